@@ -14,6 +14,12 @@ pub fn build(b: *std.Build) void {
     // set a preferred release mode, allowing the user to decide how to optimize.
     const optimize = b.standardOptimizeOption(.{});
 
+    // Emulator build options, passed to the C code as FOZBOY_* defines
+    const lazy_flags = b.option(bool, "lazy-flags", "Work out cpu flags only when they are read") orelse false;
+    const dynarec = b.option(bool, "dynarec", "Run cpu code through the x86-64 dynarec where it can") orelse false;
+
+    const c_flags = cFlags(b, lazy_flags, dynarec);
+
     // For C-only projects, we need to explicitly create a module first.
     // For Zig projects, the module is created implicitly when you provide root_source_file.
     const lib_module = b.createModule(.{
@@ -24,20 +30,47 @@ pub fn build(b: *std.Build) void {
     const core_c_files = [_][]const u8{
         "emulator/gbc.c",
         "emulator/cpu/cpu.c",
+        "emulator/cpu/dynarec.c",
+        "emulator/cpu/idle.c",
+        "emulator/cpu/instructions.c",
+        "emulator/cpu/lazy_flags.c",
         "emulator/memory/mmu.c",
+        "emulator/memory/io_regs.c",
+        "emulator/processing/dma.c",
+        "emulator/processing/palette.c",
+        "emulator/processing/pixels.c",
+        "emulator/processing/ppu.c",
+        "emulator/processing/timer.c",
         "emulator/cartridge/cart.c",
         "emulator/cartridge/ext_ram.c",
+        "emulator/cartridge/save_writer.c",
         "emulator/cartridge/mbc.c",
         "emulator/static/cart_type_data.c",
+        "emulator/static/idle_hacks.c",
+        "emulator/static/opcode_cycles.c",
+        "emulator/state/gb.c",
+        "emulator/state/scheduler.c",
     };
 
+    // ALU flag tables are generated at build time by a host tool
+    const gen_alu_tables_exe = b.addExecutable(.{
+        .name = "gen_alu_tables",
+        .root_module = b.createModule(.{
+            .root_source_file = b.path("emulator/static/alu_tables.gen.zig"),
+            .target = b.graph.host,
+        }),
+    });
+    const gen_alu_tables = b.addRunArtifact(gen_alu_tables_exe);
+    const alu_tables_c = gen_alu_tables.addOutputFileArg("alu_tables.c");
+
     // Add C source files to the module (not needed for Zig projects)
     for (core_c_files) |file_name| {
         lib_module.addCSourceFile(.{
             .file = b.path(file_name),
-            .flags = &.{ "-std=c11", "-fno-sanitize=undefined" },
+            .flags = c_flags,
         });
     }
+    lib_module.addCSourceFile(.{ .file = alu_tables_c, .flags = c_flags });
 
     lib_module.addIncludePath(b.path("emulator"));
 
@@ -58,6 +91,15 @@ pub fn build(b: *std.Build) void {
     b.getInstallStep().dependOn(&install_main_header.step);
 
     // Unit tests
+    // The machine the cpu, dynarec and part tests build, see test_gb.zig
+    const test_gb_module = b.createModule(.{
+        .target = target,
+        .optimize = optimize,
+        .root_source_file = b.path("emulator/state/test_gb.zig"),
+        .link_libc = true,
+    });
+    test_gb_module.addIncludePath(b.path("emulator"));
+
     const mbc_test_module = b.createModule(.{
         .target = target,
         .optimize = optimize,
@@ -70,20 +112,78 @@ pub fn build(b: *std.Build) void {
         .root_source_file = b.path("emulator/memory/mmu.test.zig"),
     });
 
+    const cpu_test_module = b.createModule(.{
+        .target = target,
+        .optimize = optimize,
+        .root_source_file = b.path("emulator/cpu/cpu.test.zig"),
+    });
+
+    // The cpu tests run against both flag modes, whichever -Dlazy-flags picks
+    // for the library and the other one
+    const cpu_other_test_module = b.createModule(.{
+        .target = target,
+        .optimize = optimize,
+        .root_source_file = b.path("emulator/cpu/cpu.test.zig"),
+    });
+    const other_c_flags = cFlags(b, !lazy_flags, dynarec);
+
+    // Translated code against the interpreter, skipped on hosts without a dynarec
+    const dynarec_test_module = b.createModule(.{
+        .target = target,
+        .optimize = optimize,
+        .root_source_file = b.path("emulator/cpu/dynarec.test.zig"),
+    });
+
+    // Every decode and colorize kernel the host can run against the scalar one
+    const pixels_test_module = b.createModule(.{
+        .target = target,
+        .optimize = optimize,
+        .root_source_file = b.path("emulator/processing/pixels.test.zig"),
+    });
+    pixels_test_module.addCSourceFile(.{
+        .file = b.path("emulator/processing/pixels.c"),
+        .flags = c_flags,
+    });
+    pixels_test_module.addIncludePath(b.path("emulator"));
+
     // Add C source files needed for testing
     for (core_c_files) |file_name| {
         mbc_test_module.addCSourceFile(.{
             .file = b.path(file_name),
-            .flags = &.{ "-std=c11", "-fno-sanitize=undefined" },
+            .flags = c_flags,
         });
         mmu_test_module.addCSourceFile(.{
             .file = b.path(file_name),
-            .flags = &.{ "-std=c11", "-fno-sanitize=undefined" },
+            .flags = c_flags,
+        });
+        cpu_test_module.addCSourceFile(.{
+            .file = b.path(file_name),
+            .flags = c_flags,
+        });
+        cpu_other_test_module.addCSourceFile(.{
+            .file = b.path(file_name),
+            .flags = other_c_flags,
+        });
+        dynarec_test_module.addCSourceFile(.{
+            .file = b.path(file_name),
+            .flags = c_flags,
         });
     }
+    mbc_test_module.addCSourceFile(.{ .file = alu_tables_c, .flags = c_flags });
+    mmu_test_module.addCSourceFile(.{ .file = alu_tables_c, .flags = c_flags });
+    cpu_test_module.addCSourceFile(.{ .file = alu_tables_c, .flags = c_flags });
+    cpu_other_test_module.addCSourceFile(.{ .file = alu_tables_c, .flags = other_c_flags });
+    dynarec_test_module.addCSourceFile(.{ .file = alu_tables_c, .flags = c_flags });
 
     mbc_test_module.addIncludePath(b.path("emulator"));
     mmu_test_module.addIncludePath(b.path("emulator"));
+    cpu_test_module.addIncludePath(b.path("emulator"));
+    cpu_other_test_module.addIncludePath(b.path("emulator"));
+    dynarec_test_module.addIncludePath(b.path("emulator"));
+
+    cpu_test_module.addImport("test_gb", test_gb_module);
+    cpu_other_test_module.addImport("test_gb", test_gb_module);
+    dynarec_test_module.addImport("test_gb", test_gb_module);
 
     const mbc_test_exe = b.addTest(.{
         .root_module = mbc_test_module,
@@ -91,14 +191,203 @@ pub fn build(b: *std.Build) void {
     const mmu_test_exe = b.addTest(.{
         .root_module = mmu_test_module,
     });
+    const cpu_test_exe = b.addTest(.{
+        .root_module = cpu_test_module,
+    });
+    const cpu_other_test_exe = b.addTest(.{
+        .root_module = cpu_other_test_module,
+    });
+    const dynarec_test_exe = b.addTest(.{
+        .root_module = dynarec_test_module,
+    });
+    const pixels_test_exe = b.addTest(.{
+        .root_module = pixels_test_module,
+    });
 
     mbc_test_exe.linkLibC();
     mmu_test_exe.linkLibC();
+    cpu_test_exe.linkLibC();
+    cpu_other_test_exe.linkLibC();
+    dynarec_test_exe.linkLibC();
+    pixels_test_exe.linkLibC();
 
     const run_mbc_test = b.addRunArtifact(mbc_test_exe);
     const run_mmu_test = b.addRunArtifact(mmu_test_exe);
+    const run_cpu_test = b.addRunArtifact(cpu_test_exe);
+    const run_cpu_other_test = b.addRunArtifact(cpu_other_test_exe);
+    const run_dynarec_test = b.addRunArtifact(dynarec_test_exe);
+    const run_pixels_test = b.addRunArtifact(pixels_test_exe);
 
     const test_step = b.step("test", "Run unit tests");
     test_step.dependOn(&run_mbc_test.step);
     test_step.dependOn(&run_mmu_test.step);
+    test_step.dependOn(&run_cpu_test.step);
+    test_step.dependOn(&run_cpu_other_test.step);
+    test_step.dependOn(&run_dynarec_test.step);
+    test_step.dependOn(&run_pixels_test.step);
+
+    // Tests for the parts the cpu drives, next to each part. They don't
+    // depend on the flags mode, so unlike the cpu tests they're built once
+    const part_tests = [_][]const u8{
+        "emulator/processing/dma.test.zig",
+        "emulator/processing/palette.test.zig",
+        "emulator/processing/ppu.test.zig",
+        "emulator/processing/timer.test.zig",
+    };
+    for (part_tests) |test_file| {
+        const part_test_module = b.createModule(.{
+            .target = target,
+            .optimize = optimize,
+            .root_source_file = b.path(test_file),
+        });
+        for (core_c_files) |file_name| {
+            part_test_module.addCSourceFile(.{
+                .file = b.path(file_name),
+                .flags = c_flags,
+            });
+        }
+        part_test_module.addCSourceFile(.{ .file = alu_tables_c, .flags = c_flags });
+        part_test_module.addIncludePath(b.path("emulator"));
+        part_test_module.addImport("test_gb", test_gb_module);
+
+        const part_test_exe = b.addTest(.{
+            .root_module = part_test_module,
+        });
+        part_test_exe.linkLibC();
+        test_step.dependOn(&b.addRunArtifact(part_test_exe).step);
+    }
+
+    // Benchmarks, run with `zig build bench -Doptimize=ReleaseFast`
+    const mmu_bench_module = b.createModule(.{
+        .target = target,
+        .optimize = optimize,
+    });
+
+    for (core_c_files) |file_name| {
+        mmu_bench_module.addCSourceFile(.{
+            .file = b.path(file_name),
+            .flags = c_flags,
+        });
+    }
+    mmu_bench_module.addCSourceFile(.{ .file = alu_tables_c, .flags = c_flags });
+    mmu_bench_module.addCSourceFile(.{
+        .file = b.path("emulator/memory/mmu.bench.c"),
+        .flags = c_flags,
+    });
+    mmu_bench_module.addIncludePath(b.path("emulator"));
+
+    const mmu_bench_exe = b.addExecutable(.{
+        .name = "mmu_bench",
+        .root_module = mmu_bench_module,
+    });
+    mmu_bench_exe.linkLibC();
+
+    const run_mmu_bench = b.addRunArtifact(mmu_bench_exe);
+
+    // Interpreter MIPS over roms/test, or the roms passed after `--`
+    // Compare flag modes with and without -Dlazy-flags, and the dynarec with -Ddynarec
+    const cpu_bench_module = b.createModule(.{
+        .target = target,
+        .optimize = optimize,
+    });
+
+    for (core_c_files) |file_name| {
+        cpu_bench_module.addCSourceFile(.{
+            .file = b.path(file_name),
+            .flags = c_flags,
+        });
+    }
+    cpu_bench_module.addCSourceFile(.{ .file = alu_tables_c, .flags = c_flags });
+    cpu_bench_module.addCSourceFile(.{
+        .file = b.path("emulator/cpu/cpu.bench.c"),
+        .flags = c_flags,
+    });
+    cpu_bench_module.addIncludePath(b.path("emulator"));
+
+    const cpu_bench_exe = b.addExecutable(.{
+        .name = "cpu_bench",
+        .root_module = cpu_bench_module,
+    });
+    cpu_bench_exe.linkLibC();
+
+    const run_cpu_bench = b.addRunArtifact(cpu_bench_exe);
+    run_cpu_bench.setCwd(b.path("."));
+    if (b.args) |args| {
+        run_cpu_bench.addArgs(args);
+    }
+
+    // Pixels per ns for each tile decode and colorize kernel
+    const pixels_bench_module = b.createModule(.{
+        .target = target,
+        .optimize = optimize,
+    });
+    pixels_bench_module.addCSourceFile(.{
+        .file = b.path("emulator/processing/pixels.c"),
+        .flags = c_flags,
+    });
+    pixels_bench_module.addCSourceFile(.{
+        .file = b.path("emulator/processing/pixels.bench.c"),
+        .flags = c_flags,
+    });
+    pixels_bench_module.addIncludePath(b.path("emulator"));
+
+    const pixels_bench_exe = b.addExecutable(.{
+        .name = "pixels_bench",
+        .root_module = pixels_bench_module,
+    });
+    pixels_bench_exe.linkLibC();
+
+    const run_pixels_bench = b.addRunArtifact(pixels_bench_exe);
+
+    // Sprites per line from the oam index against a scan of every sprite
+    const ppu_bench_module = b.createModule(.{
+        .target = target,
+        .optimize = optimize,
+    });
+
+    for (core_c_files) |file_name| {
+        ppu_bench_module.addCSourceFile(.{
+            .file = b.path(file_name),
+            .flags = c_flags,
+        });
+    }
+    ppu_bench_module.addCSourceFile(.{ .file = alu_tables_c, .flags = c_flags });
+    ppu_bench_module.addCSourceFile(.{
+        .file = b.path("emulator/processing/ppu.bench.c"),
+        .flags = c_flags,
+    });
+    ppu_bench_module.addIncludePath(b.path("emulator"));
+
+    const ppu_bench_exe = b.addExecutable(.{
+        .name = "ppu_bench",
+        .root_module = ppu_bench_module,
+    });
+    ppu_bench_exe.linkLibC();
+
+    const run_ppu_bench = b.addRunArtifact(ppu_bench_exe);
+
+    const bench_step = b.step("bench", "Run benchmarks");
+    bench_step.dependOn(&run_mmu_bench.step);
+    bench_step.dependOn(&run_cpu_bench.step);
+    bench_step.dependOn(&run_pixels_bench.step);
+    bench_step.dependOn(&run_ppu_bench.step);
+}
+
+// C flags for the emulator sources given the build options
+fn cFlags(b: *std.Build, lazy_flags: bool, dynarec: bool) []const []const u8 {
+    var flags: [4][]const u8 = undefined;
+    var len: usize = 0;
+    flags[len] = "-std=c11";
+    len += 1;
+    flags[len] = "-fno-sanitize=undefined";
+    len += 1;
+    if (lazy_flags) {
+        flags[len] = "-DFOZBOY_LAZY_FLAGS";
+        len += 1;
+    }
+    if (dynarec) {
+        flags[len] = "-DFOZBOY_DYNAREC";
+        len += 1;
+    }
+    return b.allocator.dupe([]const u8, flags[0..len]) catch @panic("OOM");
 }
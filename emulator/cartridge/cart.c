@@ -1,29 +1,104 @@
 // Load rom data file as virtual cartridge
 
+#define _DEFAULT_SOURCE // mmap/madvise, strdup and clock_gettime under -std=c11
+
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "cart.h"
 #include "../static/cart_type_data.h"
-#include "ext_ram.h"
-#include "mbc.h"
+#include "../util/clock.h"
 
+// Header plus the first two banks, which are mapped at power on
+#define ROM_HOT_SIZE 0x8000
 
-uint8_t load_data(cart_t* cart, char* file_name) {
+// Map the rom read-only. Nothing is read from disk here, pages fault in
+// as the mmu touches them, and processes running the same rom share them
+static int map_data(cart_t* cart, int fd, size_t size) {
+  void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return -1;
+  }
 
-  FILE* file = fopen(file_name, "rb");
-  if (!file) { return -1; }
+  // Banks get switched around freely, so readahead past what was asked
+  // for is mostly wasted. The header and first two banks are needed right away
+  madvise(data, size, MADV_RANDOM);
+  madvise(data, size < ROM_HOT_SIZE ? size : ROM_HOT_SIZE, MADV_WILLNEED);
 
-  fseek(file, 0, SEEK_END);
-  cart->size = ftell(file);
-  fseek(file, 0, SEEK_SET);
+  cart->data = data;
+  cart->size = size;
+  cart->is_mapped = true;
+  return 0;
+}
 
-  cart->data = malloc(cart->size);
-  fread(cart->data, sizeof(uint8_t), cart->size, file);
+// Fallback for anything that can't be mapped (pipes, character devices)
+static int read_data(cart_t* cart, int fd) {
+  size_t cap = ROM_HOT_SIZE;
+  size_t len = 0;
+  uint8_t* data = malloc(cap);
+  if (!data) {
+    return -1;
+  }
 
-  fclose(file);
+  for (;;) {
+    if (len == cap) {
+      uint8_t* grown = realloc(data, cap * 2);
+      if (!grown) {
+        free(data);
+        return -1;
+      }
+      data = grown;
+      cap *= 2;
+    }
+
+    ssize_t n = read(fd, data + len, cap - len);
+    if (n < 0) {
+      free(data);
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    len += n;
+  }
+
+  cart->data = data;
+  cart->size = len;
+  cart->is_mapped = false;
   return 0;
 }
 
+int load_data(cart_t* cart, char* file_name) {
+  int fd = open(file_name, O_RDONLY);
+  if (fd < 0) { return -1; }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  int res;
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    res = map_data(cart, fd, st.st_size);
+  } else {
+    res = read_data(cart, fd);
+  }
+
+  // The mapping holds its own reference to the file
+  close(fd);
+
+  // Too small to hold a header
+  if (res == 0 && cart->size <= CART_TYPE_ADDR) {
+    return -1;
+  }
+  return res;
+}
+
 bool is_in_list(uint8_t code, const uint8_t codes[], uint8_t codes_len) {
   for (int i = 0; i < codes_len; i++) {
     if (codes[i] == code) {
@@ -51,7 +126,8 @@ int load_type(cart_t* cart) {
   return -1;
 }
 
-// Sets flags like is_ram and is_batt if cart type supports those features
+// Sets flags like is_ram and is_batt if cart type supports those features,
+// and is_cgb from the cgb flag
 void load_meta_type(cart_t* cart) {
   uint8_t code = cart->data[CART_TYPE_ADDR];
 
@@ -70,29 +146,69 @@ void load_meta_type(cart_t* cart) {
   if (is_in_list(code, CODES_SENSOR, CODES_SENSOR_LEN)) {
     cart->is_sensor = true;
   }
+
+  // 0x80 for carts that also run on a dmg, 0xC0 for cgb only
+  if (cart->data[CART_CGB_ADDR] & 0x80) {
+    cart->is_cgb = true;
+  }
 }
 
-void cart_destroy(cart_t* cart) {
-  if (cart->data != NULL) {
-    free(cart->data);
+// Ram size by header code (0x149). Code 1 is 2 KiB on a few unlicensed carts
+static const uint32_t RAM_SIZES[] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+
+// Sets rom bank count and ram size from the header, rather than assuming the
+// most the mbc could support
+// Returns -1 if either size code is invalid
+int load_sizes(cart_t* cart) {
+  uint8_t rom_code = cart->data[CART_ROM_SIZE_ADDR];
+  uint8_t ram_code = cart->data[CART_RAM_SIZE_ADDR];
+
+  // 32 KiB << code, up to 8 MiB
+  if (rom_code > 8) {
+    return -1;
   }
+  cart->rom_banks = 2 << rom_code;
+  cart->rom_bank_mask = cart->rom_banks - 1;
 
-  if (cart->mbc != NULL) {
-    free(cart->mbc);
+  if (cart->cart_type == MBC2) {
+    cart->ram_size = MBC2_RAM_SIZE;
   }
+  else if (ram_code < sizeof(RAM_SIZES) / sizeof(RAM_SIZES[0])) {
+    cart->ram_size = RAM_SIZES[ram_code];
+  }
+  else {
+    return -1;
+  }
+
+  return 0;
+}
 
-  if (cart->ext_ram != NULL) {
-    ext_ram_destroy(cart->ext_ram);
+void cart_destroy(cart_t* cart) {
+  if (cart->data != NULL) {
+    if (cart->is_mapped) {
+      munmap(cart->data, cart->size);
+    } else {
+      free(cart->data);
+    }
   }
+
+  free(cart->file_name);
   free(cart);
 }
 
 cart_t* cart_create(char* file_name) {
-  cart_t* cart = malloc(sizeof(cart_t));
+  cart_t* cart = calloc(1, sizeof(cart_t));
+  if (!cart) {
+    return NULL;
+  }
+
+  uint64_t start = clock_now_ns();
   if (load_data(cart, file_name) < 0) {
     cart_destroy(cart);
     return NULL;
   }
+  uint64_t loaded = clock_now_ns();
+  cart->timing.load_ns = loaded - start;
 
   if (load_type(cart) < 0) {
     cart_destroy(cart);
@@ -101,26 +217,17 @@ cart_t* cart_create(char* file_name) {
 
   load_meta_type(cart);
 
-  cart->mbc = mbc_create(cart->cart_type);
-  if (!cart->mbc) {
+  if (load_sizes(cart) < 0) {
     cart_destroy(cart);
     return NULL;
-  } 
+  }
+  cart->timing.header_ns = clock_now_ns() - loaded;
 
-  cart->ext_ram = ext_ram_create(cart->cart_type, file_name);
-  if (!cart->ext_ram) {
+  cart->file_name = strdup(file_name);
+  if (!cart->file_name) {
     cart_destroy(cart);
     return NULL;
   }
 
   return cart;
 }
-
-uint8_t* get_ram_bank(cart_t* cart, uint8_t bank_num) {
-  // "In most MBCs, if an unmapped RAM bank is selected 
-  // (which would be translate to an out of bounds RAM address 
-  // by the MBC controller), the MBC will simply wrap around 
-  // the internal ram address and would access a valid RAM address."
-  // - https://gbdev.io/pandocs/MBCs.html#mbc-unmapped-ram-bank-access
-  return cart->ext_ram->banks[bank_num % cart->ext_ram->num_banks];
-}
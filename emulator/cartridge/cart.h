@@ -4,28 +4,45 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "../static/cart_type_data.h"
-#include "ext_ram.h"
-#include "mbc.h"
 
+#define CART_CGB_ADDR 0x0143
 #define CART_TYPE_ADDR 0x0147
+#define CART_ROM_SIZE_ADDR 0x0148
+#define CART_RAM_SIZE_ADDR 0x0149
 
+#define ROM_BANK_SIZE 0x4000
+// MBC2 has 512 half-bytes of ram built in, the header says 0
+#define MBC2_RAM_SIZE 0x200
+
+// Startup timing for cart_create, in nanoseconds
 typedef struct {
-  uint8_t* data;
+  uint64_t load_ns;
+  uint64_t header_ns;
+} cart_timing_t;
+
+// The cartridge is the read-only part, rom and header info. It can be shared
+// by several machines. Mutable cartridge state (mbc registers, ram) lives in gb_t
+
+typedef struct {
+  uint8_t* data; // read-only, mmap'd when loaded from a regular file
   long size;
+  bool is_mapped; // data came from mmap rather than malloc
   cart_type_enum cart_type;
+  uint16_t rom_banks;     // from the header, 2 << rom size code
+  uint16_t rom_bank_mask; // bank number -> bank that exists, banks are a power of two
+  uint32_t ram_size;      // from the header, 0 for no ram
+  char* file_name;
   char* program_title;
   bool is_ram;
   bool is_batt;
   bool is_timer;
   bool is_rumble;
   bool is_sensor;
-  mbc_t* mbc;
-  ext_ram_t* ext_ram;
+  bool is_cgb; // header says it uses cgb features (it may still run on a dmg)
+  cart_timing_t timing;
 } cart_t;
 
 cart_t* cart_create(char* file_name);
 void cart_destroy(cart_t* cart);
 
-uint8_t* get_ram_bank(cart_t* cart, uint8_t bank_num);
-
 #endif
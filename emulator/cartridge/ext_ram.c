@@ -1,12 +1,18 @@
+#define _DEFAULT_SOURCE // pwrite, mmap and clock_gettime under -std=c11
+
 #include "ext_ram.h"
-#include "../static/cart_type_data.h"
+#include "../util/clock.h"
+#include "save_writer.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-const uint16_t RAM_BANK_SIZE = 0xBFFF - 0xA000;
-const uint16_t SNAPSHOT_RATE = 512;
-uint16_t snapshot_counter = 0;
+const uint64_t SNAPSHOT_IDLE_MS = 500;
+const uint64_t SNAPSHOT_MAX_DELAY_MS = 5000;
 
 int get_snapshot_name(char* rom_file_name, char* buf, uint16_t buf_size) {
   const char* xdg_data_home = getenv("XDG_DATA_HOME");
@@ -33,30 +39,45 @@ int get_snapshot_name(char* rom_file_name, char* buf, uint16_t buf_size) {
   return 0;
 }
 
-void ext_ram_destroy(ext_ram_t *ram) {
-  if (ram->banks != NULL) {
+static int hand_off(ext_ram_t *ext_ram);
+static bool is_dirty(ext_ram_t *ext_ram);
 
-    for (int i = 0; i < ram->num_banks; i++) {
-      if (ram->banks[i] == NULL) {
-        break;
-      }
-      else {
-        free(ram->banks[i]);
-      }
+void ext_ram_deinit(ext_ram_t *ram) {
+  if (ram->writer != NULL) {
+    // Anything the writer can't take is written directly below
+    hand_off(ram);
+    save_writer_destroy(ram->writer);
+    ram->writer = NULL;
+  }
+
+  if (ram->data != NULL) {
+    if (is_dirty(ram)) {
+      snapshot_ram(ram);
     }
 
-    free(ram->banks);
+    if (ram->is_mapped) {
+      // MAP_SHARED, the kernel still owns writing these pages back
+      munmap(ram->data, ram->size);
+    }
+    else if (ram->owns_data) {
+      free(ram->data);
+    }
+    ram->data = NULL;
   }
 
   if (ram->snapshot_filename != NULL) {
     free(ram->snapshot_filename);
+    ram->snapshot_filename = NULL;
   }
+}
 
+void ext_ram_destroy(ext_ram_t *ram) {
+  ext_ram_deinit(ram);
   free(ram);
 }
 
 int load_snapshot(ext_ram_t* ext_ram) {
-  if (ext_ram->snapshot_filename == NULL) {
+  if (ext_ram->snapshot_filename == NULL || ext_ram->size == 0) {
     return 0;
   }
 
@@ -65,92 +86,296 @@ int load_snapshot(ext_ram_t* ext_ram) {
     return 0; // No snapshot exists yet, not an error
   }
 
-  for (int i = 0; i < ext_ram->num_banks; i++) {
-    size_t bytes_read = fread(ext_ram->banks[i], sizeof(uint8_t), RAM_BANK_SIZE, fptr);
-    if (bytes_read != RAM_BANK_SIZE) {
-      fclose(fptr);
-      return -1;
-    }
+  size_t bytes_read = fread(ext_ram->data, sizeof(uint8_t), ext_ram->size, fptr);
+  fclose(fptr);
+  if (bytes_read != ext_ram->size) {
+    return -1;
   }
 
-  fclose(fptr);
+  // Only pages written from here on need to go back to disk
+  ext_ram->file_complete = true;
   return 0;
 }
 
-ext_ram_t* ext_ram_create(cart_type_enum cart_type, char* rom_file_name) {
-  ext_ram_t* ext_ram = malloc(sizeof(ext_ram_t));
-  if (ext_ram == NULL) {
-    return NULL;
+// Map the .sav file itself as cartridge ram. Writes are plain stores into
+// the page cache and the kernel writes them back
+static int map_save(ext_ram_t* ext_ram) {
+  int fd = open(ext_ram->snapshot_filename, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return -1;
   }
 
-  ext_ram->banks = NULL;
-  ext_ram->snapshot_filename = NULL;
+  // New or short saves are zero filled up to the full size
+  struct stat st;
+  if (fstat(fd, &st) < 0 ||
+      (st.st_size < (off_t)ext_ram->size && ftruncate(fd, ext_ram->size) < 0)) {
+    close(fd);
+    return -1;
+  }
 
-  ext_ram->num_banks = CART_TYPE_MAP[cart_type].ram_banks;
-  ext_ram->banks = malloc(sizeof(uint8_t*) * ext_ram->num_banks);
-  if (ext_ram->banks == NULL) {
-    ext_ram_destroy(ext_ram);
-    return NULL;
+  void* mapping = mmap(NULL, ext_ram->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return -1;
   }
 
-  // Alloc separate banks rather than one large bank so we can easily
-  // call ext_ram[bank_num]; to get the desired ram bank
-  for (int i = 0; i < ext_ram->num_banks; i++) {
-    // calloc for 0 initialization, as carts can freely read/write here
-    ext_ram->banks[i] = calloc(1, RAM_BANK_SIZE);
-    if (ext_ram->banks[i] == NULL) {
-      ext_ram_destroy(ext_ram);
-      return NULL;
-    }
+  ext_ram->data = mapping;
+  ext_ram->is_mapped = true;
+  ext_ram->file_complete = true;
+  return 0;
+}
+
+int ext_ram_init(ext_ram_t* ext_ram, uint32_t size, uint8_t* buf,
+                 char* rom_file_name, ext_ram_backing_t backing) {
+  *ext_ram = (ext_ram_t){0};
+
+  if (size > EXT_RAM_MAX_SIZE) {
+    return -1;
   }
 
+  // Banks are only full size once there is more than one of them.
+  // Smaller rams (2 KiB, MBC2's 512 bytes) repeat through 0xA000-0xBFFF
+  ext_ram->size = size;
+  ext_ram->num_banks = size > RAM_BANK_SIZE ? size / RAM_BANK_SIZE : 1;
+  ext_ram->bank_mask = ext_ram->num_banks - 1;
+
+  // No ram on the cart, nothing to allocate or save
+  if (size == 0) {
+    return 0;
+  }
+  ext_ram->addr_mask = size < RAM_BANK_SIZE ? size - 1 : RAM_BANK_SIZE - 1;
+
   if (rom_file_name != NULL) {
     uint16_t max_path = 4096;
     char* filename = malloc(max_path);
     if (filename == NULL) {
-      ext_ram_destroy(ext_ram);
-      return NULL;
+      return -1;
     }
 
     if (get_snapshot_name(rom_file_name, filename, max_path) != 0) {
       free(filename);
-      ext_ram_destroy(ext_ram);
-      return NULL;
+      return -1;
     }
 
     ext_ram->snapshot_filename = filename;
+  }
+
+  // Falls through to the heap if the save can't be mapped
+  if (backing == EXT_RAM_MMAP && ext_ram->snapshot_filename != NULL &&
+      map_save(ext_ram) == 0) {
+    return 0;
+  }
+
+  // One buffer for every bank, get_ram_bank indexes into it.
+  // Zeroed, as carts can freely read/write here
+  if (buf != NULL) {
+    memset(buf, 0, size);
+    ext_ram->data = buf;
+  }
+  else {
+    ext_ram->data = calloc(1, size);
+    if (ext_ram->data == NULL) {
+      ext_ram_deinit(ext_ram);
+      return -1;
+    }
+    ext_ram->owns_data = true;
+  }
+
+  if (ext_ram->snapshot_filename != NULL) {
     load_snapshot(ext_ram);
+
+    // The writer starts from what is on disk now, or zeroed ram
+    ext_ram->writer = save_writer_create(ext_ram->snapshot_filename, ext_ram->data, size);
+  }
+
+  return 0;
+}
+
+ext_ram_t* ext_ram_create(uint32_t size, char* rom_file_name, ext_ram_backing_t backing) {
+  ext_ram_t* ext_ram = malloc(sizeof(ext_ram_t));
+  if (ext_ram == NULL) {
+    return NULL;
+  }
+
+  if (ext_ram_init(ext_ram, size, NULL, rom_file_name, backing) != 0) {
+    ext_ram_destroy(ext_ram);
+    return NULL;
   }
 
   return ext_ram;
 }
 
+void ext_ram_mark_dirty(ext_ram_t *ext_ram, uint16_t bank, uint16_t offset) {
+  uint32_t pos = (bank & ext_ram->bank_mask) * RAM_BANK_SIZE + (offset & ext_ram->addr_mask);
+  uint32_t page = pos >> EXT_RAM_PAGE_SHIFT;
+
+  ext_ram->dirty[page / 64] |= 1ull << (page % 64);
+  ext_ram->write_seq++;
+}
+
+static bool is_dirty(ext_ram_t *ext_ram) {
+  for (int i = 0; i < EXT_RAM_DIRTY_WORDS; i++) {
+    if (ext_ram->dirty[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool page_dirty(ext_ram_t *ext_ram, uint32_t page) {
+  return (ext_ram->dirty[page / 64] >> (page % 64)) & 1;
+}
+
+static uint32_t page_count(ext_ram_t *ext_ram) {
+  return (ext_ram->size + (1 << EXT_RAM_PAGE_SHIFT) - 1) >> EXT_RAM_PAGE_SHIFT;
+}
+
+// Finds the next run of dirty pages at or after *page, as a file range
+// [*start, *end). Advances *page past the run. Returns false when there are none
+static bool next_dirty_run(ext_ram_t *ext_ram, uint32_t* page,
+                           uint32_t* start, uint32_t* end) {
+  uint32_t num_pages = page_count(ext_ram);
+
+  while (*page < num_pages && !page_dirty(ext_ram, *page)) {
+    (*page)++;
+  }
+  if (*page >= num_pages) {
+    return false;
+  }
+
+  uint32_t run_end = *page;
+  while (run_end < num_pages && page_dirty(ext_ram, run_end)) {
+    run_end++;
+  }
+
+  *start = *page << EXT_RAM_PAGE_SHIFT;
+  *end = run_end << EXT_RAM_PAGE_SHIFT;
+  if (*end > ext_ram->size) {
+    *end = ext_ram->size;
+  }
+  *page = run_end;
+  return true;
+}
+
+static void mark_flushed(ext_ram_t *ext_ram) {
+  memset(ext_ram->dirty, 0, sizeof(ext_ram->dirty));
+  ext_ram->first_dirty_ns = 0;
+}
+
 int snapshot_ram(ext_ram_t *ext_ram) {
   if (ext_ram->snapshot_filename == NULL) {
     return 0;
   }
 
-  // overwrite file every time
-  FILE* fptr = fopen(ext_ram->snapshot_filename, "wb");
-  if (fptr == NULL) {
+  // Already in the page cache, just ask for writeback to start
+  if (ext_ram->is_mapped) {
+    if (msync(ext_ram->data, ext_ram->size, MS_ASYNC) != 0) {
+      return -1;
+    }
+    mark_flushed(ext_ram);
+    return 0;
+  }
+
+  // A missing or short file needs everything written once
+  if (!ext_ram->file_complete) {
+    for (uint32_t page = 0; page < page_count(ext_ram); page++) {
+      ext_ram->dirty[page / 64] |= 1ull << (page % 64);
+    }
+  }
+
+  if (!is_dirty(ext_ram)) {
+    return 0;
+  }
+
+  int fd = open(ext_ram->snapshot_filename, O_WRONLY | O_CREAT, 0644);
+  if (fd < 0) {
     return -1; // TODO standard errors and handling
   }
 
-  for (int i = 0; i < ext_ram->num_banks; i++) {
-    fwrite(ext_ram->banks[i],
-        sizeof(uint8_t),
-        RAM_BANK_SIZE,
-        fptr);
+  // One write per run of dirty pages
+  uint32_t page = 0, start, end;
+  while (next_dirty_run(ext_ram, &page, &start, &end)) {
+    while (start < end) {
+      ssize_t n = pwrite(fd, ext_ram->data + start, end - start, start);
+      if (n <= 0) {
+        close(fd);
+        return -1;
+      }
+      start += n;
+    }
   }
 
-  fclose(fptr);
+  close(fd);
+
+  mark_flushed(ext_ram);
+  ext_ram->file_complete = true;
   return 0;
 }
 
-int snapshot_ram_throttled(ext_ram_t *ext_ram) {
-  if (snapshot_counter++ % SNAPSHOT_RATE == 0) {
-    snapshot_counter = 0;
-    return snapshot_ram(ext_ram);
+// Copy the dirty pages into a writer slot. Returns -1 if no slot was free,
+// in which case the pages stay dirty and go with the next handoff
+static int hand_off(ext_ram_t *ext_ram) {
+  if (!is_dirty(ext_ram)) {
+    return 0;
+  }
+
+  save_slot_t* slot = save_writer_acquire(ext_ram->writer);
+  if (slot == NULL) {
+    return -1;
+  }
+
+  uint32_t page = 0, start, end;
+  while (next_dirty_run(ext_ram, &page, &start, &end)) {
+    memcpy(slot->data + start, ext_ram->data + start, end - start);
   }
+  memcpy(slot->dirty, ext_ram->dirty, sizeof(slot->dirty));
+
+  save_writer_publish(ext_ram->writer, slot);
+
+  // The writer always replaces the whole file
+  mark_flushed(ext_ram);
+  ext_ram->file_complete = true;
   return 0;
 }
+
+int snapshot_ram_throttled(ext_ram_t *ext_ram) {
+  if (!is_dirty(ext_ram)) {
+    return 0;
+  }
+
+  uint64_t now = clock_now_ns();
+
+  // Writes are only counted in the hot path, the timestamps are taken here
+  if (ext_ram->write_seq != ext_ram->seen_seq) {
+    ext_ram->seen_seq = ext_ram->write_seq;
+    ext_ram->last_write_ns = now;
+    if (ext_ram->first_dirty_ns == 0) {
+      ext_ram->first_dirty_ns = now;
+    }
+  }
+
+  uint64_t idle_ms = (now - ext_ram->last_write_ns) / 1000000;
+  uint64_t pending_ms = (now - ext_ram->first_dirty_ns) / 1000000;
+  if (idle_ms < SNAPSHOT_IDLE_MS && pending_ms < SNAPSHOT_MAX_DELAY_MS) {
+    return 0;
+  }
+
+  int res = ext_ram->writer ? hand_off(ext_ram) : snapshot_ram(ext_ram);
+  if (res != 0) {
+    // Back off for a full delay instead of retrying every call
+    ext_ram->first_dirty_ns = now;
+  }
+  return res;
+}
+
+uint8_t* get_ram_bank(ext_ram_t* ext_ram, uint8_t bank_num) {
+  // "In most MBCs, if an unmapped RAM bank is selected 
+  // (which would be translate to an out of bounds RAM address 
+  // by the MBC controller), the MBC will simply wrap around 
+  // the internal ram address and would access a valid RAM address."
+  // - https://gbdev.io/pandocs/MBCs.html#mbc-unmapped-ram-bank-access
+  if (ext_ram->data == NULL) {
+    return NULL;
+  }
+  return ext_ram->data + (bank_num & ext_ram->bank_mask) * RAM_BANK_SIZE;
+}
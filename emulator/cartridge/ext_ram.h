@@ -2,19 +2,75 @@
 #define RAM_H
 
 #include <stdint.h>
-#include "../static/cart_type_data.h"
+#include <stdbool.h>
+
+#define RAM_BANK_SIZE 0x2000
+// Largest cartridge ram, 16 banks (MBC5)
+#define EXT_RAM_MAX_SIZE (16 * RAM_BANK_SIZE)
+
+// Dirty tracking granularity, 256 bytes per bit
+#define EXT_RAM_PAGE_SHIFT 8
+#define EXT_RAM_DIRTY_WORDS ((EXT_RAM_MAX_SIZE >> EXT_RAM_PAGE_SHIFT) / 64)
+
+struct save_writer;
+
+// Where the bank memory lives
+typedef enum {
+  EXT_RAM_HEAP = 0, // on the heap, saved by the background writer
+  EXT_RAM_MMAP      // a MAP_SHARED mapping of the .sav file
+} ext_ram_backing_t;
 
 // Ext Ram is the cartridge ram
 typedef struct {
-  uint8_t** banks;
+  uint8_t* data; // every bank, back to back, as laid out in the .sav
+  uint32_t size;
   uint8_t num_banks;
+  uint8_t bank_mask;  // bank number -> valid bank, banks are a power of two
+  uint16_t addr_mask; // offset within a bank, smaller than 8 KiB for tiny rams
+  bool is_mapped;     // data is a MAP_SHARED mapping of the .sav
+  bool owns_data;     // data was allocated by ext_ram_init
   char* snapshot_filename;
+
+  // One bit per page of the save file, set by ext_ram_mark_dirty
+  uint64_t dirty[EXT_RAM_DIRTY_WORDS];
+  bool file_complete;     // the .sav on disk holds every bank
+  uint32_t write_seq;     // bumped on every write
+  uint32_t seen_seq;      // write_seq as of the last throttled check
+  uint64_t last_write_ns; // host time a change in write_seq was first seen
+  uint64_t first_dirty_ns;
+
+  // Background writer, NULL when there is no .sav, the thread couldn't start,
+  // or the banks are mapped
+  struct save_writer* writer;
 } ext_ram_t;
 
-ext_ram_t* ext_ram_create(cart_type_enum cart_type, char* rom_file_name);
+// size comes from the cartridge header (see cart_ram_size), 0 for no ram.
+// EXT_RAM_MMAP falls back to the heap when there is no rom file name or
+// the .sav can't be mapped
+ext_ram_t* ext_ram_create(uint32_t size, char* rom_file_name, ext_ram_backing_t backing);
 void ext_ram_destroy(ext_ram_t *ram);
+
+// Same as create/destroy, for an ext_ram_t that lives inside something else
+// (the machine arena). Heap backed ram uses `buf` (size bytes) if given
+int ext_ram_init(ext_ram_t* ext_ram, uint32_t size, uint8_t* buf,
+                 char* rom_file_name, ext_ram_backing_t backing);
+void ext_ram_deinit(ext_ram_t *ram);
+
+// Returns NULL if the cart has no ram
+uint8_t* get_ram_bank(ext_ram_t* ext_ram, uint8_t bank_num);
+
+// Record a write to `offset` within `bank`, called by the mmu
+void ext_ram_mark_dirty(ext_ram_t *ext_ram, uint16_t bank, uint16_t offset);
+
+// Write every dirty page to the .sav file now, on the calling thread.
+// For mapped banks this only schedules writeback (msync MS_ASYNC)
 int snapshot_ram(ext_ram_t *ext_ram);
-int shapshot_ram_throttled(ext_ram_t *ext_ram);
+
+// Cheap enough to call once per frame. Once writes have been quiet for
+// SNAPSHOT_IDLE_MS, or SNAPSHOT_MAX_DELAY_MS after the first unsaved write,
+// the dirty pages are handed to the background writer (or written directly
+// if there is none). Never waits on storage when the writer is running
+int snapshot_ram_throttled(ext_ram_t *ext_ram);
 int load_snapshot(ext_ram_t *ext_ram);
 
 #endif
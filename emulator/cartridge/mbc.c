@@ -40,12 +40,16 @@ intercept_flags_t mbc1_intercept(mbc_t* self, uint16_t addr, uint8_t data) {
   else {
     self->regs->mode = data & 0x1;
 
-    // fixed rom is switchable on bank2 register in mode 1
-    if (data == 1) {
-      flags.set_fixed_bank = true;
+    // fixed rom is switchable on bank2 register in mode 1,
+    // and goes back to bank 0 in mode 0
+    flags.set_fixed_bank = true;
+    flags.set_ram_bank = true;
+    if (self->regs->mode == 1) {
       flags.fixed_bank = regs->bank2 << 5;
-      flags.set_ram_bank = true;
       flags.ram_bank = regs->bank2;
+    } else {
+      flags.fixed_bank = 0;
+      flags.ram_bank = 0;
     }
   }
 
@@ -185,7 +189,22 @@ void mbc_destroy(mbc_t* mbc) {
 mbc_t* mbc_create(cart_type_enum cart_type) {
   mbc_t* mbc = calloc(1, sizeof(mbc_t));
   mbc_regs_t* regs = calloc(1, sizeof(mbc_regs_t));
+  if (!mbc || !regs) {
+    free(mbc);
+    free(regs);
+    return NULL;
+  }
+
+  mbc_init(mbc, regs, cart_type);
+  return mbc;
+}
+
+void mbc_init(mbc_t* mbc, mbc_regs_t* regs, cart_type_enum cart_type) {
+  *regs = (mbc_regs_t){0};
   mbc->regs = regs;
+  mbc->cart_type = cart_type;
+  // Unsupported carts behave like plain rom rather than having no handler
+  mbc->intercept = &rom_intercept;
 
   mbc->regs->latch_clock = 0xFF; // Invalid state for latch sequence
 
@@ -221,8 +240,5 @@ mbc_t* mbc_create(cart_type_enum cart_type) {
     // Not going to support pocket_cam, bandai_tama5, huc3, huc1, at least for now
     break;
   }
-
-
-  return mbc;
 }
 
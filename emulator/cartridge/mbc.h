@@ -42,4 +42,7 @@ typedef struct mbc_t {
 mbc_t* mbc_create(cart_type_enum cart_type);
 void mbc_destroy(mbc_t* mbc);
 
+// Set up an mbc in place, with registers owned by the caller
+void mbc_init(mbc_t* mbc, mbc_regs_t* regs, cart_type_enum cart_type);
+
 #endif
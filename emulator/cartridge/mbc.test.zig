@@ -128,3 +128,19 @@ test "mbc5_intercept - 9 bit bank" {
     try testing.expect(flags.set_switch_bank == true);
     try testing.expect(flags.switch_bank == 0x100);
 }
+
+test "mbc1_intercept - mode switch back to mode 0" {
+    const mbc = c.mbc_create(c.MBC1);
+    defer c.mbc_destroy(mbc);
+
+    _ = mbc.*.intercept.?(mbc, 0x4000, 0x02);
+    _ = mbc.*.intercept.?(mbc, 0x6000, 0x01);
+    const flags = mbc.*.intercept.?(mbc, 0x6000, 0x00);
+
+    // Fixed rom and ram go back to bank 0
+    try testing.expect(flags.set_fixed_bank == true);
+    try testing.expect(flags.fixed_bank == 0);
+    try testing.expect(flags.set_ram_bank == true);
+    try testing.expect(flags.ram_bank == 0);
+    try testing.expect(mbc.*.regs.*.mode == 0x00);
+}
@@ -0,0 +1,224 @@
+// Background writer for battery backed cartridge ram
+
+#define _DEFAULT_SOURCE // fsync and clock_gettime under -std=c11
+
+#include "save_writer.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// A wakeup can be missed (the signal is sent without the lock so the
+// emulation thread never blocks on it), so the writer also polls
+#define SAVE_WRITER_POLL_MS 100
+
+static int write_all(int fd, const uint8_t* buf, uint32_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n <= 0) {
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// Write the mirror to a temp file and rename it over the save, so a crash
+// mid-write leaves the previous save intact
+static int flush_image(save_writer_t* writer) {
+  int fd = open(writer->tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (write_all(fd, writer->image, writer->size) != 0 || fsync(fd) != 0) {
+    close(fd);
+    unlink(writer->tmp_filename);
+    return -1;
+  }
+  close(fd);
+
+  if (rename(writer->tmp_filename, writer->filename) != 0) {
+    unlink(writer->tmp_filename);
+    return -1;
+  }
+
+  atomic_fetch_add(&writer->bytes_written, writer->size);
+  atomic_fetch_add(&writer->flushes, 1);
+  return 0;
+}
+
+// Copy the dirty pages of a slot into the mirror
+static void apply_slot(save_writer_t* writer, save_slot_t* slot) {
+  uint32_t num_pages = (writer->size + (1 << EXT_RAM_PAGE_SHIFT) - 1) >> EXT_RAM_PAGE_SHIFT;
+
+  for (uint32_t page = 0; page < num_pages; page++) {
+    if (!((slot->dirty[page / 64] >> (page % 64)) & 1)) {
+      continue;
+    }
+
+    uint32_t start = page << EXT_RAM_PAGE_SHIFT;
+    uint32_t len = 1 << EXT_RAM_PAGE_SHIFT;
+    if (start + len > writer->size) {
+      len = writer->size - start;
+    }
+    memcpy(writer->image + start, slot->data + start, len);
+  }
+}
+
+// Take every filled slot in order. Returns false if nothing was waiting
+static bool drain_slots(save_writer_t* writer) {
+  bool any = false;
+
+  for (;;) {
+    save_slot_t* slot = &writer->slots[writer->consume_idx];
+    if (atomic_load_explicit(&slot->state, memory_order_acquire) != SAVE_SLOT_FILLED) {
+      break;
+    }
+
+    apply_slot(writer, slot);
+    atomic_store_explicit(&slot->state, SAVE_SLOT_FREE, memory_order_release);
+    atomic_fetch_sub(&writer->queue_depth, 1);
+
+    writer->consume_idx = (writer->consume_idx + 1) % SAVE_SLOT_COUNT;
+    any = true;
+  }
+
+  return any;
+}
+
+static void wait_for_work(save_writer_t* writer) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += SAVE_WRITER_POLL_MS * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&writer->lock);
+  save_slot_t* next = &writer->slots[writer->consume_idx];
+  if (!atomic_load(&writer->stop) &&
+      atomic_load_explicit(&next->state, memory_order_acquire) != SAVE_SLOT_FILLED) {
+    pthread_cond_timedwait(&writer->wake, &writer->lock, &deadline);
+  }
+  pthread_mutex_unlock(&writer->lock);
+}
+
+static void* writer_main(void* arg) {
+  save_writer_t* writer = arg;
+
+  for (;;) {
+    bool stopping = atomic_load(&writer->stop);
+
+    // Several handoffs queued up behind a slow disk become one flush
+    if (drain_slots(writer) && flush_image(writer) != 0) {
+      atomic_fetch_add(&writer->errors, 1);
+    }
+
+    if (stopping) {
+      break;
+    }
+    wait_for_work(writer);
+  }
+
+  return NULL;
+}
+
+static void free_writer(save_writer_t* writer) {
+  for (int i = 0; i < SAVE_SLOT_COUNT; i++) {
+    free(writer->slots[i].data);
+  }
+  free(writer->image);
+  free(writer->filename);
+  free(writer->tmp_filename);
+  free(writer);
+}
+
+save_writer_t* save_writer_create(const char* filename, const uint8_t* initial, uint32_t size) {
+  save_writer_t* writer = calloc(1, sizeof(save_writer_t));
+  if (!writer) {
+    return NULL;
+  }
+
+  writer->size = size;
+  writer->image = malloc(size);
+  writer->filename = strdup(filename);
+  writer->tmp_filename = malloc(strlen(filename) + sizeof(".tmp"));
+  if (!writer->image || !writer->filename || !writer->tmp_filename) {
+    free_writer(writer);
+    return NULL;
+  }
+  memcpy(writer->image, initial, size);
+  strcpy(writer->tmp_filename, filename);
+  strcat(writer->tmp_filename, ".tmp");
+
+  for (int i = 0; i < SAVE_SLOT_COUNT; i++) {
+    writer->slots[i].data = malloc(size);
+    if (!writer->slots[i].data) {
+      free_writer(writer);
+      return NULL;
+    }
+    atomic_init(&writer->slots[i].state, SAVE_SLOT_FREE);
+  }
+
+  pthread_mutex_init(&writer->lock, NULL);
+  pthread_cond_init(&writer->wake, NULL);
+
+  if (pthread_create(&writer->thread, NULL, writer_main, writer) != 0) {
+    pthread_cond_destroy(&writer->wake);
+    pthread_mutex_destroy(&writer->lock);
+    free_writer(writer);
+    return NULL;
+  }
+
+  return writer;
+}
+
+void save_writer_destroy(save_writer_t* writer) {
+  if (!writer) return;
+
+  atomic_store(&writer->stop, true);
+  pthread_mutex_lock(&writer->lock);
+  pthread_cond_signal(&writer->wake);
+  pthread_mutex_unlock(&writer->lock);
+  pthread_join(writer->thread, NULL);
+
+  pthread_cond_destroy(&writer->wake);
+  pthread_mutex_destroy(&writer->lock);
+  free_writer(writer);
+}
+
+save_slot_t* save_writer_acquire(save_writer_t* writer) {
+  save_slot_t* slot = &writer->slots[writer->produce_idx];
+
+  if (atomic_load_explicit(&slot->state, memory_order_acquire) != SAVE_SLOT_FREE) {
+    atomic_fetch_add(&writer->deferred, 1);
+    return NULL;
+  }
+
+  memset(slot->dirty, 0, sizeof(slot->dirty));
+  return slot;
+}
+
+void save_writer_publish(save_writer_t* writer, save_slot_t* slot) {
+  atomic_fetch_add(&writer->queue_depth, 1);
+  atomic_store_explicit(&slot->state, SAVE_SLOT_FILLED, memory_order_release);
+  writer->produce_idx = (writer->produce_idx + 1) % SAVE_SLOT_COUNT;
+
+  // Deliberately not taking the lock, the writer's poll covers a lost wakeup
+  pthread_cond_signal(&writer->wake);
+}
+
+save_writer_stats_t save_writer_stats(save_writer_t* writer) {
+  return (save_writer_stats_t){
+    .queue_depth = atomic_load(&writer->queue_depth),
+    .bytes_written = atomic_load(&writer->bytes_written),
+    .flushes = atomic_load(&writer->flushes),
+    .deferred = atomic_load(&writer->deferred),
+    .errors = atomic_load(&writer->errors),
+  };
+}
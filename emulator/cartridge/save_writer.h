@@ -0,0 +1,76 @@
+#ifndef SAVE_WRITER_H
+#define SAVE_WRITER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "ext_ram.h"
+
+// Background persistence for cartridge ram.
+// The emulation thread copies dirty pages into one of two slots and publishes
+// it with an atomic store. The writer thread folds the pages into its own
+// mirror of the save and replaces the .sav file with write-temp-then-rename.
+// Nothing on the emulation side ever waits on the writer or on storage.
+
+#define SAVE_SLOT_COUNT 2
+
+typedef enum {
+  SAVE_SLOT_FREE = 0,
+  SAVE_SLOT_FILLED
+} save_slot_state_t;
+
+typedef struct {
+  uint8_t* data; // file layout, only dirty pages are meaningful
+  uint64_t dirty[EXT_RAM_DIRTY_WORDS];
+  _Atomic int state;
+} save_slot_t;
+
+// Counters for monitoring, safe to read from any thread
+typedef struct {
+  uint32_t queue_depth;   // slots waiting for the writer
+  uint64_t bytes_written; // bytes written to disk
+  uint64_t flushes;       // completed .sav replacements
+  uint64_t deferred;      // handoffs put off because both slots were in flight
+  uint64_t errors;        // failed flushes
+} save_writer_stats_t;
+
+typedef struct save_writer {
+  pthread_t thread;
+  pthread_mutex_t lock; // only guards the wakeup, not the slots
+  pthread_cond_t wake;
+
+  save_slot_t slots[SAVE_SLOT_COUNT];
+  uint32_t produce_idx; // emulation thread only
+  uint32_t consume_idx; // writer thread only
+
+  uint8_t* image; // writer thread's copy of the whole save
+  uint32_t size;
+  char* filename;
+  char* tmp_filename;
+  _Atomic bool stop;
+
+  _Atomic uint32_t queue_depth;
+  _Atomic uint64_t bytes_written;
+  _Atomic uint64_t flushes;
+  _Atomic uint64_t deferred;
+  _Atomic uint64_t errors;
+} save_writer_t;
+
+// Starts the writer thread. `initial` is the save as currently on disk (or
+// zeroed ram), `size` bytes long. Returns NULL if the thread can't be started
+save_writer_t* save_writer_create(const char* filename, const uint8_t* initial, uint32_t size);
+
+// Writes out anything already handed off, then stops and frees the writer
+void save_writer_destroy(save_writer_t* writer);
+
+// Emulation thread: get the next slot to fill, or NULL if the writer is
+// still busy with it. Never blocks
+save_slot_t* save_writer_acquire(save_writer_t* writer);
+
+// Emulation thread: hand a filled slot to the writer
+void save_writer_publish(save_writer_t* writer, save_slot_t* slot);
+
+save_writer_stats_t save_writer_stats(save_writer_t* writer);
+
+#endif
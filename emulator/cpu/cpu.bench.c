@@ -0,0 +1,141 @@
+// Measures interpreter throughput in MIPS over the test roms
+// Run with `zig build bench -Doptimize=ReleaseFast`, roms are taken from
+// roms/test unless paths are passed after `--`
+
+#define _DEFAULT_SOURCE // opendir and clock_gettime under -std=c11
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "dynarec.h"
+#include "../cartridge/cart.h"
+#include "../state/gb.h"
+#include "../util/clock.h"
+
+#define ROM_DIR "roms/test"
+#define FRAMES 3600 // one minute of emulated time
+
+static void bench(const char* name, gb_t* gb) {
+  uint64_t start = clock_now_ns();
+  for (int i = 0; i < FRAMES; i++) {
+#ifdef FOZBOY_DYNAREC
+    dynarec_run_cycles(gb, GB_CYCLES_PER_FRAME);
+#else
+    cpu_run_cycles(gb, GB_CYCLES_PER_FRAME);
+#endif
+  }
+  double secs = (clock_now_ns() - start) / 1e9;
+
+  printf("%-40s %8.1f MIPS %7.1fx realtime %6llu halt cycles skipped/frame\n", name,
+         gb->instructions / secs / 1e6, FRAMES / 59.7275 / secs,
+         (unsigned long long)(gb->halt_skipped / FRAMES));
+  printf("%-40s idle loops: %llu skips (%llu from the db), %llu cycles skipped/frame\n", "",
+         (unsigned long long)gb->idle.skips, (unsigned long long)gb->idle.db_hits,
+         (unsigned long long)(gb->idle.skipped_cycles / FRAMES));
+#ifdef FOZBOY_DYNAREC
+  dynarec_print_stats(gb, stdout);
+#endif
+}
+
+static int bench_file(char* path) {
+  cart_t* cart = cart_create(path);
+  if (!cart) {
+    fprintf(stderr, "%s: couldn't load\n", path);
+    return -1;
+  }
+
+  gb_t* gb = gb_create(cart);
+  if (!gb) {
+    cart_destroy(cart);
+    return -1;
+  }
+
+  const char* name = strrchr(path, '/');
+  bench(name ? name + 1 : path, gb);
+
+  gb_destroy(gb);
+  cart_destroy(cart);
+  return 0;
+}
+
+static bool is_rom(const char* name) {
+  const char* ext = strrchr(name, '.');
+  return ext && (strcmp(ext, ".gb") == 0 || strcmp(ext, ".gbc") == 0);
+}
+
+static int bench_dir(const char* dir_path) {
+  DIR* dir = opendir(dir_path);
+  if (!dir) {
+    return 0;
+  }
+
+  int count = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (!is_rom(entry->d_name)) {
+      continue;
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+    if (bench_file(path) == 0) {
+      count++;
+    }
+  }
+
+  closedir(dir);
+  return count;
+}
+
+// Without any roms, run a small loop of loads, alu ops and branches
+static void bench_synthetic(void) {
+  static const uint8_t program[] = {
+    0x21, 0x00, 0xC0, // LD HL, C000
+    0x11, 0x00, 0x10, // LD DE, 1000
+    0x2A,             // loop: LD A, (HL+)
+    0x80,             // ADD A, B
+    0x47,             // LD B, A
+    0xA9,             // XOR C
+    0x32,             // LD (HL-), A
+    0x23,             // INC HL
+    0x0C,             // INC C
+    0xCB, 0x11,       // RL C
+    0x1B,             // DEC DE
+    0x7A,             // LD A, D
+    0xB3,             // OR E
+    0x20, 0xF2,       // JR NZ, loop
+    0xC3, 0x00, 0x01, // JP 0100
+  };
+
+  cart_t cart = {0};
+  cart.cart_type = ROM;
+  cart.size = 0x8000;
+  cart.rom_banks = 2;
+  cart.rom_bank_mask = 1;
+  cart.data = calloc(cart.size, 1);
+  memcpy(cart.data + 0x100, program, sizeof(program));
+
+  gb_t* gb = gb_create(&cart);
+  if (gb) {
+    bench("synthetic loop (no roms in " ROM_DIR ")", gb);
+    gb_destroy(gb);
+  }
+  free(cart.data);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      bench_file(argv[i]);
+    }
+    return 0;
+  }
+
+  if (bench_dir(ROM_DIR) == 0) {
+    bench_synthetic();
+  }
+  return 0;
+}
@@ -1,22 +1,25 @@
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-// CPU state (registers, flags)
-
-typedef struct {
-	uint8_t a;
-	uint8_t b;
-	uint8_t c;
-	uint8_t d;
-	uint8_t e;
-	uint8_t f; // only to be used for flags
-	uint8_t h;
-	uint8_t l;
-	uint16_t sp; // Stack Pointer
-	uint16_t pc; // Program Counter
-	bool ime;    // Interrupt Master Enable
-	bool halted; // Halt State
-} Cpu;
+#include "cpu.h"
+#include "idle.h"
+#include "instructions.h"
+#include "lazy_flags.h"
+#include "../memory/mmu.h"
+#include "../state/gb.h"
+#include "../static/alu_tables.h"
+#include "../static/opcode_cycles.h"
+
+// CPU state (registers, flags) lives in Cpu, see cpu.h. This file is the
+// fetch/decode loop, the instructions themselves are in instructions.c
+
+// With computed goto every handler jumps straight to the next opcode's
+// handler, so each has its own indirect branch for the predictor to learn.
+// Otherwise it's a plain switch, which compilers turn into a jump table
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(FOZBOY_NO_COMPUTED_GOTO)
+#define CPU_COMPUTED_GOTO
+#endif
 
 void cpu_init(Cpu *cpu) {
 	cpu->a = 0;
@@ -31,4 +34,689 @@ void cpu_init(Cpu *cpu) {
 	cpu->pc = 0;
 	cpu->ime = false;
 	cpu->halted = false;
+	cpu->ei_pending = false;
+	cpu->halt_bug = false;
+	cpu->lazy = (lazy_flags_t){0};
+}
+
+// https://gbdev.io/pandocs/Power_Up_Sequence.html#cpu-registers
+void cpu_skip_boot(Cpu *cpu) {
+	cpu_init(cpu);
+	cpu->a = 0x01;
+	cpu->f = 0xB0;
+	cpu->b = 0x00;
+	cpu->c = 0x13;
+	cpu->d = 0x00;
+	cpu->e = 0xD8;
+	cpu->h = 0x01;
+	cpu->l = 0x4D;
+	cpu->sp = 0xFFFE;
+	cpu->pc = 0x0100;
+}
+
+// Register pairs are stored as separate bytes
+#define BC ((uint16_t)(cpu->b << 8 | cpu->c))
+#define DE ((uint16_t)(cpu->d << 8 | cpu->e))
+#define HL ((uint16_t)(cpu->h << 8 | cpu->l))
+#define AF ((uint16_t)(cpu->a << 8 | cpu->f))
+#define SET_PAIR(hi, lo, val)                                                  \
+	do {                                                                   \
+		uint16_t pair_ = (val);                                        \
+		cpu->hi = pair_ >> 8;                                          \
+		cpu->lo = (uint8_t)pair_;                                      \
+	} while (0)
+
+#define READ(address) mmu_read_fast(mmu, (address))
+#define WRITE(address, val) mmu_write_fast(mmu, (address), (val))
+#define IMM8() READ(cpu->pc++)
+
+static inline uint16_t imm16(Cpu *cpu, mmu_t *mmu) {
+	uint8_t low = READ(cpu->pc++);
+	uint8_t high = READ(cpu->pc++);
+	return (uint16_t)(high << 8 | low);
+}
+
+#define CARRY_BIT() ((cpu->f >> 4) & 1)
+
+// Flag setting alu ops on A, INC/DEC and flag reads for conditions
+#ifdef FOZBOY_LAZY_FLAGS
+#define ALU_ADD(val) lazy_add(&cpu->lazy, &cpu->a, (val))
+#define ALU_ADC(val) lazy_adc(&cpu->lazy, cpu->f, &cpu->a, (val))
+#define ALU_SUB(val) lazy_sub(&cpu->lazy, &cpu->a, (val))
+#define ALU_SBC(val) lazy_sbc(&cpu->lazy, cpu->f, &cpu->a, (val))
+#define ALU_AND(val) lazy_and(&cpu->lazy, &cpu->a, (val))
+#define ALU_XOR(val) lazy_xor(&cpu->lazy, &cpu->a, (val))
+#define ALU_OR(val) lazy_or(&cpu->lazy, &cpu->a, (val))
+#define ALU_CP(val) lazy_cp(&cpu->lazy, cpu->a, (val))
+#define INC(reg) lazy_incr(&cpu->lazy, cpu->f, &(reg))
+#define DEC(reg) lazy_decr(&cpu->lazy, cpu->f, &(reg))
+#define FLAG_ZERO() lazy_flag_z(&cpu->lazy, cpu->f)
+#define FLAG_CARRY() lazy_flag_c(&cpu->lazy, cpu->f)
+
+// Brings F up to date, for everything else that reads or keeps part of it
+#define SYNC_FLAGS()                                                           \
+	do {                                                                   \
+		if (cpu->lazy.op != LAZY_NONE) {                               \
+			cpu->f = lazy_flags_resolve(&cpu->lazy, cpu->f);       \
+			cpu->lazy.op = LAZY_NONE;                              \
+		}                                                              \
+	} while (0)
+#else
+// Flags come from the generated tables, see static/alu_tables.h
+#define ALU_ADD(val)                                                           \
+	do {                                                                   \
+		uint8_t val_ = (val);                                          \
+		cpu->f = ALU_ADD_FLAGS[cpu->a << 8 | val_];                    \
+		cpu->a += val_;                                                \
+	} while (0)
+#define ALU_ADC(val)                                                           \
+	do {                                                                   \
+		uint8_t val_ = (val);                                          \
+		uint8_t carry_ = CARRY_BIT();                                  \
+		cpu->f = ALU_ADD_FLAGS[carry_ << 16 | cpu->a << 8 | val_];     \
+		cpu->a += val_ + carry_;                                       \
+	} while (0)
+#define ALU_SUB(val)                                                           \
+	do {                                                                   \
+		uint8_t val_ = (val);                                          \
+		cpu->f = ALU_SUB_FLAGS[cpu->a << 8 | val_];                    \
+		cpu->a -= val_;                                                \
+	} while (0)
+#define ALU_SBC(val)                                                           \
+	do {                                                                   \
+		uint8_t val_ = (val);                                          \
+		uint8_t carry_ = CARRY_BIT();                                  \
+		cpu->f = ALU_SUB_FLAGS[carry_ << 16 | cpu->a << 8 | val_];     \
+		cpu->a -= val_ + carry_;                                       \
+	} while (0)
+#define ALU_CP(val) cpu->f = ALU_SUB_FLAGS[cpu->a << 8 | (val)]
+#define ALU_AND(val)                                                           \
+	do {                                                                   \
+		cpu->a &= (val);                                               \
+		cpu->f = cpu->a ? FLAG_H : FLAG_Z | FLAG_H;                    \
+	} while (0)
+#define ALU_XOR(val)                                                           \
+	do {                                                                   \
+		cpu->a ^= (val);                                               \
+		cpu->f = cpu->a ? 0 : FLAG_Z;                                  \
+	} while (0)
+#define ALU_OR(val)                                                            \
+	do {                                                                   \
+		cpu->a |= (val);                                               \
+		cpu->f = cpu->a ? 0 : FLAG_Z;                                  \
+	} while (0)
+#define INC(reg)                                                               \
+	do {                                                                   \
+		cpu->f = (cpu->f & FLAG_C) | ALU_INC_FLAGS[reg];               \
+		(reg)++;                                                       \
+	} while (0)
+#define DEC(reg)                                                               \
+	do {                                                                   \
+		cpu->f = (cpu->f & FLAG_C) | ALU_DEC_FLAGS[reg];               \
+		(reg)--;                                                       \
+	} while (0)
+#define FLAG_ZERO() (cpu->f & FLAG_Z)
+#define FLAG_CARRY() (cpu->f & FLAG_C)
+#define SYNC_FLAGS() ((void)0)
+#endif
+
+// Rotates and shifts by their CB opcode order, the A only versions clear Z
+enum { SHIFT_RLC = 0, SHIFT_RRC, SHIFT_RL, SHIFT_RR, SHIFT_SLA, SHIFT_SRA, SHIFT_SWAP, SHIFT_SRL };
+
+#define SHIFT(op, reg)                                                         \
+	do {                                                                   \
+		uint16_t shift_ = ALU_SHIFT[(op) << 9 | CARRY_BIT() << 8 | (reg)]; \
+		(reg) = shift_ >> 8;                                           \
+		cpu->f = (uint8_t)shift_;                                      \
+	} while (0)
+#define ROTATE_A(op)                                                           \
+	do {                                                                   \
+		SHIFT(op, cpu->a);                                             \
+		cpu->f &= ~FLAG_Z;                                             \
+	} while (0)
+
+#define DAA()                                                                  \
+	do {                                                                   \
+		uint16_t daa_ = ALU_DAA[((cpu->f >> 4) & 7) << 8 | cpu->a];    \
+		cpu->a = daa_ >> 8;                                            \
+		cpu->f = (uint8_t)daa_;                                        \
+	} while (0)
+
+// INC/DEC (HL) go through a temporary
+#define INC_MEM()                                                              \
+	do {                                                                   \
+		uint8_t val_ = READ(HL);                                       \
+		INC(val_);                                  \
+		WRITE(HL, val_);                                               \
+	} while (0)
+#define DEC_MEM()                                                              \
+	do {                                                                   \
+		uint8_t val_ = READ(HL);                                       \
+		DEC(val_);                                  \
+		WRITE(HL, val_);                                               \
+	} while (0)
+
+#define ADD_HL(val)                                                            \
+	do {                                                                   \
+		uint16_t hl_ = HL;                                             \
+		SYNC_FLAGS();                                                  \
+		execute_add_16(&hl_, (val), &cpu->f);                          \
+		SET_PAIR(h, l, hl_);                                           \
+	} while (0)
+
+#define PUSH(val)                                                              \
+	do {                                                                   \
+		uint16_t val_ = (val);                                         \
+		execute_push(&val_, &cpu->sp, mmu);                            \
+	} while (0)
+#define POP(hi, lo)                                                            \
+	do {                                                                   \
+		uint16_t val_;                                                 \
+		execute_pop(&val_, &cpu->sp, mmu);                             \
+		SET_PAIR(hi, lo, val_);                                        \
+	} while (0)
+
+// Backward jumps that are known not to close an idle loop (most of them)
+// are answered from the cache without a call, see cpu/idle.h
+static inline void idle_check(gb_t *gb, uint16_t from) {
+	idle_loop_t *loop = &gb->idle.loops[from & (IDLE_CACHE_SIZE - 1)];
+	if (loop->from == from && !loop->idle &&
+	    loop->page == gb->mmu.read_pages[from >> MMU_PAGE_SHIFT]) {
+		return;
+	}
+	idle_jumped_back(gb, from);
+}
+
+// Conditional control flow, taken branches cost extra
+#define TAKEN() gb->cycles += OPCODE_BRANCH_CYCLES[op]
+#define JR_IF(cond)                                                            \
+	do {                                                                   \
+		int8_t offset_ = (int8_t)IMM8();                               \
+		if (cond) {                                                    \
+			execute_jr(&cpu->pc, offset_);                         \
+			TAKEN();                                               \
+			if (offset_ < 0) {                                     \
+				idle_check(gb, cpu->pc - offset_ - 2);         \
+			}                                                      \
+		}                                                              \
+	} while (0)
+#define JP_IF(cond)                                                            \
+	do {                                                                   \
+		uint16_t address_ = imm16(cpu, mmu);                           \
+		if (cond) {                                                    \
+			execute_jp(&cpu->pc, address_);                        \
+			TAKEN();                                               \
+		}                                                              \
+	} while (0)
+#define CALL_IF(cond)                                                          \
+	do {                                                                   \
+		uint16_t address_ = imm16(cpu, mmu);                           \
+		if (cond) {                                                    \
+			execute_call(&cpu->pc, &cpu->sp, address_, mmu);       \
+			TAKEN();                                               \
+		}                                                              \
+	} while (0)
+#define RET_IF(cond)                                                           \
+	do {                                                                   \
+		if (cond) {                                                    \
+			execute_pop(&cpu->pc, &cpu->sp, mmu);                  \
+			TAKEN();                                               \
+		}                                                              \
+	} while (0)
+#define RST(address) execute_call(&cpu->pc, &cpu->sp, (address), mmu)
+
+// ADD SP, e8 and LD HL, SP+e8. Flags come from the unsigned add of the low
+// byte, sets flags 00HC
+static inline uint16_t sp_offset(Cpu *cpu, int8_t offset) {
+	uint8_t val = (uint8_t)offset;
+
+	cpu->f = 0;
+	if ((cpu->sp & 0x0F) + (val & 0x0F) > 0x0F) {
+		cpu->f |= FLAG_H;
+	}
+	if ((cpu->sp & 0xFF) + val > 0xFF) {
+		cpu->f |= FLAG_C;
+	}
+	return cpu->sp + offset;
+}
+
+// CB prefixed opcodes are regular, bits 0-2 pick the operand (B, C, D, E,
+// H, L, (HL), A), bits 3-5 the shift op or bit number, bits 6-7 the group
+static const uint8_t REG_OFFSETS[8] = {
+	offsetof(Cpu, b), offsetof(Cpu, c), offsetof(Cpu, d), offsetof(Cpu, e),
+	offsetof(Cpu, h), offsetof(Cpu, l), 0, offsetof(Cpu, a),
+};
+
+static inline void execute_cb(Cpu *cpu, mmu_t *mmu, uint8_t cb) {
+	uint8_t reg = cb & 7;
+	uint8_t bit = (cb >> 3) & 7;
+	uint8_t val = reg == 6 ? READ(HL) : *((uint8_t *)cpu + REG_OFFSETS[reg]);
+
+	switch (cb >> 6) {
+	case 0:
+		SHIFT(bit, val);
+		break;
+	case 1:
+		// BIT only reads
+		execute_bit(bit, val, &cpu->f);
+		return;
+	case 2:
+		execute_res(bit, &val);
+		break;
+	case 3:
+		execute_set(bit, &val);
+		break;
+	}
+
+	if (reg == 6) {
+		WRITE(HL, val);
+	} else {
+		*((uint8_t *)cpu + REG_OFFSETS[reg]) = val;
+	}
+}
+
+// Pushes pc and jumps to the highest priority pending interrupt
+// Returns the t-cycles taken
+static int service_interrupt(Cpu *cpu, mmu_t *mmu, uint8_t pending) {
+	uint8_t num = 0;
+	while (!(pending & (1 << num))) {
+		num++;
+	}
+
+	mmu_ack_interrupt(mmu, 1 << num);
+	cpu->ime = false;
+	execute_call(&cpu->pc, &cpu->sp, 0x40 + num * 8, mmu);
+	return 20;
+}
+
+#ifdef CPU_COMPUTED_GOTO
+#define OP(hi, lo) op_##hi##lo:
+#define OP_ROW(hi)                                                             \
+	&&op_##hi##0, &&op_##hi##1, &&op_##hi##2, &&op_##hi##3,                \
+	&&op_##hi##4, &&op_##hi##5, &&op_##hi##6, &&op_##hi##7,                \
+	&&op_##hi##8, &&op_##hi##9, &&op_##hi##A, &&op_##hi##B,                \
+	&&op_##hi##C, &&op_##hi##D, &&op_##hi##E, &&op_##hi##F
+
+// Fetch and dispatch the next opcode right here. Anything that needs a look
+// outside the instruction stream (an event or the budget due, an interrupt to
+// take) is a deadline, and goes back through the top of the loop
+#define NEXT                                                                   \
+	do {                                                                   \
+		if (gb->cycles >= sched->next) {                               \
+			goto top;                                              \
+		}                                                              \
+		op = READ(cpu->pc++);                                          \
+		gb->cycles += OPCODE_CYCLES[op];                               \
+		gb->instructions++;                                            \
+		goto *OPS[op];                                                 \
+	} while (0)
+#else
+#define OP(hi, lo) case 0x##hi##lo:
+#define NEXT goto top
+#endif
+
+int cpu_step(gb_t *gb) {
+	return (int)cpu_run_cycles(gb, 1);
+}
+
+uint64_t cpu_run_cycles(gb_t *gb, uint64_t budget) {
+	Cpu *cpu = &gb->cpu;
+	mmu_t *mmu = &gb->mmu;
+	scheduler_t *sched = &gb->sched;
+	uint64_t start = gb->cycles;
+	uint8_t op;
+
+	// The budget is an event like any other, so there's a single deadline to
+	// check. An outer run's end is put back after, the dynarec steps through
+	// here from inside its own run
+	uint64_t outer_end = sched->at[SCHED_END];
+	scheduler_set(sched, SCHED_END, start + budget);
+
+#ifdef CPU_COMPUTED_GOTO
+	static const void *const OPS[256] = {
+		OP_ROW(0), OP_ROW(1), OP_ROW(2), OP_ROW(3),
+		OP_ROW(4), OP_ROW(5), OP_ROW(6), OP_ROW(7),
+		OP_ROW(8), OP_ROW(9), OP_ROW(A), OP_ROW(B),
+		OP_ROW(C), OP_ROW(D), OP_ROW(E), OP_ROW(F),
+	};
+#endif
+
+top:
+	if (gb->cycles >= sched->next && scheduler_run_due(gb)) {
+		SYNC_FLAGS();
+		scheduler_set(sched, SCHED_END, outer_end);
+		return gb->cycles - start;
+	}
+
+	uint8_t pending = mmu->int_pending;
+	if (cpu->halted) {
+		if (!pending) {
+			// Only an event can raise an interrupt now, so skip straight to
+			// the next one, in whole m-cycles as if idling through them
+			uint64_t skip = (sched->next - gb->cycles + 3) & ~(uint64_t)3;
+			gb->cycles += skip;
+			gb->halt_skipped += skip;
+			goto top;
+		}
+		// Any pending interrupt wakes the cpu, even with IME off
+		cpu->halted = false;
+	}
+	if (cpu->ime && pending) {
+		gb->cycles += service_interrupt(cpu, mmu, pending);
+		goto top;
+	}
+	// Checked after interrupts, so the instruction after EI always runs. One
+	// already pending is taken right after it
+	if (cpu->ei_pending) {
+		cpu->ei_pending = false;
+		cpu->ime = true;
+		if (pending) {
+			scheduler_set(sched, SCHED_INTERRUPT, gb->cycles);
+		}
+	}
+
+	op = READ(cpu->pc++);
+	if (cpu->halt_bug) {
+		cpu->halt_bug = false;
+		cpu->pc--;
+	}
+	gb->cycles += OPCODE_CYCLES[op];
+	gb->instructions++;
+
+#ifdef CPU_COMPUTED_GOTO
+	goto *OPS[op];
+#else
+	switch (op) {
+#endif
+
+	OP(0, 0) NEXT; // NOP
+	OP(0, 1) SET_PAIR(b, c, imm16(cpu, mmu)); NEXT;
+	OP(0, 2) WRITE(BC, cpu->a); NEXT;
+	OP(0, 3) SET_PAIR(b, c, BC + 1); NEXT;
+	OP(0, 4) INC(cpu->b); NEXT;
+	OP(0, 5) DEC(cpu->b); NEXT;
+	OP(0, 6) cpu->b = IMM8(); NEXT;
+	OP(0, 7) SYNC_FLAGS(); ROTATE_A(SHIFT_RLC); NEXT;
+	OP(0, 8) {
+		uint16_t address = imm16(cpu, mmu);
+		WRITE(address, (uint8_t)cpu->sp);
+		WRITE(address + 1, cpu->sp >> 8);
+		NEXT;
+	}
+	OP(0, 9) ADD_HL(BC); NEXT;
+	OP(0, A) cpu->a = READ(BC); NEXT;
+	OP(0, B) SET_PAIR(b, c, BC - 1); NEXT;
+	OP(0, C) INC(cpu->c); NEXT;
+	OP(0, D) DEC(cpu->c); NEXT;
+	OP(0, E) cpu->c = IMM8(); NEXT;
+	OP(0, F) SYNC_FLAGS(); ROTATE_A(SHIFT_RRC); NEXT;
+
+	// STOP is two bytes. Low power mode and the cgb speed switch aren't
+	// emulated yet, so for now it's skipped over
+	OP(1, 0) cpu->pc++; NEXT;
+	OP(1, 1) SET_PAIR(d, e, imm16(cpu, mmu)); NEXT;
+	OP(1, 2) WRITE(DE, cpu->a); NEXT;
+	OP(1, 3) SET_PAIR(d, e, DE + 1); NEXT;
+	OP(1, 4) INC(cpu->d); NEXT;
+	OP(1, 5) DEC(cpu->d); NEXT;
+	OP(1, 6) cpu->d = IMM8(); NEXT;
+	OP(1, 7) SYNC_FLAGS(); ROTATE_A(SHIFT_RL); NEXT;
+	OP(1, 8) JR_IF(true); NEXT;
+	OP(1, 9) ADD_HL(DE); NEXT;
+	OP(1, A) cpu->a = READ(DE); NEXT;
+	OP(1, B) SET_PAIR(d, e, DE - 1); NEXT;
+	OP(1, C) INC(cpu->e); NEXT;
+	OP(1, D) DEC(cpu->e); NEXT;
+	OP(1, E) cpu->e = IMM8(); NEXT;
+	OP(1, F) SYNC_FLAGS(); ROTATE_A(SHIFT_RR); NEXT;
+
+	OP(2, 0) JR_IF(!FLAG_ZERO()); NEXT;
+	OP(2, 1) SET_PAIR(h, l, imm16(cpu, mmu)); NEXT;
+	OP(2, 2) WRITE(HL, cpu->a); SET_PAIR(h, l, HL + 1); NEXT;
+	OP(2, 3) SET_PAIR(h, l, HL + 1); NEXT;
+	OP(2, 4) INC(cpu->h); NEXT;
+	OP(2, 5) DEC(cpu->h); NEXT;
+	OP(2, 6) cpu->h = IMM8(); NEXT;
+	OP(2, 7) SYNC_FLAGS(); DAA(); NEXT;
+	OP(2, 8) JR_IF(FLAG_ZERO()); NEXT;
+	OP(2, 9) ADD_HL(HL); NEXT;
+	OP(2, A) cpu->a = READ(HL); SET_PAIR(h, l, HL + 1); NEXT;
+	OP(2, B) SET_PAIR(h, l, HL - 1); NEXT;
+	OP(2, C) INC(cpu->l); NEXT;
+	OP(2, D) DEC(cpu->l); NEXT;
+	OP(2, E) cpu->l = IMM8(); NEXT;
+	OP(2, F) SYNC_FLAGS(); execute_cpl(&cpu->a, &cpu->f); NEXT;
+
+	OP(3, 0) JR_IF(!FLAG_CARRY()); NEXT;
+	OP(3, 1) cpu->sp = imm16(cpu, mmu); NEXT;
+	OP(3, 2) WRITE(HL, cpu->a); SET_PAIR(h, l, HL - 1); NEXT;
+	OP(3, 3) cpu->sp++; NEXT;
+	OP(3, 4) INC_MEM(); NEXT;
+	OP(3, 5) DEC_MEM(); NEXT;
+	OP(3, 6) WRITE(HL, IMM8()); NEXT;
+	OP(3, 7) SYNC_FLAGS(); execute_scf(&cpu->f); NEXT;
+	OP(3, 8) JR_IF(FLAG_CARRY()); NEXT;
+	OP(3, 9) ADD_HL(cpu->sp); NEXT;
+	OP(3, A) cpu->a = READ(HL); SET_PAIR(h, l, HL - 1); NEXT;
+	OP(3, B) cpu->sp--; NEXT;
+	OP(3, C) INC(cpu->a); NEXT;
+	OP(3, D) DEC(cpu->a); NEXT;
+	OP(3, E) cpu->a = IMM8(); NEXT;
+	OP(3, F) SYNC_FLAGS(); execute_ccf(&cpu->f); NEXT;
+
+	// LD r, r'
+	OP(4, 0) NEXT; // LD B, B
+	OP(4, 1) cpu->b = cpu->c; NEXT;
+	OP(4, 2) cpu->b = cpu->d; NEXT;
+	OP(4, 3) cpu->b = cpu->e; NEXT;
+	OP(4, 4) cpu->b = cpu->h; NEXT;
+	OP(4, 5) cpu->b = cpu->l; NEXT;
+	OP(4, 6) cpu->b = READ(HL); NEXT;
+	OP(4, 7) cpu->b = cpu->a; NEXT;
+	OP(4, 8) cpu->c = cpu->b; NEXT;
+	OP(4, 9) NEXT; // LD C, C
+	OP(4, A) cpu->c = cpu->d; NEXT;
+	OP(4, B) cpu->c = cpu->e; NEXT;
+	OP(4, C) cpu->c = cpu->h; NEXT;
+	OP(4, D) cpu->c = cpu->l; NEXT;
+	OP(4, E) cpu->c = READ(HL); NEXT;
+	OP(4, F) cpu->c = cpu->a; NEXT;
+	OP(5, 0) cpu->d = cpu->b; NEXT;
+	OP(5, 1) cpu->d = cpu->c; NEXT;
+	OP(5, 2) NEXT; // LD D, D
+	OP(5, 3) cpu->d = cpu->e; NEXT;
+	OP(5, 4) cpu->d = cpu->h; NEXT;
+	OP(5, 5) cpu->d = cpu->l; NEXT;
+	OP(5, 6) cpu->d = READ(HL); NEXT;
+	OP(5, 7) cpu->d = cpu->a; NEXT;
+	OP(5, 8) cpu->e = cpu->b; NEXT;
+	OP(5, 9) cpu->e = cpu->c; NEXT;
+	OP(5, A) cpu->e = cpu->d; NEXT;
+	OP(5, B) NEXT; // LD E, E
+	OP(5, C) cpu->e = cpu->h; NEXT;
+	OP(5, D) cpu->e = cpu->l; NEXT;
+	OP(5, E) cpu->e = READ(HL); NEXT;
+	OP(5, F) cpu->e = cpu->a; NEXT;
+	OP(6, 0) cpu->h = cpu->b; NEXT;
+	OP(6, 1) cpu->h = cpu->c; NEXT;
+	OP(6, 2) cpu->h = cpu->d; NEXT;
+	OP(6, 3) cpu->h = cpu->e; NEXT;
+	OP(6, 4) NEXT; // LD H, H
+	OP(6, 5) cpu->h = cpu->l; NEXT;
+	OP(6, 6) cpu->h = READ(HL); NEXT;
+	OP(6, 7) cpu->h = cpu->a; NEXT;
+	OP(6, 8) cpu->l = cpu->b; NEXT;
+	OP(6, 9) cpu->l = cpu->c; NEXT;
+	OP(6, A) cpu->l = cpu->d; NEXT;
+	OP(6, B) cpu->l = cpu->e; NEXT;
+	OP(6, C) cpu->l = cpu->h; NEXT;
+	OP(6, D) NEXT; // LD L, L
+	OP(6, E) cpu->l = READ(HL); NEXT;
+	OP(6, F) cpu->l = cpu->a; NEXT;
+	OP(7, 0) WRITE(HL, cpu->b); NEXT;
+	OP(7, 1) WRITE(HL, cpu->c); NEXT;
+	OP(7, 2) WRITE(HL, cpu->d); NEXT;
+	OP(7, 3) WRITE(HL, cpu->e); NEXT;
+	OP(7, 4) WRITE(HL, cpu->h); NEXT;
+	OP(7, 5) WRITE(HL, cpu->l); NEXT;
+	OP(7, 6) {
+		// HALT with IME off and an interrupt already pending doesn't halt,
+		// instead the next opcode byte is read twice
+		if (!cpu->ime && mmu->int_pending) {
+			cpu->halt_bug = true;
+		} else {
+			execute_halt(&cpu->halted);
+		}
+		goto top;
+	}
+	OP(7, 7) WRITE(HL, cpu->a); NEXT;
+	OP(7, 8) cpu->a = cpu->b; NEXT;
+	OP(7, 9) cpu->a = cpu->c; NEXT;
+	OP(7, A) cpu->a = cpu->d; NEXT;
+	OP(7, B) cpu->a = cpu->e; NEXT;
+	OP(7, C) cpu->a = cpu->h; NEXT;
+	OP(7, D) cpu->a = cpu->l; NEXT;
+	OP(7, E) cpu->a = READ(HL); NEXT;
+	OP(7, F) NEXT; // LD A, A
+
+	// ALU A, r
+	OP(8, 0) ALU_ADD(cpu->b); NEXT;
+	OP(8, 1) ALU_ADD(cpu->c); NEXT;
+	OP(8, 2) ALU_ADD(cpu->d); NEXT;
+	OP(8, 3) ALU_ADD(cpu->e); NEXT;
+	OP(8, 4) ALU_ADD(cpu->h); NEXT;
+	OP(8, 5) ALU_ADD(cpu->l); NEXT;
+	OP(8, 6) ALU_ADD(READ(HL)); NEXT;
+	OP(8, 7) ALU_ADD(cpu->a); NEXT;
+	OP(8, 8) ALU_ADC(cpu->b); NEXT;
+	OP(8, 9) ALU_ADC(cpu->c); NEXT;
+	OP(8, A) ALU_ADC(cpu->d); NEXT;
+	OP(8, B) ALU_ADC(cpu->e); NEXT;
+	OP(8, C) ALU_ADC(cpu->h); NEXT;
+	OP(8, D) ALU_ADC(cpu->l); NEXT;
+	OP(8, E) ALU_ADC(READ(HL)); NEXT;
+	OP(8, F) ALU_ADC(cpu->a); NEXT;
+	OP(9, 0) ALU_SUB(cpu->b); NEXT;
+	OP(9, 1) ALU_SUB(cpu->c); NEXT;
+	OP(9, 2) ALU_SUB(cpu->d); NEXT;
+	OP(9, 3) ALU_SUB(cpu->e); NEXT;
+	OP(9, 4) ALU_SUB(cpu->h); NEXT;
+	OP(9, 5) ALU_SUB(cpu->l); NEXT;
+	OP(9, 6) ALU_SUB(READ(HL)); NEXT;
+	OP(9, 7) ALU_SUB(cpu->a); NEXT;
+	OP(9, 8) ALU_SBC(cpu->b); NEXT;
+	OP(9, 9) ALU_SBC(cpu->c); NEXT;
+	OP(9, A) ALU_SBC(cpu->d); NEXT;
+	OP(9, B) ALU_SBC(cpu->e); NEXT;
+	OP(9, C) ALU_SBC(cpu->h); NEXT;
+	OP(9, D) ALU_SBC(cpu->l); NEXT;
+	OP(9, E) ALU_SBC(READ(HL)); NEXT;
+	OP(9, F) ALU_SBC(cpu->a); NEXT;
+	OP(A, 0) ALU_AND(cpu->b); NEXT;
+	OP(A, 1) ALU_AND(cpu->c); NEXT;
+	OP(A, 2) ALU_AND(cpu->d); NEXT;
+	OP(A, 3) ALU_AND(cpu->e); NEXT;
+	OP(A, 4) ALU_AND(cpu->h); NEXT;
+	OP(A, 5) ALU_AND(cpu->l); NEXT;
+	OP(A, 6) ALU_AND(READ(HL)); NEXT;
+	OP(A, 7) ALU_AND(cpu->a); NEXT;
+	OP(A, 8) ALU_XOR(cpu->b); NEXT;
+	OP(A, 9) ALU_XOR(cpu->c); NEXT;
+	OP(A, A) ALU_XOR(cpu->d); NEXT;
+	OP(A, B) ALU_XOR(cpu->e); NEXT;
+	OP(A, C) ALU_XOR(cpu->h); NEXT;
+	OP(A, D) ALU_XOR(cpu->l); NEXT;
+	OP(A, E) ALU_XOR(READ(HL)); NEXT;
+	OP(A, F) ALU_XOR(cpu->a); NEXT;
+	OP(B, 0) ALU_OR(cpu->b); NEXT;
+	OP(B, 1) ALU_OR(cpu->c); NEXT;
+	OP(B, 2) ALU_OR(cpu->d); NEXT;
+	OP(B, 3) ALU_OR(cpu->e); NEXT;
+	OP(B, 4) ALU_OR(cpu->h); NEXT;
+	OP(B, 5) ALU_OR(cpu->l); NEXT;
+	OP(B, 6) ALU_OR(READ(HL)); NEXT;
+	OP(B, 7) ALU_OR(cpu->a); NEXT;
+	OP(B, 8) ALU_CP(cpu->b); NEXT;
+	OP(B, 9) ALU_CP(cpu->c); NEXT;
+	OP(B, A) ALU_CP(cpu->d); NEXT;
+	OP(B, B) ALU_CP(cpu->e); NEXT;
+	OP(B, C) ALU_CP(cpu->h); NEXT;
+	OP(B, D) ALU_CP(cpu->l); NEXT;
+	OP(B, E) ALU_CP(READ(HL)); NEXT;
+	OP(B, F) ALU_CP(cpu->a); NEXT;
+
+	OP(C, 0) RET_IF(!FLAG_ZERO()); NEXT;
+	OP(C, 1) POP(b, c); NEXT;
+	OP(C, 2) JP_IF(!FLAG_ZERO()); NEXT;
+	OP(C, 3) JP_IF(true); NEXT;
+	OP(C, 4) CALL_IF(!FLAG_ZERO()); NEXT;
+	OP(C, 5) PUSH(BC); NEXT;
+	OP(C, 6) ALU_ADD(IMM8()); NEXT;
+	OP(C, 7) RST(0x00); NEXT;
+	OP(C, 8) RET_IF(FLAG_ZERO()); NEXT;
+	OP(C, 9) execute_pop(&cpu->pc, &cpu->sp, mmu); NEXT;
+	OP(C, A) JP_IF(FLAG_ZERO()); NEXT;
+	OP(C, B) {
+		uint8_t cb = IMM8();
+		gb->cycles += CB_OPCODE_CYCLES[cb];
+		SYNC_FLAGS();
+		execute_cb(cpu, mmu, cb);
+		NEXT;
+	}
+	OP(C, C) CALL_IF(FLAG_ZERO()); NEXT;
+	OP(C, D) CALL_IF(true); NEXT;
+	OP(C, E) ALU_ADC(IMM8()); NEXT;
+	OP(C, F) RST(0x08); NEXT;
+
+	OP(D, 0) RET_IF(!FLAG_CARRY()); NEXT;
+	OP(D, 1) POP(d, e); NEXT;
+	OP(D, 2) JP_IF(!FLAG_CARRY()); NEXT;
+	OP(D, 4) CALL_IF(!FLAG_CARRY()); NEXT;
+	OP(D, 5) PUSH(DE); NEXT;
+	OP(D, 6) ALU_SUB(IMM8()); NEXT;
+	OP(D, 7) RST(0x10); NEXT;
+	OP(D, 8) RET_IF(FLAG_CARRY()); NEXT;
+	OP(D, 9) execute_reti(&cpu->pc, &cpu->sp, &cpu->ime, mmu); goto top; // IME back on
+	OP(D, A) JP_IF(FLAG_CARRY()); NEXT;
+	OP(D, C) CALL_IF(FLAG_CARRY()); NEXT;
+	OP(D, E) ALU_SBC(IMM8()); NEXT;
+	OP(D, F) RST(0x18); NEXT;
+
+	OP(E, 0) WRITE(0xFF00 | IMM8(), cpu->a); NEXT;
+	OP(E, 1) POP(h, l); NEXT;
+	OP(E, 2) WRITE(0xFF00 | cpu->c, cpu->a); NEXT;
+	OP(E, 5) PUSH(HL); NEXT;
+	OP(E, 6) ALU_AND(IMM8()); NEXT;
+	OP(E, 7) RST(0x20); NEXT;
+	OP(E, 8) SYNC_FLAGS(); cpu->sp = sp_offset(cpu, (int8_t)IMM8()); NEXT;
+	OP(E, 9) cpu->pc = HL; NEXT;
+	OP(E, A) WRITE(imm16(cpu, mmu), cpu->a); NEXT;
+	OP(E, E) ALU_XOR(IMM8()); NEXT;
+	OP(E, F) RST(0x28); NEXT;
+
+	OP(F, 0) cpu->a = READ(0xFF00 | IMM8()); NEXT;
+	OP(F, 1) SYNC_FLAGS(); POP(a, f); cpu->f &= 0xF0; NEXT;
+	OP(F, 2) cpu->a = READ(0xFF00 | cpu->c); NEXT;
+	OP(F, 3) execute_di(&cpu->ime); cpu->ei_pending = false; NEXT;
+	OP(F, 5) SYNC_FLAGS(); PUSH(AF); NEXT;
+	OP(F, 6) ALU_OR(IMM8()); NEXT;
+	OP(F, 7) RST(0x30); NEXT;
+	OP(F, 8) SYNC_FLAGS(); SET_PAIR(h, l, sp_offset(cpu, (int8_t)IMM8())); NEXT;
+	OP(F, 9) cpu->sp = HL; NEXT;
+	OP(F, A) cpu->a = READ(imm16(cpu, mmu)); NEXT;
+	OP(F, B) cpu->ei_pending = true; goto top;
+	OP(F, E) ALU_CP(IMM8()); NEXT;
+	OP(F, F) RST(0x38); NEXT;
+
+	// Unused opcodes lock up the cpu, keep executing the same byte
+	OP(D, 3) OP(D, B) OP(D, D)
+	OP(E, 3) OP(E, 4) OP(E, B) OP(E, C) OP(E, D)
+	OP(F, 4) OP(F, C) OP(F, D)
+		cpu->pc--;
+		NEXT;
+
+#ifndef CPU_COMPUTED_GOTO
+	}
+	goto top;
+#endif
 }
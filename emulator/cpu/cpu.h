@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "lazy_flags.h"
+
+struct gb;
 
 typedef struct {
 	uint8_t a;
@@ -17,8 +20,26 @@ typedef struct {
 	uint16_t pc;
 	bool ime;
 	bool halted;
+	bool ei_pending; // EI takes effect after the next instruction
+	bool halt_bug;   // HALT with IME off and an interrupt pending
+	lazy_flags_t lazy; // last alu op, only used with FOZBOY_LAZY_FLAGS
 } Cpu;
 
 void cpu_init(Cpu *cpu);
 
+// Register values the DMG boot rom leaves behind, for starting without one
+void cpu_skip_boot(Cpu *cpu);
+
+// F is always up to date once these return, in either flags mode
+
+// Runs one instruction, or services an interrupt, or idles one m-cycle while
+// halted. Returns the t-cycles taken
+int cpu_step(struct gb *gb);
+
+// Runs instructions until at least budget t-cycles have passed, e.g. a whole
+// frame per call, running scheduled events between instructions as they come
+// due. While halted it jumps ahead to the next event instead of idling. Returns
+// the t-cycles actually run, which can go past budget by up to one instruction
+uint64_t cpu_run_cycles(struct gb *gb, uint64_t budget);
+
 #endif
@@ -0,0 +1,369 @@
+const std = @import("std");
+const testing = std.testing;
+const test_gb = @import("test_gb");
+const c = test_gb.c;
+
+test "cpu_run_cycles - runs a loop to completion" {
+    // XOR A; LD B, 10; loop: ADD A, B; DEC B; JR NZ, loop; LD (C000), A; JR -2
+    const gb = test_gb.create(.{}, &.{ 0xAF, 0x06, 0x0A, 0x80, 0x05, 0x20, 0xFC, 0xEA, 0x00, 0xC0, 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+
+    const ran = c.cpu_run_cycles(gb, 1000);
+    try testing.expect(ran >= 1000);
+    try testing.expect(ran < 1000 + 24);
+    try testing.expect(c.mmu_read(&gb.*.mmu, 0xC000) == 55);
+    try testing.expect(gb.*.cpu.pc == 0x10A);
+}
+
+test "cpu_step - cycle counts" {
+    // XOR A; LD B, 1; DEC B; JR NZ, 0 (not taken); JR 0 (taken); LD (HL), n
+    const gb = test_gb.create(.{}, &.{ 0xAF, 0x06, 0x01, 0x05, 0x20, 0x00, 0x18, 0x00, 0x36, 0x00 });
+    defer c.gb_destroy(gb);
+
+    try testing.expect(c.cpu_step(gb) == 4);
+    try testing.expect(c.cpu_step(gb) == 8);
+    try testing.expect(c.cpu_step(gb) == 4);
+    try testing.expect(c.cpu_step(gb) == 8);
+    try testing.expect(c.cpu_step(gb) == 12);
+    try testing.expect(c.cpu_step(gb) == 12);
+}
+
+test "cpu_step - calls, returns and the stack" {
+    // LD SP, DFF0; LD BC, 1234; PUSH BC; POP DE; CALL 0110; JR -2
+    var program = [_]u8{0} ** 0x13;
+    @memcpy(program[0..13], &[_]u8{ 0x31, 0xF0, 0xDF, 0x01, 0x34, 0x12, 0xC5, 0xD1, 0xCD, 0x10, 0x01, 0x18, 0xFE });
+    // 0110: LD A, 42; RET
+    @memcpy(program[0x10..0x13], &[_]u8{ 0x3E, 0x42, 0xC9 });
+    const gb = test_gb.create(.{}, &program);
+    defer c.gb_destroy(gb);
+
+    _ = c.cpu_run_cycles(gb, 200);
+    try testing.expect(gb.*.cpu.d == 0x12);
+    try testing.expect(gb.*.cpu.e == 0x34);
+    try testing.expect(gb.*.cpu.a == 0x42);
+    try testing.expect(gb.*.cpu.sp == 0xDFF0);
+    try testing.expect(gb.*.cpu.pc == 0x10B);
+}
+
+test "cpu_run_cycles - halt wakes up for an interrupt" {
+    // LD SP, DFF0; LD A, 1; LDH (FF), A; EI; HALT; NOP; JR -2
+    const gb = test_gb.create(.{}, &.{ 0x31, 0xF0, 0xDF, 0x3E, 0x01, 0xE0, 0xFF, 0xFB, 0x76, 0x00, 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    // Vblank handler: LD A, 99; RETI
+    @memcpy(test_gb.rom[0x40..0x43], &[_]u8{ 0x3E, 0x63, 0xD9 });
+
+    _ = c.cpu_run_cycles(gb, 200);
+    try testing.expect(gb.*.cpu.halted);
+
+    c.mmu_request_interrupt(&gb.*.mmu, 0x01);
+    _ = c.cpu_run_cycles(gb, 200);
+    try testing.expect(!gb.*.cpu.halted);
+    try testing.expect(gb.*.cpu.ime);
+    try testing.expect(gb.*.cpu.a == 0x63);
+    try testing.expect(gb.*.mmu.io[0x0F] & 0x01 == 0);
+}
+
+test "cpu_run_cycles - ppu line events run between instructions" {
+    // JR -2
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+
+    // Lines change on their own deadline, whatever the budget
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE - 12);
+    try testing.expect(gb.*.mmu.io[c.IO_LY] == 0);
+    _ = c.cpu_run_cycles(gb, 12);
+    try testing.expect(gb.*.mmu.io[c.IO_LY] == 1);
+    try testing.expect(gb.*.sched.at[c.SCHED_END] == c.SCHED_NEVER);
+
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE * (c.PPU_VBLANK_LINE - 1));
+    try testing.expect(gb.*.mmu.io[c.IO_LY] == c.PPU_VBLANK_LINE);
+    try testing.expect(gb.*.mmu.io[c.IO_IF] & c.INT_VBLANK != 0);
+
+    // A frame later LY is back where it was
+    _ = c.cpu_run_cycles(gb, c.GB_CYCLES_PER_FRAME);
+    try testing.expect(gb.*.mmu.io[c.IO_LY] == c.PPU_VBLANK_LINE);
+}
+
+test "cpu_run_cycles - halt skips ahead to the same place idling would" {
+    // LD SP, DFF0; LD A, 1; LDH (FF), A; EI; loop: HALT; JR loop
+    const gb = test_gb.create(.{}, &.{ 0x31, 0xF0, 0xDF, 0x3E, 0x01, 0xE0, 0xFF, 0xFB, 0x76, 0x18, 0xFD });
+    defer c.gb_destroy(gb);
+    // Vblank handler: INC B; RETI
+    @memcpy(test_gb.rom[0x40..0x42], &[_]u8{ 0x04, 0xD9 });
+
+    const idler = c.gb_clone(gb);
+    defer c.gb_destroy(idler);
+
+    _ = c.cpu_run_cycles(gb, c.GB_CYCLES_PER_FRAME * 2);
+    while (idler.*.cycles < gb.*.cycles) {
+        _ = c.cpu_step(idler);
+    }
+
+    try testing.expect(gb.*.cpu.b == 2);
+    try testing.expect(gb.*.halt_skipped > c.GB_CYCLES_PER_FRAME);
+    try testing.expect(idler.*.cycles == gb.*.cycles);
+    try testing.expect(idler.*.cpu.b == gb.*.cpu.b);
+    try testing.expect(idler.*.cpu.pc == gb.*.cpu.pc);
+    try testing.expect(idler.*.mmu.io[c.IO_LY] == gb.*.mmu.io[c.IO_LY]);
+}
+
+test "cpu_run_cycles - idle loop skips land where running would" {
+    // loop: LDH A, (44); CP 90; JR NZ, loop; INC B; JR loop
+    const gb = test_gb.create(.{}, &.{ 0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA, 0x04, 0x18, 0xF7 });
+    defer c.gb_destroy(gb);
+
+    const runner = c.gb_clone(gb);
+    defer c.gb_destroy(runner);
+
+    _ = c.cpu_run_cycles(gb, c.GB_CYCLES_PER_FRAME * 2);
+    while (runner.*.cycles < gb.*.cycles) {
+        _ = c.cpu_step(runner);
+    }
+
+    try testing.expect(gb.*.idle.skips > 0);
+    try testing.expect(gb.*.idle.skipped_cycles > c.GB_CYCLES_PER_FRAME);
+    try testing.expect(runner.*.cycles == gb.*.cycles);
+    try testing.expect(runner.*.instructions == gb.*.instructions);
+    try testing.expect(runner.*.cpu.a == gb.*.cpu.a);
+    try testing.expect(runner.*.cpu.b == gb.*.cpu.b);
+    try testing.expect(runner.*.cpu.f == gb.*.cpu.f);
+    try testing.expect(runner.*.cpu.pc == gb.*.cpu.pc);
+}
+
+test "cpu_run_cycles - idle skips of a STAT poll stop at each mode change" {
+    // loop: LDH A, (41); AND 3; JR NZ, loop; INC B; wait: LDH A, (41); AND 3; JR Z, wait; JR loop
+    const gb = test_gb.create(.{}, &.{ 0xF0, 0x41, 0xE6, 0x03, 0x20, 0xFA, 0x04, 0xF0, 0x41, 0xE6, 0x03, 0x28, 0xFA, 0x18, 0xF1 });
+    defer c.gb_destroy(gb);
+
+    const runner = c.gb_clone(gb);
+    defer c.gb_destroy(runner);
+
+    _ = c.cpu_run_cycles(gb, c.GB_CYCLES_PER_FRAME);
+    while (runner.*.cycles < gb.*.cycles) {
+        _ = c.cpu_step(runner);
+    }
+
+    // Once per hblank
+    try testing.expect(gb.*.idle.skips > 0);
+    try testing.expect(gb.*.cpu.b == c.PPU_VBLANK_LINE);
+    try testing.expect(runner.*.cycles == gb.*.cycles);
+    try testing.expect(runner.*.cpu.b == gb.*.cpu.b);
+    try testing.expect(runner.*.cpu.pc == gb.*.cpu.pc);
+}
+
+test "cpu_step - CB prefixed ops" {
+    // LD A, 81; RLC A; SET 7, A; BIT 7, A; SWAP A
+    const gb = test_gb.create(.{}, &.{ 0x3E, 0x81, 0xCB, 0x07, 0xCB, 0xFF, 0xCB, 0x7F, 0xCB, 0x37 });
+    defer c.gb_destroy(gb);
+
+    _ = c.cpu_step(gb);
+    try testing.expect(c.cpu_step(gb) == 8);
+    try testing.expect(gb.*.cpu.a == 0x03);
+    try testing.expect(gb.*.cpu.f == c.FLAG_C);
+    _ = c.cpu_step(gb);
+    try testing.expect(gb.*.cpu.a == 0x83);
+    _ = c.cpu_step(gb);
+    try testing.expect(gb.*.cpu.f == c.FLAG_H | c.FLAG_C);
+    _ = c.cpu_step(gb);
+    try testing.expect(gb.*.cpu.a == 0x38);
+    try testing.expect(gb.*.cpu.f == 0);
+}
+
+test "execute_adc/execute_sbc - carry out of a wrapped result" {
+    var a: u8 = 0xFF;
+    var f: u8 = c.FLAG_C;
+    c.execute_adc(&a, 0xFF, &f);
+    try testing.expect(a == 0xFF);
+    try testing.expect(f & c.FLAG_C != 0);
+
+    a = 0x00;
+    f = c.FLAG_C;
+    c.execute_sbc(&f, &a, 0xFF);
+    try testing.expect(a == 0x00);
+    try testing.expect(f & c.FLAG_C != 0);
+    try testing.expect(f & c.FLAG_Z != 0);
+}
+
+test "execute_daa - clears a stale zero flag" {
+    var a: u8 = 0x01;
+    var f: u8 = c.FLAG_Z;
+    c.execute_daa(&a, &f);
+    try testing.expect(a == 0x01);
+    try testing.expect(f == 0);
+}
+
+test "cpu_step - flags read back the same in either flags mode" {
+    // LD A, 0F; ADD A, 01; PUSH AF; POP BC; DAA; INC A; SCF; CCF; PUSH AF; POP DE
+    const gb = test_gb.create(.{}, &.{ 0x31, 0xF0, 0xDF, 0x3E, 0x0F, 0xC6, 0x01, 0xF5, 0xC1, 0x27, 0x3C, 0x37, 0x3F, 0xF5, 0xD1 });
+    defer c.gb_destroy(gb);
+
+    for (0..5) |_| {
+        _ = c.cpu_step(gb);
+    }
+    try testing.expect(gb.*.cpu.c == c.FLAG_H);
+    try testing.expect(gb.*.cpu.f == c.FLAG_H);
+
+    for (0..6) |_| {
+        _ = c.cpu_step(gb);
+    }
+    // 0x10 adjusts to 0x16, INC to 0x17, then SCF and CCF leave C clear
+    try testing.expect(gb.*.cpu.a == 0x17);
+    try testing.expect(gb.*.cpu.e == 0);
+}
+
+const AluOp = enum { add, adc, sub, sbc, and_op, xor_op, or_op, cp };
+
+fn eagerAlu(op: AluOp, a: *u8, val: u8, f: *u8) void {
+    switch (op) {
+        .add => c.execute_add(a, val, f),
+        .adc => c.execute_adc(a, val, f),
+        .sub => c.execute_subtract(f, a, val),
+        .sbc => c.execute_sbc(f, a, val),
+        .and_op => c.execute_and(f, a, val),
+        .xor_op => c.execute_xor(f, a, val),
+        .or_op => c.execute_or(f, a, val),
+        .cp => c.execute_cp(f, a.*, val),
+    }
+}
+
+fn lazyAlu(op: AluOp, lazy: *c.lazy_flags_t, f: u8, a: *u8, val: u8) void {
+    switch (op) {
+        .add => c.lazy_add(lazy, a, val),
+        .adc => c.lazy_adc(lazy, f, a, val),
+        .sub => c.lazy_sub(lazy, a, val),
+        .sbc => c.lazy_sbc(lazy, f, a, val),
+        .and_op => c.lazy_and(lazy, a, val),
+        .xor_op => c.lazy_xor(lazy, a, val),
+        .or_op => c.lazy_or(lazy, a, val),
+        .cp => c.lazy_cp(lazy, a.*, val),
+    }
+}
+
+test "lazy flags - alu ops match the eager helpers for every operand" {
+    for (std.enums.values(AluOp)) |op| {
+        for (0..256) |x| {
+            for (0..256) |y| {
+                for ([_]u8{ 0, c.FLAG_C }) |flags_in| {
+                    var eager_a: u8 = @intCast(x);
+                    var eager_f: u8 = flags_in;
+                    eagerAlu(op, &eager_a, @intCast(y), &eager_f);
+
+                    var lazy_a: u8 = @intCast(x);
+                    var lazy = std.mem.zeroes(c.lazy_flags_t);
+                    lazyAlu(op, &lazy, flags_in, &lazy_a, @intCast(y));
+
+                    try testing.expectEqual(eager_a, lazy_a);
+                    try testing.expectEqual(eager_f, c.lazy_flags_resolve(&lazy, flags_in));
+                    try testing.expectEqual(eager_f & c.FLAG_Z != 0, c.lazy_flag_z(&lazy, flags_in));
+                    try testing.expectEqual(eager_f & c.FLAG_C != 0, c.lazy_flag_c(&lazy, flags_in));
+                }
+            }
+        }
+    }
+}
+
+test "lazy flags - INC/DEC keep a carry that is still lazy" {
+    for (0..256) |x| {
+        for ([_]u8{ 0x00, 0xFF }) |before| {
+            // The op before sets C lazily (0xFF + 1 carries, 0x00 + 1 doesn't)
+            var eager_a: u8 = before;
+            var eager_f: u8 = 0;
+            c.execute_add(&eager_a, 1, &eager_f);
+            var lazy_a: u8 = before;
+            var lazy = std.mem.zeroes(c.lazy_flags_t);
+            c.lazy_add(&lazy, &lazy_a, 1);
+
+            var eager_val: u8 = @intCast(x);
+            var lazy_val: u8 = @intCast(x);
+            c.execute_incr(&eager_f, &eager_val);
+            c.lazy_incr(&lazy, 0, &lazy_val);
+            try testing.expectEqual(eager_val, lazy_val);
+            try testing.expectEqual(eager_f, c.lazy_flags_resolve(&lazy, 0));
+
+            c.execute_decr(&eager_f, &eager_val);
+            c.lazy_decr(&lazy, 0, &lazy_val);
+            try testing.expectEqual(eager_val, lazy_val);
+            try testing.expectEqual(eager_f, c.lazy_flags_resolve(&lazy, 0));
+        }
+    }
+}
+
+test "alu tables - add/sub flags match the eager helpers for every operand" {
+    for (0..256) |x| {
+        for (0..256) |y| {
+            for ([_]u8{ 0, c.FLAG_C }) |flags_in| {
+                const index = @as(usize, flags_in >> 4) << 16 | x << 8 | y;
+                const plain = x << 8 | y;
+                var a: u8 = undefined;
+                var f: u8 = undefined;
+
+                a = @intCast(x);
+                f = flags_in;
+                c.execute_add(&a, @intCast(y), &f);
+                try testing.expectEqual(f, c.ALU_ADD_FLAGS[plain]);
+
+                a = @intCast(x);
+                f = flags_in;
+                c.execute_adc(&a, @intCast(y), &f);
+                try testing.expectEqual(f, c.ALU_ADD_FLAGS[index]);
+
+                a = @intCast(x);
+                f = flags_in;
+                c.execute_subtract(&f, &a, @intCast(y));
+                try testing.expectEqual(f, c.ALU_SUB_FLAGS[plain]);
+
+                f = flags_in;
+                c.execute_cp(&f, @intCast(x), @intCast(y));
+                try testing.expectEqual(f, c.ALU_SUB_FLAGS[plain]);
+
+                a = @intCast(x);
+                f = flags_in;
+                c.execute_sbc(&f, &a, @intCast(y));
+                try testing.expectEqual(f, c.ALU_SUB_FLAGS[index]);
+            }
+        }
+    }
+}
+
+test "alu tables - inc/dec, daa and shifts match the eager helpers" {
+    for (0..256) |x| {
+        for ([_]u8{ 0, c.FLAG_C }) |flags_in| {
+            var val: u8 = @intCast(x);
+            var f: u8 = flags_in;
+            c.execute_incr(&f, &val);
+            try testing.expectEqual(f, (flags_in & c.FLAG_C) | c.ALU_INC_FLAGS[x]);
+
+            val = @intCast(x);
+            f = flags_in;
+            c.execute_decr(&f, &val);
+            try testing.expectEqual(f, (flags_in & c.FLAG_C) | c.ALU_DEC_FLAGS[x]);
+        }
+
+        // Every N, H and C combination DAA can see
+        for (0..8) |nhc| {
+            var a: u8 = @intCast(x);
+            var f: u8 = @intCast(nhc << 4);
+            c.execute_daa(&a, &f);
+            try testing.expectEqual(@as(u16, a) << 8 | f, c.ALU_DAA[nhc << 8 | x]);
+        }
+
+        for (0..8) |op| {
+            for ([_]u8{ 0, c.FLAG_C }) |flags_in| {
+                var val: u8 = @intCast(x);
+                var f: u8 = flags_in;
+                switch (op) {
+                    0 => c.execute_rlc(&val, &f, true),
+                    1 => c.execute_rrc(&val, &f, true),
+                    2 => c.execute_rl(&val, &f, true),
+                    3 => c.execute_rr(&val, &f, true),
+                    4 => c.execute_sla(&val, &f),
+                    5 => c.execute_sra(&val, &f),
+                    6 => c.execute_swap(&val, &f),
+                    else => c.execute_srl(&val, &f),
+                }
+                const index = op << 9 | @as(usize, flags_in >> 4) << 8 | x;
+                try testing.expectEqual(@as(u16, val) << 8 | f, c.ALU_SHIFT[index]);
+            }
+        }
+    }
+}
@@ -0,0 +1,1281 @@
+#define _DEFAULT_SOURCE // mmap and MAP_ANONYMOUS under -std=c11
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dynarec.h"
+#include "cpu.h"
+#include "idle.h"
+#include "instructions.h"
+#include "../memory/mmu.h"
+#include "../state/gb.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define DYNAREC_X86_64
+#endif
+
+#ifdef DYNAREC_X86_64
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../static/alu_tables.h"
+#include "../static/opcode_cycles.h"
+
+#define DYNAREC_CODE_SIZE (8 << 20)
+#define DYNAREC_CACHE_BITS 14
+#define DYNAREC_BLOCK_MAX 48        // instructions per block
+#define DYNAREC_BLOCK_BYTES 0x4000  // room left before translating a block
+
+// One cache slot. A block is only run while the page it was translated from
+// is still mapped to the same memory and, for ram, hasn't been written since
+typedef struct {
+	bool used;
+	uint32_t key;  // bank << 16 | address
+	uint32_t gen;  // jit->gens[page] when translated
+	uint8_t *page; // read_pages[page] when translated
+	uint8_t *code; // NULL if the first instruction can't be translated
+	uint32_t max_cycles; // taking every branch
+} jit_block_t;
+
+// Translated code is entered through a trampoline at the start of the buffer,
+// which returns either NULL or the address of a jump that can be linked to
+// the block for the new pc
+typedef uint8_t *(*jit_enter_t)(gb_t *gb, uint8_t *code, uint64_t deadline);
+
+typedef struct dynarec {
+	uint8_t *code; // rx, rw only while written, NULL if it couldn't be mapped
+	size_t page_size;
+	size_t code_used;
+	size_t code_start; // past the trampoline
+	jit_enter_t enter;
+	uint8_t *exit; // returns NULL from the trampoline
+
+	uint32_t gens[MMU_PAGE_COUNT]; // bumped when a page's code is written
+	jit_block_t blocks[1 << DYNAREC_CACHE_BITS];
+
+	gb_t *shadow; // interpreter copy for the lockstep check
+	dynarec_stats_t stats;
+} dynarec_t;
+
+// Generated code keeps gb in rbx, the next event's cycle in r14 and a flag in
+// r15 that's set when a write took the slow path (io, mbc, watched code).
+// Everything else is loaded from gb_t as needed, so a call out to C never
+// has to save anything
+#define OFF(field) ((uint32_t)offsetof(gb_t, field))
+
+enum { EAX = 0, ECX = 1, EDX = 2, AH = 4, ESI = 6 };
+
+// ModRM for [rbx + disp32] with reg (or an opcode extension)
+#define MODRM_RBX(reg) (0x83 | (reg) << 3)
+
+// Group 1 opcode extensions for op byte [rbx + disp32], imm8
+enum { GRP_ADD = 0, GRP_OR = 1, GRP_AND = 4, GRP_XOR = 6 };
+
+typedef struct {
+	uint8_t *p;
+} emit_t;
+
+#define EMIT(e, ...)                                                           \
+	emit_bytes((e), (const uint8_t[]){__VA_ARGS__},                        \
+		   sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void emit_bytes(emit_t *e, const uint8_t *bytes, size_t len) {
+	memcpy(e->p, bytes, len);
+	e->p += len;
+}
+
+static void emit32(emit_t *e, uint32_t val) {
+	memcpy(e->p, &val, 4);
+	e->p += 4;
+}
+
+static void emit64(emit_t *e, uint64_t val) {
+	memcpy(e->p, &val, 8);
+	e->p += 8;
+}
+
+// rel32 from the end of a 4 byte field at `at` to target
+static void patch_rel32(uint8_t *at, uint8_t *target) {
+	int32_t rel = (int32_t)(target - (at + 4));
+	memcpy(at, &rel, 4);
+}
+
+// Short forward jumps, patched once the target is known
+static uint8_t *jump8(emit_t *e, uint8_t opcode) {
+	EMIT(e, opcode, 0);
+	return e->p - 1;
+}
+
+static void land8(emit_t *e, uint8_t *at) {
+	*at = (uint8_t)(e->p - (at + 1));
+}
+
+#define JZ8 0x74
+#define JNZ8 0x75
+#define JMP8 0xEB
+
+static void jump_to(emit_t *e, uint8_t *target) {
+	EMIT(e, 0xE9);
+	patch_rel32(e->p, target);
+	e->p += 4;
+}
+
+// jcc rel32, 0x84 jz, 0x85 jnz, 0x83 jae
+static void jump_if(emit_t *e, uint8_t cc, uint8_t *target) {
+	EMIT(e, 0x0F, cc);
+	patch_rel32(e->p, target);
+	e->p += 4;
+}
+
+static uint8_t *jump_if_later(emit_t *e, uint8_t cc) {
+	EMIT(e, 0x0F, cc);
+	e->p += 4;
+	return e->p - 4;
+}
+
+// movzx r32, byte [rbx + off]
+static void load8(emit_t *e, int reg, uint32_t off) {
+	EMIT(e, 0x0F, 0xB6, MODRM_RBX(reg));
+	emit32(e, off);
+}
+
+// mov byte [rbx + off], r8
+static void store8(emit_t *e, int reg, uint32_t off) {
+	EMIT(e, 0x88, MODRM_RBX(reg));
+	emit32(e, off);
+}
+
+static void store8_imm(emit_t *e, uint32_t off, uint8_t val) {
+	EMIT(e, 0xC6, MODRM_RBX(0));
+	emit32(e, off);
+	EMIT(e, val);
+}
+
+static void alu8_imm(emit_t *e, int ext, uint32_t off, uint8_t val) {
+	EMIT(e, 0x80, MODRM_RBX(ext));
+	emit32(e, off);
+	EMIT(e, val);
+}
+
+static void store16_imm(emit_t *e, uint32_t off, uint16_t val) {
+	EMIT(e, 0x66, 0xC7, MODRM_RBX(0));
+	emit32(e, off);
+	EMIT(e, (uint8_t)val, val >> 8);
+}
+
+// add qword [rbx + off], imm32 (or sub with ext 5)
+static void add64_imm(emit_t *e, int ext, uint32_t off, uint32_t val) {
+	if (val == 0) {
+		return;
+	}
+	EMIT(e, 0x48, 0x81, MODRM_RBX(ext));
+	emit32(e, off);
+	emit32(e, val);
+}
+
+static void mov_imm32(emit_t *e, int reg, uint32_t val) {
+	EMIT(e, 0xB8 + reg);
+	emit32(e, val);
+}
+
+// mov rax, imm64; call rax. Generated code keeps rsp 16 byte aligned
+static void call(emit_t *e, const void *fn) {
+	EMIT(e, 0x48, 0xB8);
+	emit64(e, (uint64_t)(uintptr_t)fn);
+	EMIT(e, 0xFF, 0xD0);
+}
+
+// mov rdx, imm64
+static void load_table(emit_t *e, const void *table) {
+	EMIT(e, 0x48, 0xBA);
+	emit64(e, (uint64_t)(uintptr_t)table);
+}
+
+// Register pairs are separate bytes, put one together in esi
+static void load_pair(emit_t *e, uint32_t hi, uint32_t lo) {
+	load8(e, ESI, hi);
+	EMIT(e, 0xC1, 0xE6, 0x08); // shl esi, 8
+	load8(e, EAX, lo);
+	EMIT(e, 0x09, 0xC6); // or esi, eax
+}
+
+// Store ax back into a pair
+static void store_pair(emit_t *e, uint32_t hi, uint32_t lo) {
+	store8(e, EAX, lo);
+	store8(e, AH, hi);
+}
+
+static void load_sp(emit_t *e) {
+	EMIT(e, 0x0F, 0xB7, MODRM_RBX(ESI)); // movzx esi, word [rbx + sp]
+	emit32(e, OFF(cpu.sp));
+}
+
+#define HL_PAIR OFF(cpu.h), OFF(cpu.l)
+
+// Reads the byte at esi into eax. The slow path sees gb->cycles as of this
+// instruction, like the interpreter would
+static void emit_read(emit_t *e, uint32_t cycles) {
+	EMIT(e, 0x89, 0xF2);                   // mov edx, esi
+	EMIT(e, 0xC1, 0xEA, 0x08);             // shr edx, 8
+	EMIT(e, 0x48, 0x8B, 0x84, 0xD3);       // mov rax, [rbx + rdx*8 + read_pages]
+	emit32(e, OFF(mmu.read_pages));
+	EMIT(e, 0x48, 0x85, 0xC0);             // test rax, rax
+	uint8_t *slow = jump8(e, JZ8);
+	EMIT(e, 0x40, 0x0F, 0xB6, 0xCE);       // movzx ecx, sil
+	EMIT(e, 0x0F, 0xB6, 0x04, 0x08);       // movzx eax, byte [rax + rcx]
+	uint8_t *done = jump8(e, JMP8);
+
+	land8(e, slow);
+	add64_imm(e, GRP_ADD, OFF(cycles), cycles);
+	EMIT(e, 0x48, 0x8D, MODRM_RBX(7));     // lea rdi, [rbx + mmu]
+	emit32(e, OFF(mmu));
+	call(e, mmu_read_slow);
+	add64_imm(e, 5, OFF(cycles), cycles);
+	EMIT(e, 0x0F, 0xB6, 0xC0);             // movzx eax, al
+	land8(e, done);
+}
+
+// Writes cl to the byte at esi. A slow path write (other than to vram)
+// sets r15, and the block leaves after the instruction, see emit_write_check
+static void emit_write(emit_t *e, uint32_t cycles) {
+	EMIT(e, 0x89, 0xF0);                   // mov eax, esi
+	EMIT(e, 0xC1, 0xE8, 0x08);             // shr eax, 8
+	EMIT(e, 0x48, 0x8B, 0x84, 0xC3);       // mov rax, [rbx + rax*8 + write_pages]
+	emit32(e, OFF(mmu.write_pages));
+	EMIT(e, 0x48, 0x85, 0xC0);             // test rax, rax
+	uint8_t *slow = jump8(e, JZ8);
+	EMIT(e, 0x40, 0x0F, 0xB6, 0xD6);       // movzx edx, sil
+	EMIT(e, 0x88, 0x0C, 0x10);             // mov [rax + rdx], cl
+	uint8_t *done = jump8(e, JMP8);
+
+	land8(e, slow);
+	// Vram writes only concern the ppu, the block can go on
+	EMIT(e, 0x89, 0xF0);                   // mov eax, esi
+	EMIT(e, 0xC1, 0xE8, 0x08);             // shr eax, 8
+	EMIT(e, 0x80, 0xBC, 0x03);             // cmp byte [rbx + rax + page_tags], imm8
+	emit32(e, OFF(mmu.page_tags));
+	EMIT(e, MMU_PAGE_VRAM);
+	EMIT(e, 0x0F, 0x95, 0xC0);             // setne al
+	EMIT(e, 0x0F, 0xB6, 0xC0);             // movzx eax, al
+	EMIT(e, 0x41, 0x09, 0xC7);             // or r15d, eax
+	add64_imm(e, GRP_ADD, OFF(cycles), cycles);
+	EMIT(e, 0x0F, 0xB6, 0xD1);             // movzx edx, cl
+	EMIT(e, 0x48, 0x8D, MODRM_RBX(7));     // lea rdi, [rbx + mmu]
+	emit32(e, OFF(mmu));
+	call(e, mmu_write_slow);
+	add64_imm(e, 5, OFF(cycles), cycles);
+	land8(e, done);
+}
+
+// Host ZF AF CF to Z H C, indexed by the lahf byte
+static uint8_t host_flags[256];
+
+static void init_host_flags(void) {
+	for (int ah = 0; ah < 256; ah++) {
+		host_flags[ah] = (ah & 0x40 ? FLAG_Z : 0) |
+				 (ah & 0x10 ? FLAG_H : 0) |
+				 (ah & 0x01 ? FLAG_C : 0);
+	}
+}
+
+// F from the flags of the host op just run. x86 ADD/ADC/SUB/SBB/INC/DEC set
+// zero, half carry and carry the same way the SM83 does, so only N and the
+// flags an op leaves alone need fixing up. keep picks bits of the old F
+static void emit_flags(emit_t *e, uint8_t and_mask, uint8_t or_bits, uint8_t keep) {
+	EMIT(e, 0x9F);                         // lahf
+	EMIT(e, 0x0F, 0xB6, 0xC4);             // movzx eax, ah
+	load_table(e, host_flags);
+	EMIT(e, 0x0F, 0xB6, 0x04, 0x02);       // movzx eax, byte [rdx + rax]
+	if (and_mask != 0xFF) {
+		EMIT(e, 0x24, and_mask);       // and al, imm8
+	}
+	if (or_bits) {
+		EMIT(e, 0x0C, or_bits);        // or al, imm8
+	}
+	if (keep) {
+		load8(e, EDX, OFF(cpu.f));
+		EMIT(e, 0x83, 0xE2, keep);     // and edx, imm8
+		EMIT(e, 0x09, 0xD0);           // or eax, edx
+	}
+	store8(e, EAX, OFF(cpu.f));
+}
+
+// ALU A, cl in SM83 order: ADD ADC SUB SBC AND XOR OR CP
+static void emit_alu(emit_t *e, int alu) {
+	static const uint8_t HOST_OP[8] = { 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+	static const uint8_t AND_MASK[8] = { 0xFF, 0xFF, 0xFF, 0xFF, 0x80, 0x80, 0x80, 0xFF };
+	static const uint8_t OR_BITS[8] = { 0, 0, FLAG_N, FLAG_N, FLAG_H, 0, 0, FLAG_N };
+
+	load8(e, EAX, OFF(cpu.a));
+	if (alu == 1 || alu == 3) {
+		load8(e, EDX, OFF(cpu.f));
+		EMIT(e, 0x0F, 0xBA, 0xE2, 0x04); // bt edx, 4, carry into CF
+	}
+	EMIT(e, HOST_OP[alu], 0xC8);           // op al, cl
+	if (alu != 7) {
+		store8(e, EAX, OFF(cpu.a));
+	}
+	emit_flags(e, AND_MASK[alu], OR_BITS[alu], 0);
+}
+
+// CB shift group on cl through ALU_SHIFT, result back in cl
+static void emit_shift(emit_t *e, int op) {
+	load8(e, EAX, OFF(cpu.f));
+	EMIT(e, 0xC1, 0xE8, 0x04);             // shr eax, 4
+	EMIT(e, 0x83, 0xE0, 0x01);             // and eax, 1
+	EMIT(e, 0xC1, 0xE0, 0x08);             // shl eax, 8
+	EMIT(e, 0x09, 0xC8);                   // or eax, ecx
+	EMIT(e, 0x0D);                         // or eax, imm32
+	emit32(e, (uint32_t)op << 9);
+	load_table(e, ALU_SHIFT);
+	EMIT(e, 0x0F, 0xB7, 0x04, 0x42);       // movzx eax, word [rdx + rax*2]
+	store8(e, EAX, OFF(cpu.f));
+	EMIT(e, 0x0F, 0xB6, 0xCC);             // movzx ecx, ah
+}
+
+static void emit_daa(emit_t *e) {
+	load8(e, EAX, OFF(cpu.f));
+	EMIT(e, 0xC1, 0xE8, 0x04);             // shr eax, 4
+	EMIT(e, 0x83, 0xE0, 0x07);             // and eax, 7
+	EMIT(e, 0xC1, 0xE0, 0x08);             // shl eax, 8
+	load8(e, ECX, OFF(cpu.a));
+	EMIT(e, 0x09, 0xC8);                   // or eax, ecx
+	load_table(e, ALU_DAA);
+	EMIT(e, 0x0F, 0xB7, 0x04, 0x42);       // movzx eax, word [rdx + rax*2]
+	store8(e, EAX, OFF(cpu.f));
+	store8(e, AH, OFF(cpu.a));
+}
+
+// Operand offsets in gb_t by the 3 bit register field, (HL) is 6
+static const uint32_t REG_OFF[8] = {
+	OFF(cpu.b), OFF(cpu.c), OFF(cpu.d), OFF(cpu.e),
+	OFF(cpu.h), OFF(cpu.l), 0, OFF(cpu.a),
+};
+
+// BC DE HL SP by bits 4-5, AF replaces SP for PUSH/POP
+static const uint32_t PAIR_HI[4] = { OFF(cpu.b), OFF(cpu.d), OFF(cpu.h), OFF(cpu.sp) + 1 };
+static const uint32_t PAIR_LO[4] = { OFF(cpu.c), OFF(cpu.e), OFF(cpu.l), OFF(cpu.sp) };
+static const uint32_t STACK_HI[4] = { OFF(cpu.b), OFF(cpu.d), OFF(cpu.h), OFF(cpu.a) };
+static const uint32_t STACK_LO[4] = { OFF(cpu.c), OFF(cpu.e), OFF(cpu.l), OFF(cpu.f) };
+
+// Pushes cl from load_hi then load_lo, as execute_push does
+static void emit_push_byte(emit_t *e, uint32_t cycles) {
+	EMIT(e, 0x66, 0xFF, MODRM_RBX(1));     // dec word [rbx + sp]
+	emit32(e, OFF(cpu.sp));
+	load_sp(e);
+	emit_write(e, cycles);
+}
+
+static void emit_push_regs(emit_t *e, uint32_t hi, uint32_t lo, uint32_t cycles) {
+	load8(e, ECX, hi);
+	emit_push_byte(e, cycles);
+	load8(e, ECX, lo);
+	emit_push_byte(e, cycles);
+}
+
+static void emit_push_imm(emit_t *e, uint16_t val, uint32_t cycles) {
+	mov_imm32(e, ECX, val >> 8);
+	emit_push_byte(e, cycles);
+	mov_imm32(e, ECX, val & 0xFF);
+	emit_push_byte(e, cycles);
+}
+
+static void emit_pop(emit_t *e, uint32_t hi, uint32_t lo, uint32_t cycles) {
+	load_sp(e);
+	emit_read(e, cycles);
+	store8(e, EAX, lo);
+	EMIT(e, 0x66, 0xFF, MODRM_RBX(0));     // inc word [rbx + sp]
+	emit32(e, OFF(cpu.sp));
+	load_sp(e);
+	emit_read(e, cycles);
+	store8(e, EAX, hi);
+	EMIT(e, 0x66, 0xFF, MODRM_RBX(0));     // inc word [rbx + sp]
+	emit32(e, OFF(cpu.sp));
+}
+
+// Block exits. Cycles and instruction counts are only brought up to date here
+static void emit_account(emit_t *e, uint32_t cycles, uint32_t count) {
+	add64_imm(e, GRP_ADD, OFF(cycles), cycles);
+	add64_imm(e, GRP_ADD, OFF(instructions), count);
+}
+
+// Leaves for pc. A chained exit ends in a jump that starts out going back to
+// the dispatcher with its own address, which links it to the next block.
+// It's only taken while no slow write happened, the next block checks the
+// deadline itself
+static void emit_exit(dynarec_t *jit, emit_t *e, uint16_t pc, uint32_t cycles,
+		      uint32_t count, bool chain) {
+	store16_imm(e, OFF(cpu.pc), pc);
+	emit_account(e, cycles, count);
+	if (!chain) {
+		jump_to(e, jit->exit);
+		return;
+	}
+
+	EMIT(e, 0x45, 0x85, 0xFF);             // test r15d, r15d
+	jump_if(e, 0x85, jit->exit);
+	EMIT(e, 0xE9, 0, 0, 0, 0);             // jmp link, patched by link_exit
+	EMIT(e, 0x48, 0x8D, 0x05);             // link: lea rax, [rip - 11]
+	emit32(e, (uint32_t)-11);
+	jump_to(e, jit->exit + 2);             // past the xor eax, eax
+}
+
+// For RET and JP HL, pc is already stored
+static void emit_exit_dynamic(dynarec_t *jit, emit_t *e, uint32_t cycles, uint32_t count) {
+	emit_account(e, cycles, count);
+	jump_to(e, jit->exit);
+}
+
+// The jump back of an idle loop leaves through idle_jumped_back, so trips up
+// to the next event are skipped the same as in the interpreter
+static void emit_idle_exit(dynarec_t *jit, emit_t *e, uint16_t target, uint16_t from,
+			   uint32_t cycles, uint32_t count) {
+	store16_imm(e, OFF(cpu.pc), target);
+	emit_account(e, cycles, count);
+	EMIT(e, 0x48, 0x89, 0xDF);             // mov rdi, rbx
+	mov_imm32(e, ESI, from);
+	call(e, idle_jumped_back);
+	jump_to(e, jit->exit);
+}
+
+// After an instruction that writes, leave if the write went to the slow path.
+// That write could have switched banks, raised an interrupt or changed code
+static void emit_write_check(dynarec_t *jit, emit_t *e, uint16_t next,
+			     uint32_t cycles, uint32_t count) {
+	EMIT(e, 0x45, 0x85, 0xFF);             // test r15d, r15d
+	uint8_t *skip = jump8(e, JZ8);
+	emit_exit(jit, e, next, cycles, count, false);
+	land8(e, skip);
+}
+
+// Jumps when a JR/JP/CALL/RET condition (bits 3-4: NZ Z NC C) doesn't hold
+static uint8_t *emit_unless(emit_t *e, uint8_t op) {
+	int cc = (op >> 3) & 3;
+	EMIT(e, 0xF6, MODRM_RBX(0));           // test byte [rbx + f], imm8
+	emit32(e, OFF(cpu.f));
+	EMIT(e, cc < 2 ? FLAG_Z : FLAG_C);
+	return jump_if_later(e, cc & 1 ? 0x84 : 0x85);
+}
+
+typedef enum {
+	OP_NEXT,  // translated, keep going
+	OP_END,   // translated and the block has exited
+	OP_NONE,  // not translated, nothing emitted
+} op_result_t;
+
+// What one instruction needs to be translated
+typedef struct {
+	uint8_t op;
+	uint16_t next;   // address after it
+	uint8_t imm8;
+	uint16_t imm16;
+	uint32_t cycles; // since the block started, including this one
+	uint32_t count;  // instructions, including this one
+	bool idle_loop;  // a JR back that closes an idle loop, see cpu/idle.h
+} insn_t;
+
+static op_result_t emit_cb(dynarec_t *jit, emit_t *e, const insn_t *in) {
+	uint8_t cb = in->imm8;
+	int reg = cb & 7;
+	int bit = (cb >> 3) & 7;
+	uint8_t mask = 1 << bit;
+
+	if (reg != 6) {
+		uint32_t off = REG_OFF[reg];
+		switch (cb >> 6) {
+		case 0:
+			load8(e, ECX, off);
+			emit_shift(e, bit);
+			store8(e, ECX, off);
+			break;
+		case 1:
+			load8(e, EAX, OFF(cpu.f));
+			EMIT(e, 0x83, 0xE0, FLAG_C);     // and eax, C
+			EMIT(e, 0x83, 0xC8, FLAG_H);     // or eax, H
+			EMIT(e, 0xF6, MODRM_RBX(0));     // test byte [rbx + reg], mask
+			emit32(e, off);
+			EMIT(e, mask);
+			EMIT(e, 0x0F, 0x94, 0xC1);       // setz cl
+			EMIT(e, 0xC0, 0xE1, 0x07);       // shl cl, 7
+			EMIT(e, 0x08, 0xC8);             // or al, cl
+			store8(e, EAX, OFF(cpu.f));
+			break;
+		case 2:
+			alu8_imm(e, GRP_AND, off, ~mask);
+			break;
+		case 3:
+			alu8_imm(e, GRP_OR, off, mask);
+			break;
+		}
+		return OP_NEXT;
+	}
+
+	load_pair(e, HL_PAIR);
+	emit_read(e, in->cycles);
+	EMIT(e, 0x89, 0xC1);                   // mov ecx, eax
+	switch (cb >> 6) {
+	case 0:
+		emit_shift(e, bit);
+		break;
+	case 1:
+		load8(e, EAX, OFF(cpu.f));
+		EMIT(e, 0x83, 0xE0, FLAG_C);           // and eax, C
+		EMIT(e, 0x83, 0xC8, FLAG_H);           // or eax, H
+		EMIT(e, 0xF6, 0xC1, mask);             // test cl, mask
+		EMIT(e, 0x0F, 0x94, 0xC2);             // setz dl
+		EMIT(e, 0xC0, 0xE2, 0x07);             // shl dl, 7
+		EMIT(e, 0x08, 0xD0);                   // or al, dl
+		store8(e, EAX, OFF(cpu.f));
+		return OP_NEXT;
+	case 2:
+		EMIT(e, 0x80, 0xE1, (uint8_t)~mask);   // and cl, ~mask
+		break;
+	case 3:
+		EMIT(e, 0x80, 0xC9, mask);             // or cl, mask
+		break;
+	}
+	load_pair(e, HL_PAIR);
+	emit_write(e, in->cycles);
+	emit_write_check(jit, e, in->next, in->cycles, in->count);
+	return OP_NEXT;
+}
+
+// Emits one instruction, or nothing if it has to go to the interpreter
+static op_result_t emit_op(dynarec_t *jit, emit_t *e, const insn_t *in) {
+	uint8_t op = in->op;
+	uint32_t cycles = in->cycles;
+	uint32_t taken = cycles + OPCODE_BRANCH_CYCLES[op];
+
+	// LD r, r'
+	if (op >= 0x40 && op < 0x80 && op != 0x76) {
+		int dst = (op >> 3) & 7;
+		int src = op & 7;
+		if (dst == 6) {
+			load8(e, ECX, REG_OFF[src]);
+			load_pair(e, HL_PAIR);
+			emit_write(e, cycles);
+			emit_write_check(jit, e, in->next, cycles, in->count);
+		} else if (src == 6) {
+			load_pair(e, HL_PAIR);
+			emit_read(e, cycles);
+			store8(e, EAX, REG_OFF[dst]);
+		} else if (src != dst) {
+			load8(e, EAX, REG_OFF[src]);
+			store8(e, EAX, REG_OFF[dst]);
+		}
+		return OP_NEXT;
+	}
+
+	// ALU A, r and ALU A, n
+	if ((op >= 0x80 && op < 0xC0) || (op & 0xC7) == 0xC6) {
+		int src = op & 7;
+		if (op >= 0xC0) {
+			mov_imm32(e, ECX, in->imm8);
+		} else if (src == 6) {
+			load_pair(e, HL_PAIR);
+			emit_read(e, cycles);
+			EMIT(e, 0x89, 0xC1);   // mov ecx, eax
+		} else {
+			load8(e, ECX, REG_OFF[src]);
+		}
+		emit_alu(e, (op >> 3) & 7);
+		return OP_NEXT;
+	}
+
+	// LD r, n and INC/DEC r
+	if (op < 0x40 && (op & 0x06) == 0x04) {
+		int reg = (op >> 3) & 7;
+		bool dec = op & 1;
+		if (reg == 6) {
+			load_pair(e, HL_PAIR);
+			emit_read(e, cycles);
+			EMIT(e, 0x89, 0xC1);                   // mov ecx, eax
+			EMIT(e, 0xFE, dec ? 0xC9 : 0xC1);      // inc/dec cl
+			emit_flags(e, FLAG_Z | FLAG_H, dec ? FLAG_N : 0, FLAG_C);
+			load_pair(e, HL_PAIR);
+			emit_write(e, cycles);
+			emit_write_check(jit, e, in->next, cycles, in->count);
+		} else {
+			load8(e, EAX, REG_OFF[reg]);
+			EMIT(e, 0xFE, dec ? 0xC8 : 0xC0);      // inc/dec al
+			store8(e, EAX, REG_OFF[reg]);
+			emit_flags(e, FLAG_Z | FLAG_H, dec ? FLAG_N : 0, FLAG_C);
+		}
+		return OP_NEXT;
+	}
+	if ((op & 0xC7) == 0x06) {
+		int reg = (op >> 3) & 7;
+		if (reg == 6) {
+			mov_imm32(e, ECX, in->imm8);
+			load_pair(e, HL_PAIR);
+			emit_write(e, cycles);
+			emit_write_check(jit, e, in->next, cycles, in->count);
+		} else {
+			store8_imm(e, REG_OFF[reg], in->imm8);
+		}
+		return OP_NEXT;
+	}
+
+	// 16 bit loads and arithmetic
+	int pair = (op >> 4) & 3;
+	switch (op & 0xCF) {
+	case 0x01: // LD rr, nn
+		if (pair == 3) {
+			store16_imm(e, OFF(cpu.sp), in->imm16);
+		} else {
+			store8_imm(e, PAIR_HI[pair], in->imm16 >> 8);
+			store8_imm(e, PAIR_LO[pair], (uint8_t)in->imm16);
+		}
+		return OP_NEXT;
+	case 0x03: // INC rr
+	case 0x0B: // DEC rr
+		if (pair == 3) {
+			EMIT(e, 0x66, 0xFF, MODRM_RBX(op == 0x3B ? 1 : 0));
+			emit32(e, OFF(cpu.sp));
+		} else {
+			load_pair(e, PAIR_HI[pair], PAIR_LO[pair]);
+			EMIT(e, 0x8D, 0x46, op & 0x08 ? 0xFF : 0x01); // lea eax, [rsi +- 1]
+			store_pair(e, PAIR_HI[pair], PAIR_LO[pair]);
+		}
+		return OP_NEXT;
+	case 0x09: // ADD HL, rr, the high byte add carries H out of bit 11
+		load8(e, EAX, OFF(cpu.l));
+		load8(e, ECX, PAIR_LO[pair]);
+		EMIT(e, 0x00, 0xC8);                   // add al, cl
+		store8(e, EAX, OFF(cpu.l));
+		load8(e, EAX, OFF(cpu.h));
+		load8(e, ECX, PAIR_HI[pair]);
+		EMIT(e, 0x10, 0xC8);                   // adc al, cl
+		store8(e, EAX, OFF(cpu.h));
+		emit_flags(e, FLAG_H | FLAG_C, 0, FLAG_Z);
+		return OP_NEXT;
+	case 0xC1: // POP rr
+		emit_pop(e, STACK_HI[pair], STACK_LO[pair], cycles);
+		if (pair == 3) {
+			alu8_imm(e, GRP_AND, OFF(cpu.f), 0xF0);
+		}
+		return OP_NEXT;
+	case 0xC5: // PUSH rr
+		emit_push_regs(e, STACK_HI[pair], STACK_LO[pair], cycles);
+		emit_write_check(jit, e, in->next, cycles, in->count);
+		return OP_NEXT;
+	}
+
+	// Jumps, calls and returns end the block
+	if ((op & 0xC7) == 0xC7) { // RST
+		emit_push_imm(e, in->next, cycles);
+		emit_exit(jit, e, op & 0x38, cycles, in->count, true);
+		return OP_END;
+	}
+	switch (op) {
+	case 0x18: // JR
+	case 0xC3: // JP
+	case 0xCD: // CALL
+	{
+		uint16_t target = op == 0x18 ? in->next + (int8_t)in->imm8 : in->imm16;
+		if (op == 0xCD) {
+			emit_push_imm(e, in->next, cycles);
+		}
+		if (in->idle_loop) {
+			emit_idle_exit(jit, e, target, in->next - 2, taken, in->count);
+		} else {
+			emit_exit(jit, e, target, taken, in->count, true);
+		}
+		return OP_END;
+	}
+	case 0x20: case 0x28: case 0x30: case 0x38: // JR cc
+	case 0xC2: case 0xCA: case 0xD2: case 0xDA: // JP cc
+	case 0xC4: case 0xCC: case 0xD4: case 0xDC: // CALL cc
+	{
+		uint16_t target = op < 0x40 ? in->next + (int8_t)in->imm8 : in->imm16;
+		uint8_t *not_taken = emit_unless(e, op);
+		if ((op & 0xC7) == 0xC4) {
+			emit_push_imm(e, in->next, cycles);
+		}
+		if (in->idle_loop) {
+			emit_idle_exit(jit, e, target, in->next - 2, taken, in->count);
+		} else {
+			emit_exit(jit, e, target, taken, in->count, true);
+		}
+		patch_rel32(not_taken, e->p);
+		emit_exit(jit, e, in->next, cycles, in->count, true);
+		return OP_END;
+	}
+	case 0xC9: // RET
+		emit_pop(e, OFF(cpu.pc) + 1, OFF(cpu.pc), cycles);
+		emit_exit_dynamic(jit, e, cycles, in->count);
+		return OP_END;
+	case 0xC0: case 0xC8: case 0xD0: case 0xD8: // RET cc
+	{
+		uint8_t *not_taken = emit_unless(e, op);
+		emit_pop(e, OFF(cpu.pc) + 1, OFF(cpu.pc), cycles);
+		emit_exit_dynamic(jit, e, taken, in->count);
+		patch_rel32(not_taken, e->p);
+		emit_exit(jit, e, in->next, cycles, in->count, true);
+		return OP_END;
+	}
+	case 0xE9: // JP HL
+		load_pair(e, HL_PAIR);
+		EMIT(e, 0x66, 0x89, MODRM_RBX(ESI));   // mov word [rbx + pc], si
+		emit32(e, OFF(cpu.pc));
+		emit_exit_dynamic(jit, e, cycles, in->count);
+		return OP_END;
+	}
+
+	// Everything else one at a time
+	switch (op) {
+	case 0x00: // NOP
+		return OP_NEXT;
+	case 0x02: // LD (BC), A
+	case 0x12: // LD (DE), A
+	case 0x22: // LD (HL+), A
+	case 0x32: // LD (HL-), A
+		load8(e, ECX, OFF(cpu.a));
+		load_pair(e, PAIR_HI[op < 0x20 ? pair : 2], PAIR_LO[op < 0x20 ? pair : 2]);
+		emit_write(e, cycles);
+		if (op >= 0x20) {
+			load_pair(e, HL_PAIR);
+			EMIT(e, 0x8D, 0x46, op == 0x32 ? 0xFF : 0x01); // lea eax, [rsi +- 1]
+			store_pair(e, HL_PAIR);
+		}
+		emit_write_check(jit, e, in->next, cycles, in->count);
+		return OP_NEXT;
+	case 0x0A: // LD A, (BC)
+	case 0x1A: // LD A, (DE)
+	case 0x2A: // LD A, (HL+)
+	case 0x3A: // LD A, (HL-)
+		load_pair(e, PAIR_HI[op < 0x20 ? pair : 2], PAIR_LO[op < 0x20 ? pair : 2]);
+		emit_read(e, cycles);
+		store8(e, EAX, OFF(cpu.a));
+		if (op >= 0x20) {
+			load_pair(e, HL_PAIR);
+			EMIT(e, 0x8D, 0x46, op == 0x3A ? 0xFF : 0x01); // lea eax, [rsi +- 1]
+			store_pair(e, HL_PAIR);
+		}
+		return OP_NEXT;
+	case 0x07: // RLCA
+	case 0x0F: // RRCA
+	case 0x17: // RLA
+	case 0x1F: // RRA
+		load8(e, ECX, OFF(cpu.a));
+		emit_shift(e, op >> 3);
+		store8(e, ECX, OFF(cpu.a));
+		alu8_imm(e, GRP_AND, OFF(cpu.f), (uint8_t)~FLAG_Z);
+		return OP_NEXT;
+	case 0x27: // DAA
+		emit_daa(e);
+		return OP_NEXT;
+	case 0x2F: // CPL
+		alu8_imm(e, GRP_XOR, OFF(cpu.a), 0xFF);
+		alu8_imm(e, GRP_OR, OFF(cpu.f), FLAG_N | FLAG_H);
+		return OP_NEXT;
+	case 0x37: // SCF
+		alu8_imm(e, GRP_AND, OFF(cpu.f), FLAG_Z);
+		alu8_imm(e, GRP_OR, OFF(cpu.f), FLAG_C);
+		return OP_NEXT;
+	case 0x3F: // CCF
+		alu8_imm(e, GRP_AND, OFF(cpu.f), FLAG_Z | FLAG_C);
+		alu8_imm(e, GRP_XOR, OFF(cpu.f), FLAG_C);
+		return OP_NEXT;
+	case 0xCB:
+		return emit_cb(jit, e, in);
+	case 0xE0: // LDH (n), A
+	case 0xE2: // LD (C), A
+	case 0xEA: // LD (nn), A
+		if (op == 0xE2) {
+			load8(e, ESI, OFF(cpu.c));
+			EMIT(e, 0x81, 0xCE);           // or esi, 0xFF00
+			emit32(e, 0xFF00);
+		} else {
+			mov_imm32(e, ESI, op == 0xE0 ? 0xFF00 | in->imm8 : in->imm16);
+		}
+		load8(e, ECX, OFF(cpu.a));
+		emit_write(e, cycles);
+		emit_write_check(jit, e, in->next, cycles, in->count);
+		return OP_NEXT;
+	case 0xF0: // LDH A, (n)
+	case 0xF2: // LD A, (C)
+	case 0xFA: // LD A, (nn)
+		if (op == 0xF2) {
+			load8(e, ESI, OFF(cpu.c));
+			EMIT(e, 0x81, 0xCE);           // or esi, 0xFF00
+			emit32(e, 0xFF00);
+		} else {
+			mov_imm32(e, ESI, op == 0xF0 ? 0xFF00 | in->imm8 : in->imm16);
+		}
+		emit_read(e, cycles);
+		store8(e, EAX, OFF(cpu.a));
+		return OP_NEXT;
+	case 0xF3: // DI
+		store8_imm(e, OFF(cpu.ime), 0);
+		store8_imm(e, OFF(cpu.ei_pending), 0);
+		return OP_NEXT;
+	case 0xF9: // LD SP, HL
+		load_pair(e, HL_PAIR);
+		EMIT(e, 0x66, 0x89, MODRM_RBX(ESI));   // mov word [rbx + sp], si
+		emit32(e, OFF(cpu.sp));
+		return OP_NEXT;
+	}
+
+	// LD (nn), SP, STOP, HALT, RETI, EI, the SP offset ops and unused opcodes
+	return OP_NONE;
+}
+
+static void unwatch_all(mmu_t *mmu) {
+	for (int page = 0; page < MMU_PAGE_COUNT; page++) {
+		if (mmu->code_pages[page] != MMU_CODE_NONE) {
+			mmu_unwatch_code(mmu, page);
+		}
+	}
+	mmu->code_written = false;
+}
+
+// Drops every block. Links between blocks go with the code they're in
+static void flush(dynarec_t *jit, mmu_t *mmu) {
+	memset(jit->blocks, 0, sizeof(jit->blocks));
+	jit->code_used = jit->code_start;
+	unwatch_all(mmu);
+	jit->stats.flushes++;
+}
+
+// Rom, wram (not its echo) and hram, where code is expected to run from
+static bool translatable(mmu_t *mmu, uint16_t pc) {
+	if (pc < 0x8000 || (pc >= 0xC000 && pc < 0xE000)) {
+		return mmu->read_pages[pc >> MMU_PAGE_SHIFT] != NULL;
+	}
+	return pc >= 0xFF80 && pc < 0xFFFF;
+}
+
+// Whether an instruction fits on the block's page (and stays out of IE)
+static bool fits(uint16_t start, uint16_t pc, int len) {
+	uint32_t last = (uint32_t)pc + len - 1;
+	if ((last >> MMU_PAGE_SHIFT) != (start >> MMU_PAGE_SHIFT)) {
+		return false;
+	}
+	return last != 0xFFFF;
+}
+
+// The code buffer is never writable and executable at once. The pages
+// holding [at, at + len) are made writable for translating or linking, and
+// executable again straight after
+static bool code_writable(dynarec_t *jit, uint8_t *at, size_t len, bool writable) {
+	uintptr_t mask = jit->page_size - 1;
+	uintptr_t from = (uintptr_t)at & ~mask;
+	uintptr_t to = ((uintptr_t)at + len + mask) & ~mask;
+	int prot = PROT_READ | (writable ? PROT_WRITE : PROT_EXEC);
+	return mprotect((void *)from, to - from, prot) == 0;
+}
+
+static uint8_t *emit_block(dynarec_t *jit, gb_t *gb, uint16_t start, uint32_t *max) {
+	mmu_t *mmu = &gb->mmu;
+	uint8_t page = start >> MMU_PAGE_SHIFT;
+	bool ram = start >= 0x8000;
+	emit_t e = { .p = jit->code + jit->code_used };
+	uint8_t *entry = e.p;
+
+	// Blocks can be jumped to from others, so each checks it's still valid
+	EMIT(&e, 0x45, 0x31, 0xFF);                // xor r15d, r15d
+	EMIT(&e, 0x48, 0x8B, MODRM_RBX(EAX));      // mov rax, [rbx + read_pages[page]]
+	emit32(&e, OFF(mmu.read_pages) + page * 8);
+	load_table(&e, mmu->read_pages[page]);
+	EMIT(&e, 0x48, 0x39, 0xD0);                // cmp rax, rdx
+	jump_if(&e, 0x85, jit->exit);
+	if (ram) {
+		load_table(&e, &jit->gens[page]);
+		EMIT(&e, 0x81, 0x3A);                  // cmp dword [rdx], gen
+		emit32(&e, jit->gens[page]);
+		jump_if(&e, 0x85, jit->exit);
+	}
+
+	// Events only run between blocks, so a block that could end past the
+	// next one is left to the interpreter to get there exactly
+	EMIT(&e, 0x48, 0x8B, MODRM_RBX(EAX));      // mov rax, [rbx + cycles]
+	emit32(&e, OFF(cycles));
+	EMIT(&e, 0x48, 0x05);                      // add rax, max_cycles
+	uint8_t *max_at = e.p;
+	emit32(&e, 0);
+	EMIT(&e, 0x4C, 0x39, 0xF0);                // cmp rax, r14
+	jump_if(&e, 0x87, jit->exit);
+
+	uint16_t pc = start;
+	uint32_t cycles = 0;
+	uint32_t max_cycles = 0;
+	uint32_t count = 0;
+	for (;;) {
+		uint8_t op = mmu_read(mmu, pc);
+		int len = OPCODE_LENGTHS[op];
+		bool room = count < DYNAREC_BLOCK_MAX &&
+			    e.p - entry < DYNAREC_BLOCK_BYTES - 0x400;
+		if (!room || !fits(start, pc, len)) {
+			if (count == 0) {
+				return NULL;
+			}
+			emit_exit(jit, &e, pc, cycles, count, true);
+			break;
+		}
+
+		insn_t in = {
+			.op = op,
+			.next = pc + len,
+			.imm8 = len > 1 ? mmu_read(mmu, pc + 1) : 0,
+			.count = count + 1,
+		};
+		if (len == 3) {
+			in.imm16 = (uint16_t)(mmu_read(mmu, pc + 2) << 8 | in.imm8);
+		}
+		if ((op == 0x18 || (op & 0xE7) == 0x20) && (int8_t)in.imm8 < 0) {
+			in.idle_loop = idle_is_loop(gb, pc);
+		}
+		in.cycles = cycles + OPCODE_CYCLES[op];
+		if (op == 0xCB) {
+			in.cycles += CB_OPCODE_CYCLES[in.imm8];
+		}
+
+		op_result_t result = emit_op(jit, &e, &in);
+		if (result == OP_NONE) {
+			if (count == 0) {
+				return NULL;
+			}
+			emit_exit(jit, &e, pc, cycles, count, true);
+			break;
+		}
+		pc = in.next;
+		cycles = in.cycles;
+		count = in.count;
+		if (cycles + OPCODE_BRANCH_CYCLES[op] > max_cycles) {
+			max_cycles = cycles + OPCODE_BRANCH_CYCLES[op];
+		}
+		if (result == OP_END) {
+			break;
+		}
+	}
+
+	if (ram) {
+		mmu_watch_code(mmu, start);
+	}
+	memcpy(max_at, &max_cycles, 4);
+	*max = max_cycles;
+	jit->code_used = e.p - jit->code;
+	jit->stats.blocks++;
+	return entry;
+}
+
+static uint8_t *translate(dynarec_t *jit, gb_t *gb, uint16_t start, uint32_t *max) {
+	mmu_t *mmu = &gb->mmu;
+	if (!translatable(mmu, start)) {
+		return NULL;
+	}
+	if (jit->code_used + DYNAREC_BLOCK_BYTES > DYNAREC_CODE_SIZE) {
+		flush(jit, mmu);
+	}
+
+	// Blocks before this one can share its first page. If that page can't
+	// go back to executable they can't run either, so they all go
+	uint8_t *at = jit->code + jit->code_used;
+	if (!code_writable(jit, at, DYNAREC_BLOCK_BYTES, true)) {
+		return NULL;
+	}
+	uint8_t *entry = emit_block(jit, gb, start, max);
+	if (!code_writable(jit, at, DYNAREC_BLOCK_BYTES, false)) {
+		flush(jit, mmu);
+		return NULL;
+	}
+	return entry;
+}
+
+// Points a chained exit's jump at the block for the pc it left with.
+// Returns false if the code had to be dropped, see translate
+static bool link_exit(dynarec_t *jit, mmu_t *mmu, uint8_t *link, uint8_t *target) {
+	if (!code_writable(jit, link, 4, true)) {
+		return true; // left unlinked, it goes through the dispatcher
+	}
+	patch_rel32(link, target);
+	if (!code_writable(jit, link, 4, false)) {
+		flush(jit, mmu);
+		return false;
+	}
+	return true;
+}
+
+static uint32_t block_key(mmu_t *mmu, uint16_t pc) {
+	uint32_t bank = 0;
+	if (pc < 0x8000 && mmu->cart->data) {
+		block_t *rom = &mmu->blocks[pc < 0x4000 ? MMU_ROM_FIXED : MMU_ROM_SWITCH];
+		if (rom->buf) {
+			bank = (uint32_t)((rom->buf - mmu->cart->data) / rom->len);
+		}
+	}
+	return bank << 16 | pc;
+}
+
+static jit_block_t *lookup(dynarec_t *jit, gb_t *gb) {
+	mmu_t *mmu = &gb->mmu;
+	uint16_t pc = gb->cpu.pc;
+	uint8_t page = pc >> MMU_PAGE_SHIFT;
+	uint32_t key = block_key(mmu, pc);
+	uint32_t slot = (key * 2654435761u) >> (32 - DYNAREC_CACHE_BITS);
+
+	jit_block_t *block = &jit->blocks[slot];
+	if (block->used && block->key == key &&
+	    block->page == mmu->read_pages[page] && block->gen == jit->gens[page]) {
+		return block;
+	}
+
+	// Translating can flush, which clears the slot as well
+	uint32_t max_cycles = 0;
+	uint8_t *code = translate(jit, gb, pc, &max_cycles);
+	*block = (jit_block_t){
+		.used = true,
+		.key = key,
+		.gen = jit->gens[page],
+		.page = mmu->read_pages[page],
+		.code = code,
+		.max_cycles = max_cycles,
+	};
+	return block;
+}
+
+// Echo ram writes land on the wram page the code was translated from
+static void drop_written(dynarec_t *jit, mmu_t *mmu) {
+	mmu->code_written = false;
+	for (int page = 0; page < MMU_PAGE_COUNT; page++) {
+		if (mmu->code_pages[page] != MMU_CODE_WRITTEN) {
+			continue;
+		}
+		int code_page = page >= 0xE0 && page <= 0xFD ? page - 0x20 : page;
+		jit->gens[code_page]++;
+		mmu_unwatch_code(mmu, code_page);
+		jit->stats.invalidations++;
+	}
+}
+
+// Chained blocks never see the dispatcher, so anything that has to happen
+// between instructions sends the next one to the interpreter
+static bool needs_interpreter(gb_t *gb) {
+	Cpu *cpu = &gb->cpu;
+	return cpu->halted || cpu->ei_pending || cpu->halt_bug || (cpu->ime && gb->mmu.int_pending);
+}
+
+static void check_lockstep(dynarec_t *jit, gb_t *gb, uint16_t block_pc) {
+	gb_t *shadow = jit->shadow;
+	while (shadow->cycles < gb->cycles) {
+		cpu_step(shadow);
+	}
+
+	Cpu *a = &gb->cpu;
+	Cpu *b = &shadow->cpu;
+	bool same = a->a == b->a && a->f == b->f && a->b == b->b && a->c == b->c &&
+		    a->d == b->d && a->e == b->e && a->h == b->h && a->l == b->l &&
+		    a->sp == b->sp && a->pc == b->pc && a->ime == b->ime &&
+		    a->halted == b->halted && gb->cycles == shadow->cycles &&
+		    gb->instructions == shadow->instructions;
+	if (same) {
+		return;
+	}
+
+	jit->stats.mismatches++;
+	fprintf(stderr,
+		"dynarec: block at %04X disagrees at cycle %llu\n"
+		"  dynarec AF=%02X%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X PC=%04X cycles %llu\n"
+		"  interp  AF=%02X%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X PC=%04X cycles %llu\n",
+		block_pc, (unsigned long long)gb->cycles,
+		a->a, a->f, a->b, a->c, a->d, a->e, a->h, a->l, a->sp, a->pc,
+		(unsigned long long)gb->cycles,
+		b->a, b->f, b->b, b->c, b->d, b->e, b->h, b->l, b->sp, b->pc,
+		(unsigned long long)shadow->cycles);
+
+	// Carry on from the dynarec's state so later disagreements show up too
+	gb_t *fresh = gb_clone(gb);
+	if (fresh) {
+		gb_destroy(shadow);
+		jit->shadow = fresh;
+	}
+}
+
+static dynarec_t *dynarec_create(gb_t *gb) {
+	dynarec_t *jit = calloc(1, sizeof(dynarec_t));
+	if (!jit) {
+		return NULL;
+	}
+
+	void *code = mmap(NULL, DYNAREC_CODE_SIZE, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED) {
+		// Left without code, dynarec_run_cycles interprets
+		return jit;
+	}
+	jit->code = code;
+	jit->page_size = (size_t)sysconf(_SC_PAGESIZE);
+	init_host_flags();
+
+	// enter: push rbx; push r14; push r15; mov rbx, rdi; mov r14, rdx; jmp rsi
+	// exit: xor eax, eax; pop r15; pop r14; pop rbx; ret
+	emit_t e = { .p = jit->code };
+	EMIT(&e, 0x53, 0x41, 0x56, 0x41, 0x57, 0x48, 0x89, 0xFB, 0x49, 0x89, 0xD6, 0xFF, 0xE6);
+	jit->exit = e.p;
+	EMIT(&e, 0x31, 0xC0, 0x41, 0x5F, 0x41, 0x5E, 0x5B, 0xC3);
+	jit->enter = (jit_enter_t)(void *)jit->code;
+	jit->code_start = jit->code_used = e.p - jit->code;
+	if (!code_writable(jit, jit->code, DYNAREC_CODE_SIZE, false)) {
+		munmap(jit->code, DYNAREC_CODE_SIZE);
+		jit->code = NULL;
+		return jit;
+	}
+
+	// A clone can come with pages watched for a dynarec it doesn't have
+	unwatch_all(&gb->mmu);
+
+	if (getenv("FOZBOY_DYNAREC_CHECK")) {
+		jit->shadow = gb_clone(gb);
+	}
+	return jit;
+}
+
+bool dynarec_available(void) {
+	return true;
+}
+
+uint64_t dynarec_run_cycles(gb_t *gb, uint64_t budget) {
+	if (!gb->dynarec) {
+		gb->dynarec = dynarec_create(gb);
+	}
+	dynarec_t *jit = gb->dynarec;
+	if (!jit || !jit->code) {
+		return cpu_run_cycles(gb, budget);
+	}
+
+	mmu_t *mmu = &gb->mmu;
+	scheduler_t *sched = &gb->sched;
+	uint64_t start = gb->cycles;
+	uint8_t *link = NULL;
+
+	// Same budget event as cpu_run_cycles, see there
+	uint64_t outer_end = sched->at[SCHED_END];
+	scheduler_set(sched, SCHED_END, start + budget);
+
+	for (;;) {
+		if (gb->cycles >= sched->next && scheduler_run_due(gb)) {
+			break;
+		}
+		if (mmu->code_written) {
+			drop_written(jit, mmu);
+		}
+
+		uint16_t pc = gb->cpu.pc;
+		uint64_t flushes = jit->stats.flushes;
+		jit_block_t *block = needs_interpreter(gb) ? NULL : lookup(jit, gb);
+		if (jit->stats.flushes != flushes) {
+			link = NULL; // went with the old code
+		}
+
+		bool idle = gb->cpu.halted && !mmu->int_pending;
+		if (idle || (block && block->code && gb->cycles + block->max_cycles > sched->next)) {
+			// Interpret up to the event in one go. That's a few
+			// instructions, or a single skip ahead in HALT
+			link = NULL;
+			cpu_run_cycles(gb, sched->next - gb->cycles);
+			jit->stats.fallbacks++;
+		} else if (!block || !block->code) {
+			link = NULL;
+			cpu_step(gb);
+			jit->stats.fallbacks++;
+		} else {
+			if (link && !jit->shadow && !link_exit(jit, mmu, link, block->code)) {
+				link = NULL;
+				continue;
+			}
+			link = jit->enter(gb, block->code, sched->next);
+			jit->stats.runs++;
+		}
+
+		if (jit->shadow) {
+			check_lockstep(jit, gb, pc);
+		}
+	}
+
+	scheduler_set(sched, SCHED_END, outer_end);
+	return gb->cycles - start;
+}
+
+int dynarec_set_lockstep(gb_t *gb, bool on) {
+	if (!gb->dynarec) {
+		gb->dynarec = dynarec_create(gb);
+	}
+	dynarec_t *jit = gb->dynarec;
+	if (!jit) {
+		return -1;
+	}
+
+	if (jit->shadow) {
+		gb_destroy(jit->shadow);
+		jit->shadow = NULL;
+	}
+	if (on) {
+		// Links made so far would skip the checks
+		if (jit->code) {
+			flush(jit, &gb->mmu);
+		}
+		jit->shadow = gb_clone(gb);
+		if (!jit->shadow) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void dynarec_destroy(dynarec_t *jit) {
+	if (!jit) {
+		return;
+	}
+	if (jit->code) {
+		munmap(jit->code, DYNAREC_CODE_SIZE);
+	}
+	gb_destroy(jit->shadow);
+	free(jit);
+}
+
+#else
+
+// No translator for this host, the interpreter does everything
+
+typedef struct dynarec {
+	dynarec_stats_t stats;
+} dynarec_t;
+
+bool dynarec_available(void) {
+	return false;
+}
+
+uint64_t dynarec_run_cycles(gb_t *gb, uint64_t budget) {
+	return cpu_run_cycles(gb, budget);
+}
+
+int dynarec_set_lockstep(gb_t *gb, bool on) {
+	return on ? -1 : 0;
+}
+
+void dynarec_destroy(dynarec_t *jit) {
+	free(jit);
+}
+
+#endif
+
+dynarec_stats_t dynarec_stats(gb_t *gb) {
+	if (!gb->dynarec) {
+		return (dynarec_stats_t){0};
+	}
+	return gb->dynarec->stats;
+}
+
+void dynarec_print_stats(gb_t *gb, FILE *out) {
+	dynarec_stats_t stats = dynarec_stats(gb);
+	fprintf(out,
+		"dynarec: %llu blocks, %llu flushes, %llu runs, %llu fallbacks, %llu invalidations, %llu mismatches\n",
+		(unsigned long long)stats.blocks, (unsigned long long)stats.flushes,
+		(unsigned long long)stats.runs, (unsigned long long)stats.fallbacks,
+		(unsigned long long)stats.invalidations, (unsigned long long)stats.mismatches);
+}
@@ -0,0 +1,50 @@
+#ifndef DYNAREC_H
+#define DYNAREC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct gb;
+struct dynarec;
+
+// Translates straight line SM83 code into x86-64, a basic block at a time.
+// Blocks come from rom banks, wram and hram and are cached by (bank, address).
+// Anything it can't translate (HALT, STOP, EI, RETI, interrupts, code in vram
+// or cart ram) is left to the interpreter, see cpu_step. Only built for
+// x86-64 System V hosts, elsewhere dynarec_run_cycles is cpu_run_cycles
+
+typedef struct {
+	uint64_t blocks;        // blocks translated
+	uint64_t flushes;       // times the code buffer filled up and was emptied
+	uint64_t runs;          // times translated code was entered
+	uint64_t fallbacks;     // times the interpreter ran instead, for an instruction,
+	                        // an interrupt or the last few before an event
+	uint64_t invalidations; // ram pages dropped because code on them was written
+	uint64_t mismatches;    // lockstep disagreements with the interpreter
+} dynarec_stats_t;
+
+// True if this build can translate code for the host
+bool dynarec_available(void);
+
+// Same contract as cpu_run_cycles. A block is only entered if it can't run
+// past the next event, the instructions up to it are interpreted, so events
+// land on the same instruction either way. Sets up gb->dynarec on the first
+// call, and falls back to the interpreter if no executable memory can be had
+uint64_t dynarec_run_cycles(struct gb *gb, uint64_t budget);
+
+// Runs an interpreter on a copy of the machine alongside the translated code,
+// comparing registers after every block (blocks aren't chained meanwhile).
+// Disagreements are printed to stderr and counted in the stats.
+// Also turned on by setting FOZBOY_DYNAREC_CHECK
+// Returns -1 on failure
+int dynarec_set_lockstep(struct gb *gb, bool on);
+
+// Counters so far, zeroed if nothing has been translated
+dynarec_stats_t dynarec_stats(struct gb *gb);
+void dynarec_print_stats(struct gb *gb, FILE *out);
+
+// Frees the code buffer and cache, safe to call with NULL
+void dynarec_destroy(struct dynarec *jit);
+
+#endif
@@ -0,0 +1,78 @@
+const std = @import("std");
+const testing = std.testing;
+const test_gb = @import("test_gb");
+const c = test_gb.c;
+
+test "dynarec_run_cycles - runs a loop in step with the interpreter" {
+    if (!c.dynarec_available()) return error.SkipZigTest;
+
+    // XOR A; LD B, 10; loop: ADD A, B; DEC B; JR NZ, loop; LD (C000), A; JR -2
+    const gb = test_gb.create(.{}, &.{ 0xAF, 0x06, 0x0A, 0x80, 0x05, 0x20, 0xFC, 0xEA, 0x00, 0xC0, 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    try testing.expect(c.dynarec_set_lockstep(gb, true) == 0);
+
+    const ran = c.dynarec_run_cycles(gb, 1000);
+    try testing.expect(ran >= 1000);
+    try testing.expect(c.mmu_read(&gb.*.mmu, 0xC000) == 55);
+    try testing.expect(gb.*.cpu.pc == 0x10A);
+
+    const stats = c.dynarec_stats(gb);
+    try testing.expect(stats.blocks > 0);
+    try testing.expect(stats.mismatches == 0);
+}
+
+test "dynarec_run_cycles - code written to wram is translated again" {
+    if (!c.dynarec_available()) return error.SkipZigTest;
+
+    // Writes LD A, 1; RET to C000 and calls it, then patches the operand to 2
+    // and calls it again
+    const gb = test_gb.create(.{}, &.{
+        0x31, 0xF0, 0xDF, // LD SP, DFF0
+        0x21, 0x00, 0xC0, // LD HL, C000
+        0x36, 0x3E, 0x23, // LD (HL), 3E; INC HL
+        0x36, 0x01, 0x23, // LD (HL), 01; INC HL
+        0x36, 0xC9, // LD (HL), C9
+        0xCD, 0x00, 0xC0, // CALL C000
+        0x47, // LD B, A
+        0x3E, 0x02, // LD A, 2
+        0xEA, 0x01, 0xC0, // LD (C001), A
+        0xCD, 0x00, 0xC0, // CALL C000
+        0x4F, // LD C, A
+        0x18, 0xFE, // JR -2
+    });
+    defer c.gb_destroy(gb);
+    try testing.expect(c.dynarec_set_lockstep(gb, true) == 0);
+
+    _ = c.dynarec_run_cycles(gb, 400);
+    try testing.expect(gb.*.cpu.b == 1);
+    try testing.expect(gb.*.cpu.c == 2);
+
+    const stats = c.dynarec_stats(gb);
+    try testing.expect(stats.invalidations > 0);
+    try testing.expect(stats.mismatches == 0);
+}
+
+test "dynarec_run_cycles - blocks are kept apart by rom bank" {
+    if (!c.dynarec_available()) return error.SkipZigTest;
+
+    // Calls 4000 in bank 1, switches to bank 2 and calls it again
+    const gb = test_gb.create(.{ .cart_type = c.MBC1 }, &.{
+        0x31, 0xF0, 0xDF, // LD SP, DFF0
+        0xCD, 0x00, 0x40, // CALL 4000
+        0x47, // LD B, A
+        0x3E, 0x02, // LD A, 2
+        0xEA, 0x00, 0x20, // LD (2000), A
+        0xCD, 0x00, 0x40, // CALL 4000
+        0x4F, // LD C, A
+        0x18, 0xFE, // JR -2
+    });
+    defer c.gb_destroy(gb);
+    // LD A, n; RET at the start of banks 1 and 2
+    @memcpy(test_gb.rom[0x4000..0x4003], &[_]u8{ 0x3E, 0x11, 0xC9 });
+    @memcpy(test_gb.rom[0x8000..0x8003], &[_]u8{ 0x3E, 0x22, 0xC9 });
+
+    _ = c.dynarec_run_cycles(gb, 400);
+    try testing.expect(gb.*.cpu.b == 0x11);
+    try testing.expect(gb.*.cpu.c == 0x22);
+    try testing.expect(c.dynarec_stats(gb).mismatches == 0);
+}
@@ -0,0 +1,255 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "idle.h"
+#include "cpu.h"
+#include "../memory/mmu.h"
+#include "../state/gb.h"
+#include "../static/idle_hacks.h"
+#include "../static/opcode_cycles.h"
+#include "../processing/timer.h"
+
+// What an instruction reads and writes, for checking that every trip round
+// a loop sees the same values
+#define USES_A 0x01
+#define USES_Z 0x02
+#define USES_C 0x04
+
+void idle_init(idle_t *idle, cart_t *cart) {
+	memset(idle, 0, sizeof(*idle));
+	if (!cart->data || cart->size < 0x150) {
+		return;
+	}
+
+	idle->header_checksum = cart->data[0x14D];
+	idle->global_checksum = (uint16_t)(cart->data[0x14E] << 8 | cart->data[0x14F]);
+	for (const idle_hack_t *hack = IDLE_HACKS; hack->pc; hack++) {
+		if (hack->header_checksum == idle->header_checksum &&
+		    hack->global_checksum == idle->global_checksum) {
+			idle->has_hacks = true;
+		}
+	}
+}
+
+// Rom bank pc is in, as the mbc has it mapped
+static uint16_t rom_bank(mmu_t *mmu, uint16_t pc) {
+	block_t *rom = &mmu->blocks[pc < 0x4000 ? MMU_ROM_FIXED : MMU_ROM_SWITCH];
+	if (!rom->buf || !mmu->cart->data) {
+		return 0;
+	}
+	return (uint16_t)((rom->buf - mmu->cart->data) / rom->len);
+}
+
+static bool listed(gb_t *gb, uint16_t start) {
+	idle_t *idle = &gb->idle;
+	if (!idle->has_hacks) {
+		return false;
+	}
+
+	uint16_t bank = rom_bank(&gb->mmu, start);
+	for (const idle_hack_t *hack = IDLE_HACKS; hack->pc; hack++) {
+		if (hack->header_checksum == idle->header_checksum &&
+		    hack->global_checksum == idle->global_checksum &&
+		    hack->bank == bank && hack->pc == start) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Io that only changes when an event runs, or a write the loop doesn't do.
+// DIV and TIMA count along with the cycles. Listed loops may read anywhere
+// else too, the entry promises only the cpu or an event changes it there
+static bool steady_address(uint16_t address, bool db) {
+	if (address < 0xFF00) {
+		return db;
+	}
+	return address != 0xFF00 + IO_DIV && address != 0xFF00 + IO_TIMA;
+}
+
+// What an instruction in a detected loop uses (reads) and sets (writes)
+// Returns false if it's not something an idle loop does
+static bool side_effect_free(uint8_t op, uint8_t imm8, uint16_t imm16, bool db,
+			     uint8_t *reads, uint8_t *writes) {
+	*reads = 0;
+	*writes = 0;
+
+	switch (op) {
+	case 0xF0: // LDH A, (n)
+		*writes = USES_A;
+		return steady_address(0xFF00 | imm8, false);
+	case 0xFA: // LD A, (nn)
+		*writes = USES_A;
+		return steady_address(imm16, db);
+	case 0x0A: case 0x1A: case 0x7E: // LD A, (BC/DE/HL), nothing in the loop moves them
+		*writes = USES_A;
+		return db;
+	case 0xE6: case 0xEE: case 0xF6: // AND/XOR/OR n
+		*reads = USES_A;
+		*writes = USES_A | USES_Z | USES_C;
+		return true;
+	case 0xFE: // CP n
+		*reads = USES_A;
+		*writes = USES_Z | USES_C;
+		return true;
+	case 0xCB: // BIT b, r
+		if ((imm8 & 0xC0) != 0x40 || (imm8 & 7) == 6) {
+			return false;
+		}
+		*reads = (imm8 & 7) == 7 ? USES_A : 0;
+		*writes = USES_Z;
+		return true;
+	}
+
+	// AND/XOR/OR/CP r, not (HL)
+	if (op >= 0xA0 && op <= 0xBF && (op & 7) != 6) {
+		*reads = USES_A;
+		*writes = USES_Z | USES_C;
+		if (op < 0xB8) {
+			*writes |= USES_A;
+		}
+		// XOR A is zero whatever A was
+		if (op == 0xAF) {
+			*reads = 0;
+		}
+		return true;
+	}
+	return false;
+}
+
+static uint8_t condition_reads(uint8_t op) {
+	return ((op >> 3) & 3) < 2 ? USES_Z : USES_C;
+}
+
+// Walks the loop from start to the jump back at `from`. Branches out of it
+// part way are fine, they weren't taken on the trip that just ran
+static void analyse(gb_t *gb, uint16_t start, uint16_t from, idle_loop_t *loop) {
+	mmu_t *mmu = &gb->mmu;
+	bool db = listed(gb, start);
+	uint8_t stale = 0;   // read before being set on this trip
+	uint8_t written = 0; // set somewhere on the trip
+	uint32_t cycles = 0;
+	uint32_t count = 0;
+
+	uint16_t pc = start;
+	while (pc < from) {
+		uint8_t op = mmu_read(mmu, pc);
+		int len = OPCODE_LENGTHS[op];
+		uint8_t imm8 = mmu_read(mmu, pc + 1);
+		uint16_t imm16 = (uint16_t)(mmu_read(mmu, pc + 2) << 8 | imm8);
+		uint8_t reads = 0;
+		uint8_t writes = 0;
+
+		if ((op & 0xE7) == 0x20) { // JR cc out of the loop
+			uint16_t target = pc + 2 + (int8_t)imm8;
+			if (target >= start && target <= from) {
+				return;
+			}
+			reads = condition_reads(op);
+		}
+		else if (!side_effect_free(op, imm8, imm16, db, &reads, &writes)) {
+			return;
+		}
+
+		stale |= reads & ~written;
+		written |= writes;
+		cycles += OPCODE_CYCLES[op] + (op == 0xCB ? CB_OPCODE_CYCLES[imm8] : 0);
+		count++;
+		pc += len;
+	}
+	if (pc != from) {
+		return; // the jump back is inside another instruction
+	}
+
+	uint8_t op = mmu_read(mmu, from);
+	if (op != 0x18) {
+		stale |= condition_reads(op) & ~written;
+	}
+	cycles += OPCODE_CYCLES[op] + OPCODE_BRANCH_CYCLES[op];
+	count++;
+
+	// Something read on one trip and set later in it can differ next time,
+	// listed or not, skipping trips wouldn't set it
+	if (stale & written) {
+		return;
+	}
+	loop->idle = true;
+	loop->from_db = db;
+	loop->cycles = (uint16_t)cycles;
+	loop->count = (uint16_t)count;
+}
+
+static idle_loop_t *lookup(gb_t *gb, uint16_t from) {
+	mmu_t *mmu = &gb->mmu;
+	uint8_t *page = mmu->read_pages[from >> MMU_PAGE_SHIFT];
+	idle_loop_t *loop = &gb->idle.loops[from & (IDLE_CACHE_SIZE - 1)];
+	if (loop->page == page && loop->from == from) {
+		return loop;
+	}
+
+	*loop = (idle_loop_t){ .from = from, .page = page };
+
+	// The whole loop is on one rom page, which the cache checks is still mapped
+	uint8_t op = mmu_read(mmu, from);
+	if (!page || from >= 0x8000 || (op != 0x18 && (op & 0xE7) != 0x20)) {
+		return loop;
+	}
+	int8_t offset = (int8_t)mmu_read(mmu, from + 1);
+	uint16_t start = from + 2 + offset;
+	if (offset >= 0 || from - start > IDLE_LOOP_MAX ||
+	    (start >> MMU_PAGE_SHIFT) != ((from + 1) >> MMU_PAGE_SHIFT)) {
+		return loop;
+	}
+	analyse(gb, start, from, loop);
+	return loop;
+}
+
+void idle_jumped_back(gb_t *gb, uint16_t from) {
+	idle_loop_t *loop = lookup(gb, from);
+	if (!loop->idle) {
+		return;
+	}
+
+	// The registers left by the trip that just ended are only what every
+	// later trip leaves if it read the same memory, so nothing can have run
+	// during it. A trip that took exactly as long as it should had no
+	// interrupt in the middle
+	uint64_t last_at = loop->last_at;
+	loop->last_at = gb->cycles;
+	if (last_at + loop->cycles != gb->cycles || gb->sched.ran_at > last_at) {
+		return;
+	}
+
+	// An interrupt about to be taken ends the loop first
+	if (gb->cpu.ime && gb->mmu.int_pending) {
+		return;
+	}
+
+	// Every instruction boundary skipped is before the event, so it still
+	// runs after the same instruction it would have
+	uint64_t next = gb->sched.next;
+	if (next <= gb->cycles) {
+		return;
+	}
+	uint64_t trips = (next - gb->cycles) / loop->cycles;
+	if (trips == 0) {
+		return;
+	}
+
+	uint64_t skipped = trips * loop->cycles;
+	gb->cycles += skipped;
+	gb->instructions += trips * loop->count;
+	loop->last_at = gb->cycles;
+
+	idle_t *idle = &gb->idle;
+	idle->skips++;
+	idle->skipped_cycles += skipped;
+	if (loop->from_db) {
+		idle->db_hits++;
+	}
+}
+
+bool idle_is_loop(gb_t *gb, uint16_t from) {
+	return lookup(gb, from)->idle;
+}
@@ -0,0 +1,54 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../cartridge/cart.h"
+
+struct gb;
+
+// Skips loops that spin waiting on io or hram, like
+//   wait: LDH A, (LY); CP 144; JR NZ, wait
+// Such a loop goes round the same way until an event changes what it reads,
+// so whole trips up to the next event can be skipped as if they'd run. Loops
+// qualify if they're in rom, a few bytes long and only read io (not DIV or
+// TIMA) or hram into A and test it. Loops listed for the cart in
+// static/idle_hacks.c may read the rest of memory too
+
+#define IDLE_CACHE_SIZE 64 // loops remembered, by the address of the jump back
+#define IDLE_LOOP_MAX 16   // bytes from the loop start to the jump back
+
+typedef struct {
+	uint16_t from;    // the JR back to the loop start
+	uint8_t *page;    // read_pages[from >> 8] when looked at, NULL for an empty slot
+	bool idle;
+	bool from_db;     // listed in IDLE_HACKS rather than detected
+	uint16_t cycles;  // one trip round
+	uint16_t count;   // instructions in one trip
+	uint64_t last_at; // gb->cycles at the last jump back
+} idle_loop_t;
+
+typedef struct {
+	idle_loop_t loops[IDLE_CACHE_SIZE];
+	uint8_t header_checksum;
+	uint16_t global_checksum;
+	bool has_hacks; // the cart is in IDLE_HACKS
+
+	uint64_t skips;          // times trips were skipped
+	uint64_t skipped_cycles; // t-cycles skipped
+	uint64_t db_hits;        // skips of loops from IDLE_HACKS
+} idle_t;
+
+// Looks the cart up in IDLE_HACKS by its header checksums
+void idle_init(idle_t *idle, cart_t *cart);
+
+// Called after a JR at `from` jumped back, with pc at the loop start. If it's
+// an idle loop and the trip that just ended went round undisturbed (no event
+// or interrupt since the last jump back), runs as many whole trips round it
+// as fit before the next event
+void idle_jumped_back(struct gb *gb, uint16_t from);
+
+// Whether the JR at `from` closes an idle loop, for translating it
+bool idle_is_loop(struct gb *gb, uint16_t from);
+
+#endif
@@ -116,7 +116,11 @@ void execute_adc(uint8_t *dest, uint8_t val, uint8_t *flags) {
 	*flags = 0;
 	update_zero_flag(flags, result);
 	update_half_flag(flags, *dest, val, carry_value, true);
-	update_carry_flag(flags, *dest, result, true);
+	// Comparing the result doesn't work here, 0xFF + 0xFF + 1 wraps back
+	// around to 0xFF, so check the full sum instead
+	if (*dest + val + carry_value > 0xFF) {
+		*flags |= FLAG_C;
+	}
 
 	*dest = result;
 }
@@ -143,7 +147,10 @@ void execute_sbc(uint8_t *flags, uint8_t *dest, uint8_t val) {
 	update_zero_flag(flags, result);
 	update_negative_flag(flags);
 	update_half_flag(flags, *dest, val, carry_value, false);
-	update_carry_flag(flags, *dest, result, false);
+	// Same as adc, the borrow has to be checked before wrapping
+	if (*dest < val + carry_value) {
+		*flags |= FLAG_C;
+	}
 
 	*dest = result;
 }
@@ -511,6 +518,7 @@ void execute_daa(uint8_t *a, uint8_t *flags) {
 		*a += adjustment;
 	}
 
+	// Z only gets set by update_zero_flag, so clear the old value first
+	*flags &= ~(FLAG_Z | FLAG_H);
 	update_zero_flag(flags, *a);
-	*flags &= ~FLAG_H;
 }
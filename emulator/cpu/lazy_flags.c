@@ -0,0 +1,21 @@
+#include "lazy_flags.h"
+#include "../static/alu_tables.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+uint8_t lazy_flags_resolve(const lazy_flags_t *lazy, uint8_t flags) {
+	uint8_t carry = lazy->carry;
+	uint16_t operands = lazy->left << 8 | lazy->right;
+
+	switch (lazy->op) {
+	case LAZY_ADD: return ALU_ADD_FLAGS[operands];
+	case LAZY_ADC: return ALU_ADD_FLAGS[carry << 16 | operands];
+	case LAZY_SUB: return ALU_SUB_FLAGS[operands];
+	case LAZY_SBC: return ALU_SUB_FLAGS[carry << 16 | operands];
+	case LAZY_AND: return lazy->result ? FLAG_H : FLAG_Z | FLAG_H;
+	case LAZY_OR: return lazy->result ? 0 : FLAG_Z;
+	case LAZY_INC: return ALU_INC_FLAGS[lazy->left] | (carry ? FLAG_C : 0);
+	case LAZY_DEC: return ALU_DEC_FLAGS[lazy->left] | (carry ? FLAG_C : 0);
+	default: return flags;
+	}
+}
@@ -0,0 +1,129 @@
+#ifndef LAZY_FLAGS_H
+#define LAZY_FLAGS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "instructions.h"
+
+// Lazy flags (built with FOZBOY_LAZY_FLAGS). Rather than working out Z/N/H/C
+// on every alu op, the cpu records what the last op was and its operands.
+// F is only worked out when something reads it, most flags are overwritten
+// by the next alu op before that happens
+
+typedef enum {
+	LAZY_NONE = 0, // F in the cpu is up to date
+	LAZY_ADD,
+	LAZY_ADC,
+	LAZY_SUB,      // also CP
+	LAZY_SBC,
+	LAZY_AND,
+	LAZY_OR,       // also XOR, both set only Z
+	LAZY_INC,
+	LAZY_DEC
+} lazy_op_t;
+
+typedef struct {
+	uint8_t op;
+	uint8_t left;
+	uint8_t right;
+	uint8_t result;
+	uint8_t carry; // carry in for ADC/SBC, the preserved C for INC/DEC
+} lazy_flags_t;
+
+// Works out F for the recorded op, `flags` is returned as is for LAZY_NONE
+uint8_t lazy_flags_resolve(const lazy_flags_t *lazy, uint8_t flags);
+
+static inline bool lazy_flag_z(const lazy_flags_t *lazy, uint8_t flags) {
+	if (lazy->op == LAZY_NONE) {
+		return flags & FLAG_Z;
+	}
+	return lazy->result == 0;
+}
+
+static inline bool lazy_flag_c(const lazy_flags_t *lazy, uint8_t flags) {
+	switch (lazy->op) {
+	case LAZY_NONE: return flags & FLAG_C;
+	case LAZY_ADD: return lazy->left + lazy->right > 0xFF;
+	case LAZY_ADC: return lazy->left + lazy->right + lazy->carry > 0xFF;
+	case LAZY_SUB: return lazy->left < lazy->right;
+	case LAZY_SBC: return lazy->left < lazy->right + lazy->carry;
+	case LAZY_INC:
+	case LAZY_DEC: return lazy->carry;
+	default: return false;
+	}
+}
+
+static inline void lazy_record(lazy_flags_t *lazy, lazy_op_t op, uint8_t left,
+                               uint8_t right, uint8_t result, uint8_t carry) {
+	lazy->op = op;
+	lazy->left = left;
+	lazy->right = right;
+	lazy->result = result;
+	lazy->carry = carry;
+}
+
+// Lazy versions of the execute_* alu helpers, same operands and results
+
+static inline void lazy_add(lazy_flags_t *lazy, uint8_t *dest, uint8_t val) {
+	uint8_t result = *dest + val;
+	lazy_record(lazy, LAZY_ADD, *dest, val, result, 0);
+	*dest = result;
+}
+
+static inline void lazy_adc(lazy_flags_t *lazy, uint8_t flags, uint8_t *dest,
+                            uint8_t val) {
+	uint8_t carry = lazy_flag_c(lazy, flags);
+	uint8_t result = *dest + val + carry;
+	lazy_record(lazy, LAZY_ADC, *dest, val, result, carry);
+	*dest = result;
+}
+
+static inline void lazy_sub(lazy_flags_t *lazy, uint8_t *dest, uint8_t val) {
+	uint8_t result = *dest - val;
+	lazy_record(lazy, LAZY_SUB, *dest, val, result, 0);
+	*dest = result;
+}
+
+static inline void lazy_sbc(lazy_flags_t *lazy, uint8_t flags, uint8_t *dest,
+                            uint8_t val) {
+	uint8_t carry = lazy_flag_c(lazy, flags);
+	uint8_t result = *dest - val - carry;
+	lazy_record(lazy, LAZY_SBC, *dest, val, result, carry);
+	*dest = result;
+}
+
+static inline void lazy_cp(lazy_flags_t *lazy, uint8_t dest, uint8_t val) {
+	lazy_record(lazy, LAZY_SUB, dest, val, dest - val, 0);
+}
+
+static inline void lazy_and(lazy_flags_t *lazy, uint8_t *dest, uint8_t val) {
+	*dest &= val;
+	lazy_record(lazy, LAZY_AND, 0, 0, *dest, 0);
+}
+
+static inline void lazy_or(lazy_flags_t *lazy, uint8_t *dest, uint8_t val) {
+	*dest |= val;
+	lazy_record(lazy, LAZY_OR, 0, 0, *dest, 0);
+}
+
+static inline void lazy_xor(lazy_flags_t *lazy, uint8_t *dest, uint8_t val) {
+	*dest ^= val;
+	lazy_record(lazy, LAZY_OR, 0, 0, *dest, 0);
+}
+
+// INC/DEC keep C, so it is carried over from whatever set it
+static inline void lazy_incr(lazy_flags_t *lazy, uint8_t flags, uint8_t *dest) {
+	uint8_t carry = lazy_flag_c(lazy, flags);
+	uint8_t result = *dest + 1;
+	lazy_record(lazy, LAZY_INC, *dest, 1, result, carry);
+	*dest = result;
+}
+
+static inline void lazy_decr(lazy_flags_t *lazy, uint8_t flags, uint8_t *dest) {
+	uint8_t carry = lazy_flag_c(lazy, flags);
+	uint8_t result = *dest - 1;
+	lazy_record(lazy, LAZY_DEC, *dest, 1, result, carry);
+	*dest = result;
+}
+
+#endif
@@ -1,11 +1,76 @@
+#define _DEFAULT_SOURCE // nanosleep and clock_gettime under -std=c11
+
 #include "gbc.h"
 #include "cpu/cpu.h"
+#include "cpu/dynarec.h"
+#include "cartridge/cart.h"
+#include "state/gb.h"
+#include "util/clock.h"
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+
+static atomic_bool stopping;
+
+void stop(void) {
+	atomic_store(&stopping, true);
+}
+
+// Sleep until the host clock reaches deadline_ns
+static void wait_until(uint64_t deadline_ns) {
+	uint64_t now = clock_now_ns();
+	if (deadline_ns <= now) {
+		return;
+	}
+
+	uint64_t wait = deadline_ns - now;
+	struct timespec ts = {
+		.tv_sec = wait / 1000000000ull,
+		.tv_nsec = wait % 1000000000ull,
+	};
+	nanosleep(&ts, NULL);
+}
+
+int run(char* rom_path) {
+	if (rom_path == NULL || rom_path[0] == '\0') {
+		return 0;
+	}
+
+	cart_t* cart = cart_create(rom_path);
+	if (!cart) {
+		return -1;
+	}
+
+	gb_t* gb = gb_create(cart);
+	if (!gb) {
+		cart_destroy(cart);
+		return -1;
+	}
+	gb_print_timing(gb, stderr);
+
+	// A frame of emulation per iteration, paced to the real frame rate
+	atomic_store(&stopping, false);
+	uint64_t next_frame = clock_now_ns();
+	while (!atomic_load(&stopping)) {
+#ifdef FOZBOY_DYNAREC
+		dynarec_run_cycles(gb, GB_CYCLES_PER_FRAME);
+#else
+		cpu_run_cycles(gb, GB_CYCLES_PER_FRAME);
+#endif
+		snapshot_ram_throttled(&gb->ext_ram);
 
-int run(void) {
-	Cpu cpu;
-	cpu_init(&cpu);
+		next_frame += GB_FRAME_NS;
+		// Don't try to catch up after a stall (suspend, debugger), resync
+		if (clock_now_ns() > next_frame + GB_FRAME_NS) {
+			next_frame = clock_now_ns();
+		}
+		wait_until(next_frame);
+	}
 
+	// Writes out any cart ram still dirty and joins the save writer
+	gb_destroy(gb);
+	cart_destroy(cart);
 	return 0;
 }
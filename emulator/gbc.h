@@ -1,6 +1,12 @@
 #ifndef GBC_H
 #define GBC_H
 
-int run(void);
+// rom_path may be NULL or empty, in which case there is nothing to run
+// Runs until stop is called, then flushes the save and frees everything
+int run(char* rom_path);
+
+// Makes run return after the frame it's on. Safe from any thread or a
+// signal handler
+void stop(void);
 
 #endif
@@ -0,0 +1,204 @@
+// IO register behaviour, see io_reg_t
+
+#include "io_regs.h"
+#include "../processing/dma.h"
+#include "../processing/palette.h"
+#include "../processing/ppu.h"
+#include "../processing/timer.h"
+
+// Nothing is wired to the buttons yet, so all of them read as released
+static void write_joyp(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  mmu->io[reg] = data & 0x30;
+}
+
+// A standalone mmu has no timer, the registers are plain memory then
+static uint8_t read_timer(mmu_t* mmu, uint8_t reg) {
+  if (!mmu->gb) {
+    return mmu->io[reg];
+  }
+  return timer_read(mmu->gb, reg);
+}
+
+static void write_timer(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  if (!mmu->gb) {
+    mmu->io[reg] = data;
+    return;
+  }
+  timer_write(mmu->gb, reg, data);
+}
+
+// DMA needs the whole machine, a standalone mmu just keeps the value
+static void write_dma(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  if (!mmu->gb) {
+    mmu->io[reg] = data;
+    return;
+  }
+  if (reg == IO_DMA) {
+    dma_oam_start(mmu->gb, data);
+  }
+  // No HDMA on a dmg, HDMA5 is just a register there
+  else if (!mmu->cart->is_cgb) {
+    mmu->io[reg] = data;
+  }
+  else {
+    dma_hdma_start(mmu->gb, data);
+  }
+}
+
+// Dmg carts get plain registers, the banks only exist on a cgb
+static void write_vbk(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  if (!mmu->cart->is_cgb) {
+    mmu->io[reg] = data;
+    return;
+  }
+  switch_vram(mmu, data);
+}
+
+static void write_svbk(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  if (!mmu->cart->is_cgb) {
+    mmu->io[reg] = data;
+    return;
+  }
+  switch_wram(mmu, data);
+}
+
+// The mode and LY == LYC bits are the ppu's, the cpu only picks the
+// interrupt sources
+static void write_stat(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  uint8_t ppu_bits = STAT_MODE | STAT_LYC_EQUAL;
+  mmu->io[reg] = (data & ~ppu_bits) | (mmu->io[reg] & ppu_bits);
+  if (mmu->gb) {
+    ppu_stat_written(mmu->gb);
+  }
+}
+
+// LY only moves with the line timing
+static void write_ly(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  (void)mmu;
+  (void)reg;
+  (void)data;
+}
+
+static void write_lyc(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  mmu->io[reg] = data;
+  if (mmu->gb) {
+    ppu_stat_written(mmu->gb);
+  }
+}
+
+// Lines are drawn late, the ones already over get drawn with the old value
+static void write_lcd(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  if (mmu->gb) {
+    ppu_catch_up(mmu->gb);
+  }
+  mmu->io[reg] = data;
+}
+
+// LCDC.7 switches the lcd, line timing and hblank DMA stop or start with it
+static void write_lcdc(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  uint8_t old = mmu->io[reg];
+  write_lcd(mmu, reg, data);
+  if (mmu->gb && ((old ^ data) & LCDC_LCD_ON)) {
+    ppu_lcd_switched(mmu->gb);
+    dma_lcd_switched(mmu->gb);
+  }
+}
+
+// Palettes are kept as host pixels, so the ppu hears about every change
+static uint8_t read_palette(mmu_t* mmu, uint8_t reg) {
+  if (!mmu->gb) {
+    return mmu->io[reg];
+  }
+  return palette_read(mmu->gb, reg);
+}
+
+static void write_palette(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  if (!mmu->gb) {
+    mmu->io[reg] = data;
+    return;
+  }
+  palette_write(mmu->gb, reg, data);
+}
+
+static void write_if(mmu_t* mmu, uint8_t reg, uint8_t data) {
+  mmu->io[reg] = data;
+  mmu_update_pending(mmu);
+}
+
+#define NONE { .unused = 0xFF }
+#define TIMER { .read = read_timer, .write = write_timer }
+
+// Registers not listed are plain with every bit readable (SB, the sound
+// envelopes, wave ram...)
+const io_reg_t IO_REGS[IO_REG_COUNT] = {
+  [0x00] = { .write = write_joyp, .unused = 0xCF }, // P1
+  [0x02] = { .unused = 0x7E },                      // SC
+  [0x03] = NONE,
+  [0x04] = TIMER, // DIV
+  [0x05] = TIMER, // TIMA
+  [0x06] = TIMER, // TMA
+  [0x07] = TIMER, // TAC
+  [0x08] = NONE, [0x09] = NONE, [0x0A] = NONE, [0x0B] = NONE,
+  [0x0C] = NONE, [0x0D] = NONE, [0x0E] = NONE,
+  [0x0F] = { .write = write_if, .unused = 0xE0 }, // IF
+
+  // Sound, the frequency and length bits are write only
+  [0x10] = { .unused = 0x80 }, // NR10
+  [0x11] = { .unused = 0x3F }, // NR11
+  [0x13] = NONE,               // NR13
+  [0x14] = { .unused = 0xBF }, // NR14
+  [0x15] = NONE,
+  [0x16] = { .unused = 0x3F }, // NR21
+  [0x18] = NONE,               // NR23
+  [0x19] = { .unused = 0xBF }, // NR24
+  [0x1A] = { .unused = 0x7F }, // NR30
+  [0x1B] = NONE,               // NR31
+  [0x1C] = { .unused = 0x9F }, // NR32
+  [0x1D] = NONE,               // NR33
+  [0x1E] = { .unused = 0xBF }, // NR34
+  [0x1F] = NONE,
+  [0x20] = NONE,               // NR41
+  [0x23] = { .unused = 0xBF }, // NR44
+  [0x26] = { .unused = 0x70 }, // NR52
+  [0x27] = NONE, [0x28] = NONE, [0x29] = NONE, [0x2A] = NONE,
+  [0x2B] = NONE, [0x2C] = NONE, [0x2D] = NONE, [0x2E] = NONE, [0x2F] = NONE,
+
+  // Lcd
+  [0x40] = { .write = write_lcdc }, // LCDC
+  [0x41] = { .write = write_stat, .unused = 0x80 }, // STAT
+  [0x42] = { .write = write_lcd }, // SCY
+  [0x43] = { .write = write_lcd }, // SCX
+  [0x44] = { .write = write_ly }, // LY
+  [0x45] = { .write = write_lyc }, // LYC
+  [0x46] = { .write = write_dma }, // DMA
+  [0x47] = { .write = write_palette }, // BGP
+  [0x48] = { .write = write_palette }, // OBP0
+  [0x49] = { .write = write_palette }, // OBP1
+  [0x4A] = { .write = write_lcd }, // WY
+  [0x4B] = { .write = write_lcd }, // WX
+
+  // Cgb
+  [0x4C] = NONE,
+  [0x4D] = { .unused = 0x7E }, // KEY1
+  [0x4E] = NONE,
+  [0x4F] = { .write = write_vbk, .unused = 0xFE }, // VBK
+  [0x50] = NONE,               // boot rom off
+  [0x51] = NONE, [0x52] = NONE, [0x53] = NONE, [0x54] = NONE, // HDMA1-4
+  [0x55] = { .write = write_dma }, // HDMA5
+  [0x56] = { .unused = 0x3C }, // RP
+  [0x57] = NONE, [0x58] = NONE, [0x59] = NONE, [0x5A] = NONE, [0x5B] = NONE,
+  [0x5C] = NONE, [0x5D] = NONE, [0x5E] = NONE, [0x5F] = NONE, [0x60] = NONE,
+  [0x61] = NONE, [0x62] = NONE, [0x63] = NONE, [0x64] = NONE, [0x65] = NONE,
+  [0x66] = NONE, [0x67] = NONE,
+  [0x68] = { .unused = 0x40 }, // BCPS
+  [0x69] = { .read = read_palette, .write = write_palette }, // BCPD
+  [0x6A] = { .unused = 0x40 }, // OCPS
+  [0x6B] = { .read = read_palette, .write = write_palette }, // OCPD
+  [0x6C] = { .unused = 0xFE }, // OPRI
+  [0x6D] = NONE, [0x6E] = NONE, [0x6F] = NONE,
+  [0x70] = { .write = write_svbk, .unused = 0xF8 }, // SVBK
+  [0x71] = NONE,
+  [0x75] = { .unused = 0x8F },
+  [0x78] = NONE, [0x79] = NONE, [0x7A] = NONE, [0x7B] = NONE,
+  [0x7C] = NONE, [0x7D] = NONE, [0x7E] = NONE, [0x7F] = NONE,
+};
@@ -0,0 +1,23 @@
+#ifndef IO_REGS_H
+#define IO_REGS_H
+
+#include <stdint.h>
+#include "mmu.h"
+
+// How each register in 0xFF00-0xFF7F behaves, indexed by address & 0x7F.
+// Only the slow path looks here. Plain registers have no handlers and are
+// stored straight to mmu->io, registers with side effects go through them
+typedef uint8_t (*io_read_t)(mmu_t* mmu, uint8_t reg);
+typedef void (*io_write_t)(mmu_t* mmu, uint8_t reg, uint8_t data);
+
+typedef struct {
+  io_read_t read;   // NULL reads io[reg] | unused
+  io_write_t write; // NULL stores to io[reg]
+  uint8_t unused;   // bits that always read back as 1, 0xFF for no register
+} io_reg_t;
+
+#define IO_REG_COUNT 0x80
+
+extern const io_reg_t IO_REGS[IO_REG_COUNT];
+
+#endif
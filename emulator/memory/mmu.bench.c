@@ -0,0 +1,132 @@
+// Measures the cost of mmu_read/mmu_write against the old linear block scan
+// Run with `zig build bench -Doptimize=ReleaseFast`
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mmu.h"
+#include "../cartridge/cart.h"
+#include "../state/gb.h"
+
+#define ACCESS_COUNT (1 << 16)
+#define PASSES 256
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// The block scan mmu_read used before the page tables, kept as the baseline
+static uint8_t scan_read(mmu_t* mmu, uint16_t address) {
+  for (int i = 0; i < MMU_BLOCK_COUNT; i++) {
+    block_t* block = &mmu->blocks[i];
+
+    if (address >= block->start && address <= block->end) {
+      return block->buf[address - block->start];
+    }
+  }
+  return 0xFF;
+}
+
+static void scan_write(mmu_t* mmu, uint16_t address, uint8_t data) {
+  for (int i = 0; i < MMU_BLOCK_COUNT; i++) {
+    block_t* block = &mmu->blocks[i];
+
+    if (address >= block->start && address <= block->end) {
+      block->buf[address - block->start] = data;
+    }
+  }
+}
+
+// Roughly what a cpu produces: mostly opcode fetches from rom,
+// then wram data and hram/stack accesses
+static void fill_addresses(uint16_t* addrs, int count) {
+  srand(0x5EED);
+  for (int i = 0; i < count; i++) {
+    int kind = rand() % 10;
+    if (kind < 6) {
+      addrs[i] = rand() % 0x8000;
+    } else if (kind < 9) {
+      addrs[i] = 0xC000 + rand() % 0x2000;
+    } else {
+      addrs[i] = 0xFF80 + rand() % 0x7F;
+    }
+  }
+}
+
+static void report(const char* name, uint64_t elapsed) {
+  double ns = (double)elapsed / ((double)ACCESS_COUNT * PASSES);
+  printf("%-18s %6.2f ns/access\n", name, ns);
+}
+
+int main(void) {
+  cart_t cart = {0};
+  cart.cart_type = MBC1;
+  cart.size = 0x8000;
+  cart.rom_banks = 2;
+  cart.rom_bank_mask = 1;
+  cart.ram_size = 0x8000;
+  cart.data = calloc(cart.size, 1);
+
+  // No file name, so the cart ram has no .sav behind it
+  gb_t* gb = gb_create(&cart);
+  if (!gb) {
+    fprintf(stderr, "gb_create failed\n");
+    return 1;
+  }
+  mmu_t* mmu = &gb->mmu;
+
+  uint16_t* addrs = malloc(sizeof(uint16_t) * ACCESS_COUNT);
+  fill_addresses(addrs, ACCESS_COUNT);
+
+  // Writes only target ram, rom writes would be mbc commands
+  uint16_t* write_addrs = malloc(sizeof(uint16_t) * ACCESS_COUNT);
+  for (int i = 0; i < ACCESS_COUNT; i++) {
+    write_addrs[i] = addrs[i] < 0x8000 ? 0xC000 | (addrs[i] & 0x1FFF) : addrs[i];
+  }
+
+  volatile uint8_t sink = 0;
+  uint64_t start;
+
+  start = now_ns();
+  for (int p = 0; p < PASSES; p++) {
+    for (int i = 0; i < ACCESS_COUNT; i++) {
+      sink += scan_read(mmu, addrs[i]);
+    }
+  }
+  report("read (block scan)", now_ns() - start);
+
+  start = now_ns();
+  for (int p = 0; p < PASSES; p++) {
+    for (int i = 0; i < ACCESS_COUNT; i++) {
+      sink += mmu_read(mmu, addrs[i]);
+    }
+  }
+  report("read (page table)", now_ns() - start);
+
+  start = now_ns();
+  for (int p = 0; p < PASSES; p++) {
+    for (int i = 0; i < ACCESS_COUNT; i++) {
+      scan_write(mmu, write_addrs[i], (uint8_t)i);
+    }
+  }
+  report("write (block scan)", now_ns() - start);
+
+  start = now_ns();
+  for (int p = 0; p < PASSES; p++) {
+    for (int i = 0; i < ACCESS_COUNT; i++) {
+      mmu_write(mmu, write_addrs[i], (uint8_t)i);
+    }
+  }
+  report("write (page table)", now_ns() - start);
+
+  free(write_addrs);
+  free(addrs);
+  gb_destroy(gb);
+  free(cart.data);
+  return 0;
+}
@@ -5,141 +5,137 @@
 #include <string.h>
 #include "mmu.h"
 #include "../cartridge/cart.h"
+#include "io_regs.h"
+#include "../state/gb.h"
 
-// If buf not provided, will be allocated
-block_t* new_block(uint16_t start, uint16_t end, uint8_t* buf) {
-  uint16_t len = end - start + 1;
-
-  if (!buf) {
-    buf = calloc(len, sizeof(uint8_t));
-    if (!buf) {
-      return NULL;
-    }
-  }
-
-  block_t* block = malloc(sizeof(block_t));
-  if (!block) {
-    free(buf);
-    return NULL;
-  }
-
-  *block = (block_t){
-    .len = len,
+static void init_block(mmu_t* mmu, mmu_region_t region,
+                       uint16_t start, uint16_t end, uint8_t* buf) {
+  mmu->blocks[region] = (block_t){
+    .len = end - start + 1,
     .start = start,
     .end = end,
     .buf = buf
   };
-
-  return block;
 }
 
-void block_destroy(block_t* block) {
-  if (!block) return;
-  free(block->buf);
-  free(block);
+// Point every page in [start, end] at buf, biased so page[addr & 0xFF] works
+// NULL pointers leave the page to the slow path
+static void map_range(mmu_t* mmu, uint16_t start, uint16_t end, uint8_t* buf,
+                      bool readable, bool writable, mmu_page_tag_t tag) {
+  for (int page = start >> MMU_PAGE_SHIFT; page <= end >> MMU_PAGE_SHIFT; page++) {
+    uint8_t* ptr = buf ? buf + ((page << MMU_PAGE_SHIFT) - start) : NULL;
+
+    mmu->read_pages[page] = readable ? ptr : NULL;
+    mmu->write_pages[page] = writable ? ptr : NULL;
+    mmu->page_tags[page] = tag;
+  }
 }
 
-// Special destroy for blocks that share buffers (don't free the buffer)
-void block_destroy_no_buf_free(block_t* block) {
-  if (!block) return;
-  free(block); // Only free the block struct, not the buffer
+static void map_block(mmu_t* mmu, mmu_region_t region,
+                      bool readable, bool writable, mmu_page_tag_t tag) {
+  block_t* block = &mmu->blocks[region];
+  map_range(mmu, block->start, block->end, block->buf, readable, writable, tag);
 }
 
-void mmu_destroy(mmu_t* mmu) {
-  block_destroy(mmu->blocks[MMU_ROM_FIXED]);
-  block_destroy(mmu->blocks[MMU_ROM_SWITCH]);
-  block_destroy(mmu->blocks[MMU_VRAM]);
-  block_destroy_no_buf_free(mmu->blocks[MMU_EXT_RAM]); // Shares buffer with cart ext_ram
-  block_destroy(mmu->blocks[MMU_WRAM]);
-  block_destroy(mmu->blocks[MMU_WRAM_SWITCH]);
-  block_destroy_no_buf_free(mmu->blocks[MMU_ECHO_RAM]); // Shares buffer with WRAM
-  block_destroy(mmu->blocks[MMU_OAM]);
-  block_destroy(mmu->blocks[MMU_UNUSABLE]);
-  block_destroy(mmu->blocks[MMU_IO_REGS]);
-  block_destroy(mmu->blocks[MMU_HRAM]);
-  block_destroy(mmu->blocks[MMU_INT_ENABLE]);
+// Vram writes take the slow path so the ppu can draw the lines before them
+// and drop decoded tiles
+static void map_vram(mmu_t* mmu) {
+  map_block(mmu, MMU_VRAM, true, false, MMU_PAGE_VRAM);
+}
 
-  free(mmu);
+// Builds the page tables from the current block buffers
+// Everything from 0xFE00 up shares pages with registers, so it stays on the slow path
+static void map_pages(mmu_t* mmu) {
+  map_block(mmu, MMU_ROM_FIXED, true, false, MMU_PAGE_ROM);
+  map_block(mmu, MMU_ROM_SWITCH, true, false, MMU_PAGE_ROM);
+  map_vram(mmu);
+  map_block(mmu, MMU_EXT_RAM, false, false, MMU_PAGE_EXT_RAM);
+  map_block(mmu, MMU_WRAM, true, true, MMU_PAGE_DIRECT);
+  map_block(mmu, MMU_WRAM_SWITCH, true, true, MMU_PAGE_DIRECT);
+
+  // Echo ram mirrors 0xC000-0xDDFF, which spans both wram blocks
+  map_range(mmu, 0xE000, 0xEFFF, mmu->wram, true, true, MMU_PAGE_DIRECT);
+  map_range(mmu, 0xF000, 0xFDFF, mmu->blocks[MMU_WRAM_SWITCH].buf, true, true, MMU_PAGE_DIRECT);
+
+  map_range(mmu, 0xFE00, 0xFEFF, NULL, false, false, MMU_PAGE_OAM);
+  map_range(mmu, 0xFF00, 0xFFFF, NULL, false, false, MMU_PAGE_IO);
 }
 
-mmu_t* mmu_create(cart_t* cart) {
-  mmu_t* mmu = calloc(1, sizeof(mmu_t));
-  if (!mmu) return NULL;
-  
+void mmu_init(mmu_t* mmu, cart_t* cart, mbc_t* mbc, ext_ram_t* ext_ram) {
   mmu->cart = cart;
-
-  mmu->blocks[MMU_ROM_FIXED] = new_block(0x0000, 0x3FFF, NULL);
-  if (!mmu->blocks[MMU_ROM_FIXED]) goto cleanup;
-
-  mmu->blocks[MMU_ROM_SWITCH] = new_block(0x4000, 0x7FFF, NULL);
-  if (!mmu->blocks[MMU_ROM_SWITCH]) goto cleanup;
-
-  mmu->blocks[MMU_VRAM] = new_block(0x8000, 0x9FFF, NULL);
-  if (!mmu->blocks[MMU_VRAM]) goto cleanup;
-
-  uint8_t* ext_ram_buf = get_ram_bank(cart, 0);
-  if (!ext_ram_buf) goto cleanup;
-  mmu->blocks[MMU_EXT_RAM] = new_block(0xA000, 0xBFFF, ext_ram_buf);
-  if (!mmu->blocks[MMU_EXT_RAM]) goto cleanup;
-
-  mmu->blocks[MMU_WRAM] = new_block(0xC000, 0xCFFF, NULL);
-  if (!mmu->blocks[MMU_WRAM]) goto cleanup;
-
-  mmu->blocks[MMU_WRAM_SWITCH] = new_block(0xD000, 0xDFFF, NULL);
-  if (!mmu->blocks[MMU_WRAM_SWITCH]) goto cleanup;
-
-  mmu->blocks[MMU_ECHO_RAM] = new_block(0xE000, 0xFDFF, mmu->blocks[MMU_WRAM]->buf);
-  if (!mmu->blocks[MMU_ECHO_RAM]) goto cleanup;
-
-  mmu->blocks[MMU_OAM] = new_block(0xFE00, 0xFE9F, NULL);
-  if (!mmu->blocks[MMU_OAM]) goto cleanup;
-
-  mmu->blocks[MMU_UNUSABLE] = new_block(0xFEA0, 0xFEFF, NULL);
-  if (!mmu->blocks[MMU_UNUSABLE]) goto cleanup;
-
-  mmu->blocks[MMU_IO_REGS] = new_block(0xFF00, 0xFF7F, NULL);
-  if (!mmu->blocks[MMU_IO_REGS]) goto cleanup;
-
-  mmu->blocks[MMU_HRAM] = new_block(0xFF80, 0xFFFE, NULL);
-  if (!mmu->blocks[MMU_HRAM]) goto cleanup;
-
-  mmu->blocks[MMU_INT_ENABLE] = new_block(0xFFFF, 0xFFFF, NULL);
-  if (!mmu->blocks[MMU_INT_ENABLE]) goto cleanup;
-
+  mmu->mbc = mbc;
+  mmu->ext_ram = ext_ram;
+
+  // Rom blocks start out NULL and switch_rom points them into cart->data
+  init_block(mmu, MMU_ROM_FIXED, 0x0000, 0x3FFF, NULL);
+  init_block(mmu, MMU_ROM_SWITCH, 0x4000, 0x7FFF, NULL);
+  init_block(mmu, MMU_VRAM, 0x8000, 0x9FFF, mmu->vram_banks[0]);
+  // NULL for carts without ram, reads are then open bus
+  init_block(mmu, MMU_EXT_RAM, 0xA000, 0xBFFF, get_ram_bank(ext_ram, 0));
+  init_block(mmu, MMU_WRAM, 0xC000, 0xCFFF, mmu->wram);
+  init_block(mmu, MMU_WRAM_SWITCH, 0xD000, 0xDFFF, mmu->wram_banks[0]);
+  // Only the page tables are used for echo ram, they mirror each wram block
+  init_block(mmu, MMU_ECHO_RAM, 0xE000, 0xFDFF, mmu->wram);
+  init_block(mmu, MMU_OAM, 0xFE00, 0xFE9F, mmu->oam);
+  init_block(mmu, MMU_UNUSABLE, 0xFEA0, 0xFEFF, mmu->unusable);
+  init_block(mmu, MMU_IO_REGS, 0xFF00, 0xFF7F, mmu->io);
+  init_block(mmu, MMU_HRAM, 0xFF80, 0xFFFE, mmu->hram);
+  init_block(mmu, MMU_INT_ENABLE, 0xFFFF, 0xFFFF, &mmu->ie);
+
+  map_pages(mmu);
+
+  // Banks 0 and 1 are mapped at power on. Without a cart image (or with one
+  // too small for a bank) the rom pages stay on the slow path and read 0xFF
+  write_rom_fixed(mmu);
+  switch_rom(mmu, 1, 0);
+  if (cart->is_cgb) {
+    switch_wram(mmu, 1);
+  }
 
   mmu->ram_enabled = false;
   mmu->current_ram_bank = 0;
-  
   mmu->timer_enabled = false;
-  mmu->rtc_s = 0;
-  mmu->rtc_m = 0;
-  mmu->rtc_h = 0;
-  mmu->rtc_dl = 0;
-  mmu->rtc_dh = 0;
-  mmu->rtc_s_latched = 0;
-  mmu->rtc_m_latched = 0;
-  mmu->rtc_h_latched = 0;
-  mmu->rtc_dl_latched = 0;
-  mmu->rtc_dh_latched = 0;
+}
+
+void mmu_destroy(mmu_t* mmu) {
+  free(mmu);
+}
+
+mmu_t* mmu_create(cart_t* cart, mbc_t* mbc, ext_ram_t* ext_ram) {
+  mmu_t* mmu = calloc(1, sizeof(mmu_t));
+  if (!mmu) return NULL;
 
+  mmu_init(mmu, cart, mbc, ext_ram);
   return mmu;
+}
 
-cleanup:
-  mmu_destroy(mmu);
-  return NULL;
+// Blocks in the 0xFE00-0xFFFF pages, which share pages with each other
+static block_t* high_block(mmu_t* mmu, uint16_t address) {
+  if (address < 0xFEA0) { return &mmu->blocks[MMU_OAM]; }
+  if (address < 0xFF00) { return &mmu->blocks[MMU_UNUSABLE]; }
+  if (address < 0xFF80) { return &mmu->blocks[MMU_IO_REGS]; }
+  if (address < 0xFFFF) { return &mmu->blocks[MMU_HRAM]; }
+  return &mmu->blocks[MMU_INT_ENABLE];
 }
 
+// With something pending the cpu has to look at it before the next
+// instruction, which happens at the top of its loop
+void mmu_update_pending(mmu_t* mmu) {
+  mmu->int_pending = mmu->ie & mmu->io[IO_IF] & INT_MASK;
+  if (mmu->int_pending && mmu->gb) {
+    scheduler_set(&mmu->gb->sched, SCHED_INTERRUPT, mmu->gb->cycles);
+  }
+}
 
-uint8_t mmu_read(mmu_t* mmu, uint16_t address) {
+uint8_t mmu_read_slow(mmu_t* mmu, uint16_t address) {
+  mbc_regs_t* mbc_regs = mmu->mbc->regs;
 
-  mbc_regs_t* mbc_regs = mmu->cart->mbc->regs;
-  
-  // Special handling for external RAM region
-  if (address >= 0xA000 && address <= 0xBFFF) {
+  switch (mmu->page_tags[address >> MMU_PAGE_SHIFT]) {
+  case MMU_PAGE_EXT_RAM: {
     if (!mmu->ram_enabled) {
       return 0xFF;
     }
-    
+
     // Check if an RTC register is selected (MBC3 only)
     if (mbc_regs->rtc_register >= 0x08 && mbc_regs->rtc_register <= 0x0C) {
       // Return latched RTC register value
@@ -151,31 +147,89 @@ uint8_t mmu_read(mmu_t* mmu, uint16_t address) {
         case 0x0C: return mmu->rtc_dh_latched;
       }
     }
-  }
-  
-  // identify block to read from and read
-  for (int i = 0; i < MMU_BLOCK_COUNT; i++) {
-    block_t* block = mmu->blocks[i];
 
-    if (address >= block->start && address <= block->end) {
-      uint16_t rel_addr = address - block->start;
+    block_t* block = &mmu->blocks[MMU_EXT_RAM];
+    if (!block->buf) {
+      return 0xFF;
+    }
+
+    // Rams smaller than a bank repeat through the region
+    uint8_t data = block->buf[(address - block->start) & mmu->ext_ram->addr_mask];
 
-      return block->buf[rel_addr];
+    // MBC2 ram is 4 bits wide, the upper half reads as set
+    if (mmu->cart->cart_type == MBC2) {
+      data |= 0xF0;
+    }
+    return data;
+  }
+  case MMU_PAGE_IO:
+    if (address < 0xFF80) {
+      uint8_t reg = address & (IO_REG_COUNT - 1);
+      const io_reg_t* io_reg = &IO_REGS[reg];
+      if (io_reg->read) {
+        return io_reg->read(mmu, reg);
+      }
+      return mmu->io[reg] | io_reg->unused;
+    }
+    // hram and IE
+    // fallthrough
+  case MMU_PAGE_OAM: {
+    if (mmu->oam_dma && address < 0xFEA0) {
+      return 0xFF;
     }
+    block_t* block = high_block(mmu, address);
+    return block->buf[address - block->start];
+  }
+  default:
+    return 0xFF; // unmapped
   }
-  return 0xFF; // unmapped
 }
 
-void mmu_write(mmu_t* mmu, uint16_t address, uint8_t data) {
+// Page 0xFF is shared with the io registers, only hram there can hold code
+static void mark_code_write(mmu_t* mmu, uint16_t address) {
+  uint8_t page = address >> MMU_PAGE_SHIFT;
+  if (mmu->code_pages[page] != MMU_CODE_WATCHED) {
+    return;
+  }
+  if (page == 0xFF && (address < 0xFF80 || address == 0xFFFF)) {
+    return;
+  }
+  mmu->code_pages[page] = MMU_CODE_WRITTEN;
+  mmu->code_written = true;
+}
 
-  mbc_regs_t* mbc_regs = mmu->cart->mbc->regs;
-  
-  // Special handling for external RAM region
-  if (address >= 0xA000 && address <= 0xBFFF) {
+void mmu_write_slow(mmu_t* mmu, uint16_t address, uint8_t data) {
+  mbc_regs_t* mbc_regs = mmu->mbc->regs;
+
+  mark_code_write(mmu, address);
+
+  switch (mmu->page_tags[address >> MMU_PAGE_SHIFT]) {
+  case MMU_PAGE_DIRECT: {
+    // Only here while watched for code, the read pointer is the same memory
+    uint8_t* page = mmu->read_pages[address >> MMU_PAGE_SHIFT];
+    if (page) {
+      page[address & (MMU_PAGE_SIZE - 1)] = data;
+    }
+    return;
+  }
+  case MMU_PAGE_ROM:
+    mbc_intercept(mmu, address, data);
+    return;
+  case MMU_PAGE_VRAM: {
+    block_t* block = &mmu->blocks[MMU_VRAM];
+    uint16_t offset = address - block->start;
+    if (mmu->gb) {
+      ppu_catch_up(mmu->gb);
+      ppu_vram_written(&mmu->gb->ppu, block->buf == mmu->vram_banks[1], offset);
+    }
+    block->buf[offset] = data;
+    return;
+  }
+  case MMU_PAGE_EXT_RAM: {
     if (!mmu->ram_enabled && !mmu->timer_enabled) {
       return;
     }
-    
+
     // Check if an RTC register is selected (MBC3 only)
     if (mbc_regs->rtc_register >= 0x08 && mbc_regs->rtc_register <= 0x0C) {
       // Write to RTC register
@@ -187,40 +241,151 @@ void mmu_write(mmu_t* mmu, uint16_t address, uint8_t data) {
         case 0x0C: mmu->rtc_dh = data; return;
       }
     }
-  }
-  
-  // identify block to write to and write
-  for (int i = 0; i < MMU_BLOCK_COUNT; i++) {
-    block_t* block = mmu->blocks[i];
 
-    if (address >= block->start && address <= block->end) {
-      uint16_t rel_addr = address - block->start;
-      block->buf[rel_addr] = data;
+    block_t* block = &mmu->blocks[MMU_EXT_RAM];
+    if (!block->buf) {
+      return;
+    }
+
+    ext_ram_t* ext_ram = mmu->ext_ram;
+    uint16_t offset = (address - block->start) & ext_ram->addr_mask;
+    block->buf[offset] = mmu->cart->cart_type == MBC2 ? data & 0x0F : data;
+    ext_ram_mark_dirty(ext_ram, mmu->current_ram_bank, offset);
+    return;
+  }
+  case MMU_PAGE_IO:
+    if (address < 0xFF80) {
+      uint8_t reg = address & (IO_REG_COUNT - 1);
+      const io_reg_t* io_reg = &IO_REGS[reg];
+      if (io_reg->write) {
+        io_reg->write(mmu, reg, data);
+      }
+      else {
+        mmu->io[reg] = data;
+      }
+      return;
+    }
+    if (address == 0xFFFF) {
+      mmu->ie = data;
+      mmu_update_pending(mmu);
+      return;
     }
+    // hram
+    // fallthrough
+  case MMU_PAGE_OAM: {
+    if (mmu->oam_dma && address < 0xFEA0) {
+      return;
+    }
+    if (address < 0xFEA0 && mmu->gb) {
+      ppu_catch_up(mmu->gb);
+      ppu_oam_written(&mmu->gb->ppu);
+    }
+    block_t* block = high_block(mmu, address);
+    block->buf[address - block->start] = data;
+    return;
+  }
+  default:
+    return;
   }
 }
 
-void write_rom_fixed(mmu_t* mmu) {
-  block_t* block = mmu->blocks[MMU_ROM_FIXED];
+void mmu_request_interrupt(mmu_t* mmu, uint8_t bits) {
+  mmu->io[IO_IF] |= bits;
+  mmu_update_pending(mmu);
+}
+
+uint8_t mmu_read(mmu_t* mmu, uint16_t address) {
+  return mmu_read_fast(mmu, address);
+}
+
+void mmu_write(mmu_t* mmu, uint16_t address, uint8_t data) {
+  mmu_write_fast(mmu, address, data);
+}
+
+// Echo ram pages and the wram pages they mirror
+static int echo_mirror(int page) {
+  if (page >= 0xC0 && page <= 0xDD) { return page + 0x20; }
+  if (page >= 0xE0 && page <= 0xFD) { return page - 0x20; }
+  return -1;
+}
+
+static void set_code_page(mmu_t* mmu, int page, mmu_code_page_t state) {
+  mmu->code_pages[page] = state;
+  if (mmu->page_tags[page] == MMU_PAGE_DIRECT) {
+    mmu->write_pages[page] = state == MMU_CODE_NONE ? mmu->read_pages[page] : NULL;
+  }
+}
+
+void mmu_watch_code(mmu_t* mmu, uint16_t address) {
+  int page = address >> MMU_PAGE_SHIFT;
+  set_code_page(mmu, page, MMU_CODE_WATCHED);
+
+  int mirror = echo_mirror(page);
+  if (mirror >= 0) {
+    set_code_page(mmu, mirror, MMU_CODE_WATCHED);
+  }
+}
 
-  uint16_t cpy_len = block->len;
-  if (mmu->cart->size < cpy_len) {
-    cpy_len = mmu->cart->size;
+void mmu_unwatch_code(mmu_t* mmu, uint8_t page) {
+  set_code_page(mmu, page, MMU_CODE_NONE);
+
+  int mirror = echo_mirror(page);
+  if (mirror >= 0) {
+    set_code_page(mmu, mirror, MMU_CODE_NONE);
+  }
+}
+
+// Remaps direct pages after a bank switch. Pages with translated code on them
+// keep sending writes to the slow path
+static void remap_direct(mmu_t* mmu, uint16_t start, uint16_t end, uint8_t* buf) {
+  map_range(mmu, start, end, buf, true, true, MMU_PAGE_DIRECT);
+  for (int page = start >> MMU_PAGE_SHIFT; page <= end >> MMU_PAGE_SHIFT; page++) {
+    set_code_page(mmu, page, mmu->code_pages[page]);
+  }
+}
+
+void switch_vram(mmu_t* mmu, uint8_t bank) {
+  bank &= MMU_VRAM_BANKS - 1;
+  mmu->io[IO_VBK] = bank;
+
+  block_t* block = &mmu->blocks[MMU_VRAM];
+  block->buf = mmu->vram_banks[bank];
+  map_vram(mmu);
+}
+
+void switch_wram(mmu_t* mmu, uint8_t bank) {
+  bank &= 7;
+  if (bank == 0) {
+    bank = 1;
   }
+  mmu->io[IO_SVBK] = bank;
 
-  memcpy(block->buf, mmu->cart->data, cpy_len);
+  block_t* block = &mmu->blocks[MMU_WRAM_SWITCH];
+  block->buf = mmu->wram_banks[bank - 1];
+  remap_direct(mmu, block->start, block->end, block->buf);
+  remap_direct(mmu, 0xF000, 0xFDFF, block->buf);
+}
+
+void write_rom_fixed(mmu_t* mmu) {
+  switch_rom(mmu, 0, 1);
 }
 
 int switch_rom(mmu_t* mmu, uint16_t bank, uint8_t fixed_rom) {
   mmu_region_t block_key = fixed_rom ? MMU_ROM_FIXED : MMU_ROM_SWITCH;
-  block_t* block = mmu->blocks[MMU_ROM_SWITCH];
+  block_t* block = &mmu->blocks[block_key];
+
+  if (bank > 512) { return -1; }
+  if (!mmu->cart->data) { return -1; }
 
-  if (bank < 2 || bank > 512) { return -1; }
+  // Like the mbc, ignore bank bits past what the rom has
+  bank &= mmu->cart->rom_bank_mask;
 
-  long address = bank * block->len;
-  if (address >= mmu->cart->size) { return -1; }
+  long address = (long)bank * block->len;
+  if (address + block->len > mmu->cart->size) { return -1; }
 
-  memcpy(block->buf, &mmu->cart->data[address], block->len);
+  // No copy, the region reads straight out of the cartridge image
+  block->buf = &mmu->cart->data[address];
+  map_block(mmu, block_key, true, false, MMU_PAGE_ROM);
   return 0;
 }
 
@@ -229,8 +394,8 @@ int switch_ram(mmu_t* mmu, uint16_t bank) {
   
   mmu->current_ram_bank = bank;
 
-  uint8_t* ext_ram_buf = get_ram_bank(mmu->cart, mmu->current_ram_bank);
-  mmu->blocks[MMU_EXT_RAM]->buf = ext_ram_buf;
+  uint8_t* ext_ram_buf = get_ram_bank(mmu->ext_ram, mmu->current_ram_bank);
+  mmu->blocks[MMU_EXT_RAM].buf = ext_ram_buf;
   // Note - no mem leak here
   // all ram bank lifecycles are owned by ext_ram module
   
@@ -238,8 +403,7 @@ int switch_ram(mmu_t* mmu, uint16_t bank) {
 }
 
 int mbc_intercept(mmu_t* mmu, uint16_t addr, uint8_t data) {
-  cart_t* cart = mmu->cart;
-  intercept_flags_t flags = cart->mbc->intercept(cart->mbc, addr, data);
+  intercept_flags_t flags = mmu->mbc->intercept(mmu->mbc, addr, data);
 
   if (flags.set_switch_bank) {
     switch_rom(mmu, flags.switch_bank, 0);
@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 #include "../cartridge/cart.h"
+#include "../cartridge/ext_ram.h"
+#include "../cartridge/mbc.h"
+
+struct gb;
 
 typedef struct {
   uint8_t* buf;
@@ -27,9 +31,60 @@ typedef enum {
   MMU_BLOCK_COUNT
 } mmu_region_t;
 
+// The address space is split into 256 byte pages so that mmu_read/mmu_write
+// can find the backing buffer with a shift instead of scanning every block
+#define MMU_PAGE_SHIFT 8
+#define MMU_PAGE_SIZE (1 << MMU_PAGE_SHIFT)
+#define MMU_PAGE_COUNT (0x10000 >> MMU_PAGE_SHIFT)
+
+// Tells the slow path what to do with a page that has no host pointer
+// (or no pointer for the direction being accessed)
+typedef enum {
+  MMU_PAGE_DIRECT = 0, // plain memory, always served through the page pointers
+  MMU_PAGE_ROM,        // reads are direct, writes go to the mbc registers
+  MMU_PAGE_EXT_RAM,    // ram gate, rtc registers and bank switching
+  MMU_PAGE_VRAM,       // reads are direct, writes catch the ppu up first
+  MMU_PAGE_OAM,        // oam and the unusable region after it
+  MMU_PAGE_IO          // io registers, hram and interrupt enable
+} mmu_page_tag_t;
+
+#define IO_IF 0x0F    // interrupt flags, offset into the io registers
+#define INT_MASK 0x1F // vblank, stat, timer, serial, joypad
+
+// Pages the dynarec has translated code from (see cpu/dynarec.h). Writes to a
+// watched page take the slow path, which marks it written
+typedef enum {
+  MMU_CODE_NONE = 0,
+  MMU_CODE_WATCHED,
+  MMU_CODE_WRITTEN
+} mmu_code_page_t;
+
+// Cgb memory banks. A dmg only ever sees the first of each
+#define MMU_WRAM_BANKS 7
+#define MMU_VRAM_BANKS 2
+#define IO_VBK 0x4F
+#define IO_SVBK 0x70
+
+// The mmu owns the console's own memory inline, so it needs no allocations of
+// its own and can be embedded (see gb_t). Rom and cart ram are borrowed from
+// the cart and ext_ram
 typedef struct {
-  block_t* blocks[MMU_BLOCK_COUNT];
+  // Page tables, indexed by address >> MMU_PAGE_SHIFT. Each pointer is biased
+  // so that page[address & 0xFF] is the byte for that address.
+  // NULL sends the access down the slow path, which dispatches on page_tags
+  uint8_t* read_pages[MMU_PAGE_COUNT];
+  uint8_t* write_pages[MMU_PAGE_COUNT];
+  uint8_t page_tags[MMU_PAGE_COUNT];
+  uint8_t code_pages[MMU_PAGE_COUNT]; // mmu_code_page_t
+  bool code_written;                  // some page went to MMU_CODE_WRITTEN
+  uint8_t int_pending;                // ie & IF & INT_MASK, see mmu_request_interrupt
+  bool oam_dma;                       // OAM DMA running, oam reads 0xFF and ignores writes
+
+  block_t blocks[MMU_BLOCK_COUNT];
   cart_t* cart;
+  mbc_t* mbc;
+  ext_ram_t* ext_ram;
+  struct gb* gb; // owner, for io registers other parts answer. NULL when standalone
   
   // External RAM state
   bool ram_enabled;
@@ -49,13 +104,27 @@ typedef struct {
   uint8_t rtc_h_latched;
   uint16_t rtc_dl_latched;
   uint8_t rtc_dh_latched;
+
+  // Backing memory for the blocks, hottest first
+  uint8_t hram[0x7F];
+  uint8_t ie;
+  uint8_t io[0x80];
+  uint8_t oam[0xA0];
+  uint8_t unusable[0x60];
+  uint8_t wram[0x1000];
+  uint8_t wram_banks[MMU_WRAM_BANKS][0x1000]; // 1-7 at 0xD000, picked by SVBK
+  uint8_t vram_banks[MMU_VRAM_BANKS][0x2000]; // picked by VBK
 } mmu_t;
 
-// Cleans up all memory blocks allocated for mmu
+// Sets up an mmu in place over the given cart, mbc and cart ram
+// Memory is expected to be zeroed
+void mmu_init(mmu_t* mmu, cart_t* cart, mbc_t* mbc, ext_ram_t* ext_ram);
+
+// Frees an mmu from mmu_create, the cart, mbc and ext_ram are not owned
 void mmu_destroy(mmu_t* mmu);
 
-// Creates new mmu with all blocks allocated
-mmu_t* mmu_create(cart_t* cart);
+// Allocates a standalone mmu, gb_create embeds one instead
+mmu_t* mmu_create(cart_t* cart, mbc_t* mbc, ext_ram_t* ext_ram);
 
 // Read from virtualized gb memory bank
 // Addresses will be the same as on the original GB hardware
@@ -65,12 +134,63 @@ uint8_t mmu_read(mmu_t* mmu, uint16_t address);
 // Addresses will be the same as on the original GB hardware
 void mmu_write(mmu_t* mmu, uint16_t address, uint8_t data);
 
-// Write the fixed length first block of rom to memory
+// Accesses the page tables can't serve, dispatched on page_tags
+uint8_t mmu_read_slow(mmu_t* mmu, uint16_t address);
+void mmu_write_slow(mmu_t* mmu, uint16_t address, uint8_t data);
+
+// Inlined versions of mmu_read/mmu_write for the cpu core
+static inline uint8_t mmu_read_fast(mmu_t* mmu, uint16_t address) {
+  uint8_t* page = mmu->read_pages[address >> MMU_PAGE_SHIFT];
+  if (page) {
+    return page[address & (MMU_PAGE_SIZE - 1)];
+  }
+  return mmu_read_slow(mmu, address);
+}
+
+static inline void mmu_write_fast(mmu_t* mmu, uint16_t address, uint8_t data) {
+  uint8_t* page = mmu->write_pages[address >> MMU_PAGE_SHIFT];
+  if (page) {
+    page[address & (MMU_PAGE_SIZE - 1)] = data;
+    return;
+  }
+  mmu_write_slow(mmu, address, data);
+}
+
+// IE and IF only change through these and the slow path, so int_pending is
+// always current and the cpu checks one byte for interrupts. Raising one also
+// brings the cpu back to the top of its loop to take it (SCHED_INTERRUPT)
+void mmu_request_interrupt(mmu_t* mmu, uint8_t bits);
+void mmu_update_pending(mmu_t* mmu);
+
+static inline void mmu_ack_interrupt(mmu_t* mmu, uint8_t bits) {
+  mmu->io[IO_IF] &= ~bits;
+  mmu->int_pending = mmu->ie & mmu->io[IO_IF] & INT_MASK;
+}
+
+// Sends writes to the page holding address (and its echo ram mirror) down the
+// slow path, so code translated from it can be dropped when it changes
+void mmu_watch_code(mmu_t* mmu, uint16_t address);
+
+// Stops watching a page (and its mirror) and gives back fast path writes
+void mmu_unwatch_code(mmu_t* mmu, uint8_t page);
+
+// Handle mbc register writes (rom address space)
+// Returns true if the write was consumed by the mbc
+int mbc_intercept(mmu_t* mmu, uint16_t addr, uint8_t data);
+
+// Map the first rom bank into the fixed region (0x0000-0x3FFF)
 void write_rom_fixed(mmu_t* mmu);
 
-// Switch to another switchable rom bank in memory
-// bank: 2-512
+// Map a rom bank into the switchable region, or the fixed region if fixed_rom
+// is set (MBC1 mode 1). Regions point directly into cart->data, so this is
+// a pointer swap and never copies
+// bank: 0-512, wrapped to the rom's bank count
 // Returns -1 if bank is invalid or if bank would exceed the size of cart->data
 int switch_rom(mmu_t* mmu, uint16_t bank, uint8_t fixed_rom);
 
+// Map a cgb vram bank (0-1) or switchable wram bank (1-7, 0 is 1) in. Like
+// switch_rom these only move page pointers, echo ram follows the wram bank
+void switch_vram(mmu_t* mmu, uint8_t bank);
+void switch_wram(mmu_t* mmu, uint8_t bank);
+
 #endif
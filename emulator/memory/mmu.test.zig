@@ -4,24 +4,38 @@ const c = @cImport({
     @cInclude("memory/mmu.h");
     @cInclude("cartridge/cart.h");
     @cInclude("cartridge/mbc.h");
+    @cInclude("cartridge/ext_ram.h");
     @cInclude("static/cart_type_data.h");
+    @cInclude("state/gb.h");
 });
 
+// A cart plus the mutable cart state that gb_t would normally embed
+const TestCart = struct {
+    cart: c.cart_t,
+    mbc: [*c]c.mbc_t,
+    ext_ram: [*c]c.ext_ram_t,
+};
+
 // Helper function to create a test cartridge
-fn createTestCart(cart_type: c.cart_type_enum) c.cart_t {
+fn createTestCart(cart_type: c.cart_type_enum) TestCart {
     var cart: c.cart_t = std.mem.zeroes(c.cart_t);
     cart.cart_type = cart_type;
     cart.size = 32768; // 32KB
+    cart.rom_banks = 2;
+    cart.rom_bank_mask = 1;
+    cart.ram_size = if (cart_type == c.MBC2) c.MBC2_RAM_SIZE else 0x8000; // 4 banks
     cart.data = null; // No actual ROM data needed for these tests
     cart.is_ram = false;
     cart.is_batt = false;
-    cart.ext_ram = c.ext_ram_create(cart_type, null);
-    cart.mbc = c.mbc_create(cart_type);
-    return cart;
+    return .{
+        .cart = cart,
+        .mbc = c.mbc_create(cart_type),
+        .ext_ram = c.ext_ram_create(cart.ram_size, null, c.EXT_RAM_HEAP),
+    };
 }
 
 // Helper function to clean up test cartridge
-fn destroyTestCart(cart: *c.cart_t) void {
+fn destroyTestCart(cart: *TestCart) void {
     if (cart.mbc != null) {
         c.mbc_destroy(cart.mbc);
         cart.mbc = null;
@@ -32,6 +46,10 @@ fn destroyTestCart(cart: *c.cart_t) void {
     }
 }
 
+fn createTestMmu(cart: *TestCart) [*c]c.mmu_t {
+    return c.mmu_create(&cart.cart, cart.mbc, cart.ext_ram);
+}
+
 test "cart creation - basic" {
     var cart = createTestCart(c.MBC1);
     defer destroyTestCart(&cart);
@@ -43,11 +61,11 @@ test "cart creation - basic" {
 test "mmu_create - basic initialization" {
     var cart = createTestCart(c.MBC1);
     defer destroyTestCart(&cart);
-    const mmu = c.mmu_create(&cart);
+    const mmu = createTestMmu(&cart);
     defer c.mmu_destroy(mmu);
 
     try testing.expect(mmu != null);
-    try testing.expect(mmu.*.cart.*.mbc != null);
+    try testing.expect(mmu.*.mbc != null);
     try testing.expect(mmu.*.ram_enabled == false);
     try testing.expect(mmu.*.current_ram_bank == 0);
     try testing.expect(mmu.*.timer_enabled == false);
@@ -56,7 +74,7 @@ test "mmu_create - basic initialization" {
 test "mmu_create - RTC initialization" {
     var cart = createTestCart(c.MBC3);
     defer destroyTestCart(&cart);
-    const mmu = c.mmu_create(&cart);
+    const mmu = createTestMmu(&cart);
     defer c.mmu_destroy(mmu);
 
     // Check RTC registers are initialized to 0
@@ -77,12 +95,12 @@ test "mmu_create - RTC initialization" {
 test "mmu_read - basic memory regions" {
     var cart = createTestCart(c.MBC1);
     defer destroyTestCart(&cart);
-    const mmu = c.mmu_create(&cart);
+    const mmu = createTestMmu(&cart);
     defer c.mmu_destroy(mmu);
 
     // Write test data to HRAM (0xFF80-0xFFFE)
-    mmu.*.blocks[c.MMU_HRAM].*.buf[0] = 0x42;
-    mmu.*.blocks[c.MMU_HRAM].*.buf[10] = 0xAB;
+    mmu.*.blocks[c.MMU_HRAM].buf[0] = 0x42;
+    mmu.*.blocks[c.MMU_HRAM].buf[10] = 0xAB;
 
     // Read back the data
     const value1 = c.mmu_read(mmu, 0xFF80);
@@ -95,7 +113,7 @@ test "mmu_read - basic memory regions" {
 test "mmu_read - external RAM disabled returns 0xFF" {
     var cart = createTestCart(c.MBC1);
     defer destroyTestCart(&cart);
-    const mmu = c.mmu_create(&cart);
+    const mmu = createTestMmu(&cart);
     defer c.mmu_destroy(mmu);
 
     // External RAM is disabled by default
@@ -109,7 +127,7 @@ test "mmu_read - external RAM disabled returns 0xFF" {
 test "mmu_write - basic memory write" {
     var cart = createTestCart(c.MBC1);
     defer destroyTestCart(&cart);
-    const mmu = c.mmu_create(&cart);
+    const mmu = createTestMmu(&cart);
     defer c.mmu_destroy(mmu);
 
     // Write to WRAM (0xC000-0xCFFF)
@@ -117,14 +135,14 @@ test "mmu_write - basic memory write" {
     c.mmu_write(mmu, 0xC100, 0xAA);
 
     // Verify the writes
-    try testing.expect(mmu.*.blocks[c.MMU_WRAM].*.buf[0] == 0x55);
-    try testing.expect(mmu.*.blocks[c.MMU_WRAM].*.buf[0x100] == 0xAA);
+    try testing.expect(mmu.*.blocks[c.MMU_WRAM].buf[0] == 0x55);
+    try testing.expect(mmu.*.blocks[c.MMU_WRAM].buf[0x100] == 0xAA);
 }
 
 test "mmu_write - external RAM disabled ignores writes" {
     var cart = createTestCart(c.MBC1);
     defer destroyTestCart(&cart);
-    const mmu = c.mmu_create(&cart);
+    const mmu = createTestMmu(&cart);
     defer c.mmu_destroy(mmu);
 
     // External RAM and timer are disabled by default
@@ -139,16 +157,262 @@ test "mmu_write - external RAM disabled ignores writes" {
     try testing.expect(value == 0xFF);
 }
 
+test "mmu_write - IE and IF keep the pending mask current" {
+    var cart = createTestCart(c.MBC1);
+    defer destroyTestCart(&cart);
+    const mmu = createTestMmu(&cart);
+    defer c.mmu_destroy(mmu);
+
+    c.mmu_write(mmu, 0xFF0F, 0xE5);
+    try testing.expect(mmu.*.int_pending == 0);
+    c.mmu_write(mmu, 0xFFFF, 0x04);
+    try testing.expect(mmu.*.int_pending == 0x04);
+
+    c.mmu_ack_interrupt(mmu, 0x04);
+    try testing.expect(mmu.*.int_pending == 0);
+    c.mmu_request_interrupt(mmu, 0x06);
+    try testing.expect(mmu.*.int_pending == 0x04);
+    try testing.expect(c.mmu_read(mmu, 0xFF0F) == 0xE7);
+}
+
+test "mmu_read - io registers read unused bits as set" {
+    var cart = createTestCart(c.MBC1);
+    defer destroyTestCart(&cart);
+    const mmu = createTestMmu(&cart);
+    defer c.mmu_destroy(mmu);
+
+    // SCY is plain, STAT bit 7 and all of 0xFF03 don't exist
+    c.mmu_write(mmu, 0xFF42, 0x12);
+    c.mmu_write(mmu, 0xFF41, 0x00);
+    c.mmu_write(mmu, 0xFF03, 0x00);
+    try testing.expect(c.mmu_read(mmu, 0xFF42) == 0x12);
+    try testing.expect(c.mmu_read(mmu, 0xFF41) == 0x80);
+    try testing.expect(c.mmu_read(mmu, 0xFF03) == 0xFF);
+
+    // Only the select bits of P1 are kept, no buttons are down
+    c.mmu_write(mmu, 0xFF00, 0x20);
+    try testing.expect(c.mmu_read(mmu, 0xFF00) == 0xEF);
+
+    // hram and IE past the table
+    c.mmu_write(mmu, 0xFF80, 0x34);
+    c.mmu_write(mmu, 0xFFFF, 0x1F);
+    try testing.expect(c.mmu_read(mmu, 0xFF80) == 0x34);
+    try testing.expect(c.mmu_read(mmu, 0xFFFF) == 0x1F);
+}
+
 test "switch_rom - invalid bank numbers" {
     var cart = createTestCart(c.MBC1);
     defer destroyTestCart(&cart);
-    const mmu = c.mmu_create(&cart);
+    const mmu = createTestMmu(&cart);
     defer c.mmu_destroy(mmu);
 
     // Test invalid bank numbers
-    const result1 = c.switch_rom(mmu, 1, 0); // Bank 1 is invalid (< 2)
+    const result1 = c.switch_rom(mmu, 1, 0); // Bank 1 is invalid (no rom image to map)
     const result2 = c.switch_rom(mmu, 513, 0); // Bank 513 is invalid (> 512)
 
     try testing.expect(result1 == -1);
     try testing.expect(result2 == -1);
 }
+
+test "mmu_write - echo RAM mirrors both WRAM blocks" {
+    var cart = createTestCart(c.MBC1);
+    defer destroyTestCart(&cart);
+    const mmu = createTestMmu(&cart);
+    defer c.mmu_destroy(mmu);
+
+    c.mmu_write(mmu, 0xE010, 0x11);
+    c.mmu_write(mmu, 0xD123, 0x22);
+
+    try testing.expect(c.mmu_read(mmu, 0xC010) == 0x11);
+    try testing.expect(c.mmu_read(mmu, 0xF123) == 0x22);
+    try testing.expect(mmu.*.blocks[c.MMU_WRAM_SWITCH].buf[0x123] == 0x22);
+}
+
+test "mmu_write - SVBK and VBK swap cgb banks in, echo RAM follows" {
+    var cart = createTestCart(c.MBC1);
+    cart.cart.is_cgb = true;
+    defer destroyTestCart(&cart);
+    const mmu = createTestMmu(&cart);
+    defer c.mmu_destroy(mmu);
+
+    c.mmu_write(mmu, 0xFF70, 0x03);
+    c.mmu_write(mmu, 0xD010, 0x33);
+    try testing.expect(mmu.*.wram_banks[2][0x10] == 0x33);
+    try testing.expect(c.mmu_read(mmu, 0xF010) == 0x33);
+    try testing.expect(c.mmu_read(mmu, 0xFF70) == 0xFB);
+
+    // Bank 0 selects bank 1
+    c.mmu_write(mmu, 0xFF70, 0x00);
+    try testing.expect(c.mmu_read(mmu, 0xD010) == 0);
+    c.mmu_write(mmu, 0xF010, 0x11);
+    try testing.expect(mmu.*.wram_banks[0][0x10] == 0x11);
+
+    c.mmu_write(mmu, 0xFF4F, 0x01);
+    c.mmu_write(mmu, 0x8000, 0x77);
+    c.mmu_write(mmu, 0xFF4F, 0x00);
+    try testing.expect(mmu.*.vram_banks[1][0] == 0x77);
+    try testing.expect(c.mmu_read(mmu, 0x8000) == 0);
+    try testing.expect(c.mmu_read(mmu, 0xFF4F) == 0xFE);
+}
+
+test "mmu_write - ROM writes go to the mbc" {
+    var cart = createTestCart(c.MBC1);
+    defer destroyTestCart(&cart);
+    const mmu = createTestMmu(&cart);
+    defer c.mmu_destroy(mmu);
+
+    // RAM gate enable, should not land in the rom buffer
+    c.mmu_write(mmu, 0x0000, 0x0A);
+
+    try testing.expect(mmu.*.ram_enabled == true);
+    // No rom image in the test cart, so the rom pages read as unmapped
+    try testing.expect(c.mmu_read(mmu, 0x0000) == 0xFF);
+}
+
+test "page tables - direct pages, slow path pages" {
+    var cart = createTestCart(c.MBC1);
+    defer destroyTestCart(&cart);
+    const mmu = createTestMmu(&cart);
+    defer c.mmu_destroy(mmu);
+
+    // WRAM is served straight from the page pointers
+    try testing.expect(mmu.*.read_pages[0xC0] != null);
+    try testing.expect(mmu.*.write_pages[0xC0] != null);
+
+    // ROM is read-only, writes are mbc commands
+    try testing.expect(mmu.*.read_pages[0x00] != null);
+    try testing.expect(mmu.*.write_pages[0x00] == null);
+    try testing.expect(mmu.*.page_tags[0x00] == c.MMU_PAGE_ROM);
+
+    // Ext RAM and IO always take the slow path
+    try testing.expect(mmu.*.read_pages[0xA0] == null);
+    try testing.expect(mmu.*.page_tags[0xA0] == c.MMU_PAGE_EXT_RAM);
+    try testing.expect(mmu.*.read_pages[0xFF] == null);
+    try testing.expect(mmu.*.page_tags[0xFF] == c.MMU_PAGE_IO);
+}
+
+test "switch_rom - banks point into the cart image" {
+    var cart = createTestCart(c.MBC1);
+    defer destroyTestCart(&cart);
+
+    // 4 banks, each filled with its bank number
+    var rom: [0x10000]u8 = undefined;
+    for (&rom, 0..) |*byte, i| {
+        byte.* = @intCast(i / 0x4000);
+    }
+    cart.cart.data = &rom;
+    cart.cart.size = rom.len;
+    cart.cart.rom_banks = 4;
+    cart.cart.rom_bank_mask = 3;
+
+    const mmu = createTestMmu(&cart);
+    defer c.mmu_destroy(mmu);
+
+    // Banks 0 and 1 are mapped at power on
+    try testing.expect(c.mmu_read(mmu, 0x0000) == 0);
+    try testing.expect(c.mmu_read(mmu, 0x4000) == 1);
+
+    try testing.expect(c.switch_rom(mmu, 3, 0) == 0);
+    try testing.expect(@intFromPtr(mmu.*.blocks[c.MMU_ROM_SWITCH].buf) == @intFromPtr(&rom[0xC000]));
+    try testing.expect(c.mmu_read(mmu, 0x7FFF) == 3);
+
+    // Fixed region remap, as done by MBC1 mode 1
+    try testing.expect(c.switch_rom(mmu, 2, 1) == 0);
+    try testing.expect(c.mmu_read(mmu, 0x0000) == 2);
+
+    // Banks past what the rom has wrap around, like on the mbc
+    try testing.expect(c.switch_rom(mmu, 5, 0) == 0);
+    try testing.expect(c.mmu_read(mmu, 0x4000) == 1);
+
+    // A header claiming more banks than the image holds can't map past the end
+    cart.cart.rom_banks = 8;
+    cart.cart.rom_bank_mask = 7;
+    try testing.expect(c.switch_rom(mmu, 6, 0) == -1);
+    try testing.expect(c.mmu_read(mmu, 0x4000) == 1);
+}
+
+test "mmu_write - external RAM writes mark pages dirty" {
+    var cart = createTestCart(c.MBC1);
+    defer destroyTestCart(&cart);
+    const mmu = createTestMmu(&cart);
+    defer c.mmu_destroy(mmu);
+
+    // Enable RAM and select bank 1
+    c.mmu_write(mmu, 0x0000, 0x0A);
+    c.mmu_write(mmu, 0x6000, 0x01);
+    c.mmu_write(mmu, 0x4000, 0x01);
+
+    const seq = cart.ext_ram.*.write_seq;
+    c.mmu_write(mmu, 0xA100, 0x42);
+
+    // Page 1 of bank 1, pages are 256 bytes
+    const page = (c.RAM_BANK_SIZE + 0x100) >> c.EXT_RAM_PAGE_SHIFT;
+    try testing.expect(cart.ext_ram.*.write_seq == seq + 1);
+    try testing.expect((cart.ext_ram.*.dirty[page / 64] >> @intCast(page % 64)) & 1 == 1);
+    try testing.expect(c.mmu_read(mmu, 0xA100) == 0x42);
+}
+
+test "mmu_read - MBC2 RAM is 4 bits wide and repeats" {
+    var cart = createTestCart(c.MBC2);
+    defer destroyTestCart(&cart);
+    const mmu = createTestMmu(&cart);
+    defer c.mmu_destroy(mmu);
+
+    mmu.*.ram_enabled = true;
+    c.mmu_write(mmu, 0xA001, 0xAB);
+
+    // Only the low nibble is stored, 512 bytes repeat through 0xA000-0xBFFF
+    try testing.expect(cart.ext_ram.*.data[1] == 0x0B);
+    try testing.expect(c.mmu_read(mmu, 0xA001) == 0xFB);
+    try testing.expect(c.mmu_read(mmu, 0xA201) == 0xFB);
+    try testing.expect(c.mmu_read(mmu, 0xBE01) == 0xFB);
+}
+
+test "mmu_read - cart without RAM reads open bus" {
+    var cart = TestCart{
+        .cart = std.mem.zeroes(c.cart_t),
+        .mbc = c.mbc_create(c.ROM),
+        .ext_ram = c.ext_ram_create(0, null, c.EXT_RAM_HEAP),
+    };
+    cart.cart.cart_type = c.ROM;
+    defer destroyTestCart(&cart);
+    const mmu = createTestMmu(&cart);
+    defer c.mmu_destroy(mmu);
+
+    mmu.*.ram_enabled = true;
+    c.mmu_write(mmu, 0xA000, 0x12);
+
+    try testing.expect(c.get_ram_bank(cart.ext_ram, 0) == null);
+    try testing.expect(c.mmu_read(mmu, 0xA000) == 0xFF);
+}
+
+test "gb_clone - clone has its own memory" {
+    var cart = createTestCart(c.MBC1);
+    defer destroyTestCart(&cart);
+
+    const gb = c.gb_create(&cart.cart);
+    try testing.expect(gb != null);
+    defer c.gb_destroy(gb);
+
+    const mmu = &gb.*.mmu;
+    c.mmu_write(mmu, 0xC010, 0x11);
+    c.mmu_write(mmu, 0x0000, 0x0A); // ram on
+    c.mmu_write(mmu, 0xA010, 0x22);
+
+    const clone = c.gb_clone(gb);
+    try testing.expect(clone != null);
+    defer c.gb_destroy(clone);
+    const clone_mmu = &clone.*.mmu;
+
+    try testing.expect(c.mmu_read(clone_mmu, 0xC010) == 0x11);
+    try testing.expect(c.mmu_read(clone_mmu, 0xA010) == 0x22);
+
+    // Writes to one machine don't show up in the other
+    c.mmu_write(clone_mmu, 0xC010, 0x33);
+    c.mmu_write(clone_mmu, 0xA010, 0x44);
+    try testing.expect(c.mmu_read(mmu, 0xC010) == 0x11);
+    try testing.expect(c.mmu_read(mmu, 0xA010) == 0x22);
+
+    try testing.expect(clone.*.mmu.mbc == &clone.*.mbc);
+    try testing.expect(clone.*.mbc.regs == &clone.*.mbc_regs);
+}
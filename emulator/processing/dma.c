@@ -0,0 +1,146 @@
+// Direct Memory Access
+
+#include <string.h>
+#include "dma.h"
+#include "ppu.h"
+#include "../state/gb.h"
+
+// Copies len bytes that don't cross a page. Pages with a host pointer are a
+// memcpy, cart ram (with its gate and rtc registers) goes a byte at a time
+static void copy_from(mmu_t* mmu, uint8_t* dst, uint16_t src, int len) {
+  uint8_t* page = mmu->read_pages[src >> MMU_PAGE_SHIFT];
+  if (page) {
+    memcpy(dst, page + (src & (MMU_PAGE_SIZE - 1)), len);
+    return;
+  }
+  for (int i = 0; i < len; i++) {
+    dst[i] = mmu_read_slow(mmu, src + i);
+  }
+}
+
+void dma_init(gb_t* gb) {
+  gb->dma.hdma_blocks = 0;
+  gb->mmu.io[IO_HDMA5] = 0xFF;
+  gb->mmu.oam_dma = false;
+}
+
+void dma_oam_start(gb_t* gb, uint8_t page) {
+  mmu_t* mmu = &gb->mmu;
+  mmu->io[IO_DMA] = page;
+
+  // Above wram the source is the echo of it
+  uint16_t src = page << 8;
+  if (src >= 0xE000) {
+    src -= 0x2000;
+  }
+  ppu_catch_up(gb);
+  copy_from(mmu, mmu->oam, src, DMA_OAM_LEN);
+  ppu_oam_written(&gb->ppu);
+
+  // A restart while one is running keeps oam locked until the new one ends
+  mmu->oam_dma = true;
+  scheduler_set(&gb->sched, SCHED_OAM_DMA, gb->cycles + DMA_OAM_CYCLES);
+}
+
+void dma_oam_end(gb_t* gb, uint64_t at) {
+  (void)at;
+  gb->mmu.oam_dma = false;
+}
+
+// Copies one block to vram and stops the cpu for it. Sources in vram itself
+// aren't wired to anything and read 0xFF
+static void copy_block(gb_t* gb) {
+  mmu_t* mmu = &gb->mmu;
+  dma_t* dma = &gb->dma;
+  uint8_t* dst = mmu->blocks[MMU_VRAM].buf + dma->hdma_dst;
+  ppu_catch_up(gb);
+
+  if (dma->hdma_src >= 0x8000 && dma->hdma_src < 0xA000) {
+    memset(dst, 0xFF, HDMA_BLOCK_LEN);
+  }
+  else {
+    copy_from(mmu, dst, dma->hdma_src, HDMA_BLOCK_LEN);
+  }
+  // Blocks are tile aligned, so this is one tile
+  ppu_vram_written(&gb->ppu, mmu->blocks[MMU_VRAM].buf == mmu->vram_banks[1], dma->hdma_dst);
+  dma->hdma_src += HDMA_BLOCK_LEN;
+  dma->hdma_dst = (dma->hdma_dst + HDMA_BLOCK_LEN) & 0x1FF0;
+  gb->cycles += HDMA_BLOCK_CYCLES;
+}
+
+// The first hblank on a visible line at or after cycle `from`, worked out
+// from where the ppu is in the frame
+static uint64_t next_hblank(gb_t* gb, uint64_t from) {
+  uint64_t start = gb->sched.at[SCHED_PPU_LINE] - PPU_CYCLES_PER_LINE;
+  int ly = gb->mmu.io[IO_LY];
+  for (;;) {
+    if (ly < PPU_VBLANK_LINE && from < start + PPU_CYCLES_PER_LINE) {
+      uint64_t hblank = start + PPU_HBLANK_START;
+      return from > hblank ? from : hblank;
+    }
+    start += PPU_CYCLES_PER_LINE;
+    ly = (ly + 1) % PPU_LINES;
+  }
+}
+
+void dma_hdma_start(gb_t* gb, uint8_t data) {
+  mmu_t* mmu = &gb->mmu;
+  dma_t* dma = &gb->dma;
+  uint8_t blocks = (data & 0x7F) + 1;
+
+  // Bit 7 clear while an hblank transfer runs stops it, and reads back with
+  // bit 7 set over what was left
+  if (dma->hdma_blocks && !(data & 0x80)) {
+    mmu->io[IO_HDMA5] = 0x80 | (dma->hdma_blocks - 1);
+    dma->hdma_blocks = 0;
+    scheduler_cancel(&gb->sched, SCHED_HDMA);
+    return;
+  }
+
+  uint8_t* io = mmu->io;
+  dma->hdma_src = (io[IO_HDMA1] << 8 | io[IO_HDMA2]) & 0xFFF0;
+  dma->hdma_dst = (io[IO_HDMA3] << 8 | io[IO_HDMA4]) & 0x1FF0;
+
+  // General purpose, all of it now with the cpu stopped until it's done
+  if (!(data & 0x80)) {
+    for (int i = 0; i < blocks; i++) {
+      copy_block(gb);
+    }
+    io[IO_HDMA5] = 0xFF;
+    return;
+  }
+
+  dma->hdma_blocks = blocks;
+  io[IO_HDMA5] = blocks - 1;
+  if (io[IO_LCDC] & LCDC_LCD_ON) {
+    scheduler_set(&gb->sched, SCHED_HDMA, next_hblank(gb, gb->cycles));
+  }
+}
+
+void dma_hblank(gb_t* gb, uint64_t at) {
+  (void)at;
+  dma_t* dma = &gb->dma;
+  copy_block(gb);
+
+  dma->hdma_blocks--;
+  if (!dma->hdma_blocks) {
+    gb->mmu.io[IO_HDMA5] = 0xFF;
+    return;
+  }
+  gb->mmu.io[IO_HDMA5] = dma->hdma_blocks - 1;
+
+  // The line this hblank is on ends at the next line event
+  scheduler_set(&gb->sched, SCHED_HDMA, next_hblank(gb, gb->sched.at[SCHED_PPU_LINE]));
+}
+
+void dma_lcd_switched(gb_t* gb) {
+  if (!gb->dma.hdma_blocks) {
+    return;
+  }
+  if (gb->mmu.io[IO_LCDC] & LCDC_LCD_ON) {
+    scheduler_set(&gb->sched, SCHED_HDMA, next_hblank(gb, gb->cycles));
+  }
+  else {
+    scheduler_cancel(&gb->sched, SCHED_HDMA);
+  }
+}
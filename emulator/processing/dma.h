@@ -0,0 +1,47 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include <stdint.h>
+
+struct gb;
+
+// OAM DMA (0xFF46) and cgb vram DMA (0xFF51-0xFF55). Both copy whole runs of
+// bytes between host pointers rather than a byte per m-cycle, what happens
+// to the cpu meanwhile is done with the scheduler: oam is locked until
+// SCHED_OAM_DMA, and vram DMA stops the cpu by moving gb->cycles on
+
+#define IO_DMA 0x46
+#define IO_HDMA1 0x51 // source high
+#define IO_HDMA2 0x52 // source low
+#define IO_HDMA3 0x53 // destination high
+#define IO_HDMA4 0x54 // destination low
+#define IO_HDMA5 0x55 // length, mode and start
+
+#define DMA_OAM_LEN 0xA0
+#define DMA_OAM_CYCLES 644   // a byte every m-cycle, after one to start
+#define HDMA_BLOCK_LEN 0x10
+#define HDMA_BLOCK_CYCLES 32 // the cpu waits 8 m-cycles for each block
+
+typedef struct {
+  uint16_t hdma_src;   // next byte to copy
+  uint16_t hdma_dst;   // next byte to write, offset into vram
+  uint8_t hdma_blocks; // left in an hblank transfer, 0 when none is running
+} dma_t;
+
+void dma_init(struct gb* gb);
+
+// Writes to 0xFF46 and 0xFF55
+void dma_oam_start(struct gb* gb, uint8_t page);
+void dma_hdma_start(struct gb* gb, uint8_t data);
+
+// SCHED_OAM_DMA handler, gives oam back to the cpu
+void dma_oam_end(struct gb* gb, uint64_t at);
+
+// SCHED_HDMA handler, copies one block at the start of hblank
+void dma_hblank(struct gb* gb, uint64_t at);
+
+// LCDC.7 changed, an hblank transfer waits while the lcd is off and picks
+// up at the next hblank once it's on
+void dma_lcd_switched(struct gb* gb);
+
+#endif
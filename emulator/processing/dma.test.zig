@@ -0,0 +1,87 @@
+const std = @import("std");
+const testing = std.testing;
+const test_gb = @import("test_gb");
+const c = test_gb.c;
+
+test "dma - OAM DMA copies a page and locks oam until it ends" {
+    // LD A, C0; LDH (46), A; loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x3E, 0xC0, 0xE0, 0x46, 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    for (0..c.DMA_OAM_LEN) |i| {
+        gb.*.mmu.wram[i] = @intCast(i + 1);
+    }
+
+    _ = c.cpu_step(gb);
+    _ = c.cpu_step(gb);
+    try testing.expectEqualSlices(u8, gb.*.mmu.wram[0..c.DMA_OAM_LEN], gb.*.mmu.oam[0..c.DMA_OAM_LEN]);
+    try testing.expect(c.mmu_read(&gb.*.mmu, 0xFE05) == 0xFF);
+
+    _ = c.cpu_run_cycles(gb, c.DMA_OAM_CYCLES);
+    try testing.expect(c.mmu_read(&gb.*.mmu, 0xFE05) == 6);
+}
+
+test "dma - general purpose DMA copies to vram with the cpu stopped" {
+    // loop: JR loop
+    const gb = test_gb.create(.{ .is_cgb = true }, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    for (0..0x20) |i| {
+        gb.*.mmu.wram[0x100 + i] = @intCast(0x80 + i);
+    }
+
+    // C100 to 8100, two blocks
+    c.mmu_write(&gb.*.mmu, 0xFF51, 0xC1);
+    c.mmu_write(&gb.*.mmu, 0xFF52, 0x00);
+    c.mmu_write(&gb.*.mmu, 0xFF53, 0x81);
+    c.mmu_write(&gb.*.mmu, 0xFF54, 0x00);
+    const before = gb.*.cycles;
+    c.mmu_write(&gb.*.mmu, 0xFF55, 0x01);
+
+    try testing.expect(gb.*.cycles - before == 2 * c.HDMA_BLOCK_CYCLES);
+    try testing.expectEqualSlices(u8, gb.*.mmu.wram[0x100..0x120], gb.*.mmu.vram_banks[0][0x100..0x120]);
+    try testing.expect(c.mmu_read(&gb.*.mmu, 0xFF55) == 0xFF);
+}
+
+test "dma - hblank DMA copies a block each hblank" {
+    // loop: JR loop
+    const gb = test_gb.create(.{ .is_cgb = true }, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    for (0..0x20) |i| {
+        gb.*.mmu.wram[0x100 + i] = @intCast(0x80 + i);
+    }
+
+    c.mmu_write(&gb.*.mmu, 0xFF51, 0xC1);
+    c.mmu_write(&gb.*.mmu, 0xFF52, 0x00);
+    c.mmu_write(&gb.*.mmu, 0xFF53, 0x01);
+    c.mmu_write(&gb.*.mmu, 0xFF54, 0x00);
+    c.mmu_write(&gb.*.mmu, 0xFF55, 0x81);
+    try testing.expect(c.mmu_read(&gb.*.mmu, 0xFF55) == 0x01);
+
+    // Line 0 reaches hblank first
+    _ = c.cpu_run_cycles(gb, c.PPU_HBLANK_START + 48);
+    try testing.expect(c.mmu_read(&gb.*.mmu, 0xFF55) == 0x00);
+    try testing.expect(gb.*.mmu.vram_banks[0][0x110] == 0);
+
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE);
+    try testing.expect(c.mmu_read(&gb.*.mmu, 0xFF55) == 0xFF);
+    try testing.expectEqualSlices(u8, gb.*.mmu.wram[0x100..0x120], gb.*.mmu.vram_banks[0][0x100..0x120]);
+}
+
+test "dma - HDMA5 does nothing on a dmg" {
+    // loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    for (0..0x20) |i| {
+        gb.*.mmu.wram[0x100 + i] = @intCast(0x80 + i);
+    }
+
+    c.mmu_write(&gb.*.mmu, 0xFF51, 0xC1);
+    c.mmu_write(&gb.*.mmu, 0xFF52, 0x00);
+    c.mmu_write(&gb.*.mmu, 0xFF53, 0x81);
+    c.mmu_write(&gb.*.mmu, 0xFF54, 0x00);
+    const before = gb.*.cycles;
+    c.mmu_write(&gb.*.mmu, 0xFF55, 0x01);
+
+    try testing.expect(gb.*.cycles == before);
+    try testing.expect(gb.*.mmu.vram_banks[0][0x100] == 0);
+    try testing.expect(gb.*.sched.at[c.SCHED_HDMA] == c.SCHED_NEVER);
+}
@@ -0,0 +1,112 @@
+// Palettes
+
+#include <pthread.h>
+#include "palette.h"
+#include "ppu.h"
+#include "../state/gb.h"
+
+// Dmg shades, lightest first
+static const uint32_t DMG_SHADES[4] = { PALETTE_WHITE, 0xFFAAAAAA, 0xFF555555, 0xFF000000 };
+
+// The same for every machine
+static uint32_t luts[2][PALETTE_RGB555];
+static pthread_once_t luts_once = PTHREAD_ONCE_INIT;
+
+static uint32_t pixel(uint32_t r, uint32_t g, uint32_t b) {
+  return 0xFF000000 | r << 16 | g << 8 | b;
+}
+
+static void build_luts(void) {
+  for (int color = 0; color < PALETTE_RGB555; color++) {
+    uint32_t r = color & 0x1F;
+    uint32_t g = (color >> 5) & 0x1F;
+    uint32_t b = (color >> 10) & 0x1F;
+    luts[0][color] = pixel(r << 3 | r >> 2, g << 3 | g >> 2, b << 3 | b >> 2);
+
+    // Each channel bleeds into the others a little and nothing quite
+    // reaches full brightness
+    uint32_t cr = r * 26 + g * 4 + b * 2;
+    uint32_t cg = g * 24 + b * 8;
+    uint32_t cb = r * 6 + g * 4 + b * 22;
+    luts[1][color] = pixel((cr < 960 ? cr : 960) >> 2, (cg < 960 ? cg : 960) >> 2,
+                           (cb < 960 ? cb : 960) >> 2);
+  }
+}
+
+// Machines can be created on any thread, so the tables are built under
+// pthread_once rather than checked and filled in place
+const uint32_t* palette_lut(bool corrected) {
+  pthread_once(&luts_once, build_luts);
+  return luts[corrected];
+}
+
+static void dmg_colors(ppu_t* ppu, const uint8_t* io) {
+  ppu->colors[PPU_DMG_BLANK] = PALETTE_WHITE;
+  for (int color = 0; color < 4; color++) {
+    int shift = color * 2;
+    ppu->colors[color] = DMG_SHADES[(io[IO_BGP] >> shift) & 3];
+    ppu->colors[PPU_OBJ_COLORS + color] = DMG_SHADES[(io[IO_OBP0] >> shift) & 3];
+    ppu->colors[PPU_OBJ_COLORS + 4 + color] = DMG_SHADES[(io[IO_OBP1] >> shift) & 3];
+  }
+}
+
+// Entry `color` (0-31) of the bg (0) or sprite (1) palette ram
+static void cgb_color(ppu_t* ppu, int obj, int color) {
+  const uint8_t* ram = ppu->palettes[obj];
+  uint16_t rgb555 = (ram[color * 2] | ram[color * 2 + 1] << 8) & (PALETTE_RGB555 - 1);
+  ppu->colors[obj * PPU_OBJ_COLORS + color] = ppu->lut[rgb555];
+}
+
+void palette_refresh(gb_t* gb) {
+  ppu_t* ppu = &gb->ppu;
+  if (!gb->cart->is_cgb) {
+    dmg_colors(ppu, gb->mmu.io);
+    return;
+  }
+  for (int color = 0; color < PPU_OBJ_COLORS; color++) {
+    cgb_color(ppu, 0, color);
+    cgb_color(ppu, 1, color);
+  }
+}
+
+uint8_t palette_read(gb_t* gb, uint8_t reg) {
+  uint8_t* io = gb->mmu.io;
+  if (!gb->cart->is_cgb || (reg != IO_BCPD && reg != IO_OCPD)) {
+    return io[reg];
+  }
+  int obj = reg == IO_OCPD;
+  return gb->ppu.palettes[obj][io[reg - 1] & (PALETTE_BYTES - 1)];
+}
+
+void palette_write(gb_t* gb, uint8_t reg, uint8_t data) {
+  ppu_t* ppu = &gb->ppu;
+  uint8_t* io = gb->mmu.io;
+  ppu_catch_up(gb);
+  io[reg] = data;
+
+  if (!gb->cart->is_cgb) {
+    if (reg == IO_BGP || reg == IO_OBP0 || reg == IO_OBP1) {
+      dmg_colors(ppu, io);
+    }
+    return;
+  }
+  if (reg != IO_BCPD && reg != IO_OCPD) {
+    return;
+  }
+
+  // The index register is the one before the data register
+  int obj = reg == IO_OCPD;
+  uint8_t* spec = &io[reg - 1];
+  uint8_t index = *spec & (PALETTE_BYTES - 1);
+  ppu->palettes[obj][index] = data;
+  cgb_color(ppu, obj, index >> 1);
+
+  if (*spec & PALETTE_AUTO_INC) {
+    *spec = (*spec & ~(PALETTE_BYTES - 1)) | ((index + 1) & (PALETTE_BYTES - 1));
+  }
+}
+
+void palette_set_correction(gb_t* gb, bool on) {
+  gb->ppu.lut = palette_lut(on);
+  palette_refresh(gb);
+}
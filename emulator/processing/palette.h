@@ -0,0 +1,39 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct gb;
+
+// Lines are colored from ppu->colors, a host pixel for each of the 64
+// palette entries. They're worked out when a palette register is written
+// rather than per pixel, cgb colors through a table of every RGB555 color
+
+#define IO_BCPS 0x68 // cgb bg palette byte to access, see PALETTE_AUTO_INC
+#define IO_BCPD 0x69
+#define IO_OCPS 0x6A // cgb sprite palette byte to access
+#define IO_OCPD 0x6B
+#define PALETTE_AUTO_INC 0x80 // in BCPS/OCPS, move on a byte after each write
+
+#define PALETTE_BYTES 64   // 8 palettes of 4 RGB555 colors, low byte first
+#define PALETTE_RGB555 0x8000
+#define PALETTE_WHITE 0xFFFFFFFF
+
+// Host pixel (0xAARRGGBB) for every RGB555 color. The corrected table mixes
+// and dims the channels the way a cgb screen shows them
+const uint32_t* palette_lut(bool corrected);
+
+// Works out every entry again, for ppu_init and a change of table
+void palette_refresh(struct gb* gb);
+
+// BCPD and OCPD, reads of the other palette registers are plain
+uint8_t palette_read(struct gb* gb, uint8_t reg);
+
+// BGP, OBP0, OBP1 (dmg), BCPD and OCPD
+void palette_write(struct gb* gb, uint8_t reg, uint8_t data);
+
+// Picks the corrected or plain table for cgb colors, plain to start with
+void palette_set_correction(struct gb* gb, bool on);
+
+#endif
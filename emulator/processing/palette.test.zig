@@ -0,0 +1,27 @@
+const std = @import("std");
+const testing = std.testing;
+const test_gb = @import("test_gb");
+const c = test_gb.c;
+
+test "palette - cgb palette writes update the colors lines use" {
+    // loop: JR loop
+    const gb = test_gb.create(.{ .is_cgb = true }, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    const mmu = &gb.*.mmu;
+
+    try testing.expect(gb.*.ppu.colors[1] == c.PALETTE_WHITE);
+
+    // Bg palette 0 color 1 to pure red, a byte at a time
+    c.mmu_write(mmu, 0xFF68, c.PALETTE_AUTO_INC | 0x02);
+    c.mmu_write(mmu, 0xFF69, 0x1F);
+    c.mmu_write(mmu, 0xFF69, 0x00);
+    try testing.expect(c.mmu_read(mmu, 0xFF68) == 0xC4);
+    try testing.expect(gb.*.ppu.colors[1] == 0xFFFF0000);
+
+    c.mmu_write(mmu, 0xFF68, 0x02);
+    try testing.expect(c.mmu_read(mmu, 0xFF69) == 0x1F);
+
+    // The corrected table dims it and bleeds some into blue
+    c.palette_set_correction(gb, true);
+    try testing.expect(gb.*.ppu.colors[1] == 0xFFC9002E);
+}
@@ -0,0 +1,77 @@
+// Pixels per ns for each decode and colorize kernel the host can run
+// Run with `zig build bench -Doptimize=ReleaseFast`
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "pixels.h"
+
+#define TILE_ROWS (384 * 8 * 2) // both vram banks of tiles
+#define LINES 144
+#define LINE_WIDTH 160
+#define PASSES 2000
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char* kernel, const char* job, uint64_t pixels, uint64_t elapsed) {
+  printf("%-8s %-8s %6.2f pixels/ns\n", kernel, job, (double)pixels / (double)elapsed);
+}
+
+int main(void) {
+  uint8_t* rows = malloc(TILE_ROWS * 2);
+  uint8_t* decoded = malloc(TILE_ROWS * 8);
+  uint8_t* entries = malloc(LINES * LINE_WIDTH);
+  uint32_t* frame = malloc(sizeof(uint32_t) * LINES * LINE_WIDTH);
+  uint32_t colors[64];
+
+  srand(0x5EED);
+  for (int i = 0; i < TILE_ROWS * 2; i++) {
+    rows[i] = rand();
+  }
+  for (int i = 0; i < LINES * LINE_WIDTH; i++) {
+    entries[i] = rand() % 64;
+  }
+  for (int i = 0; i < 64; i++) {
+    colors[i] = 0xFF000000 | (uint32_t)rand();
+  }
+
+  volatile uint32_t sink = 0;
+  for (int which = 0; which < PIXELS_KERNEL_COUNT; which++) {
+    const pixels_kernels_t* kernels = pixels_kernels(which);
+    if (!kernels) {
+      continue;
+    }
+
+    // Every tile in vram decoded again, then a frame of lines colored
+    uint64_t start = now_ns();
+    for (int p = 0; p < PASSES; p++) {
+      kernels->decode(rows, decoded, TILE_ROWS);
+      sink += decoded[p % (TILE_ROWS * 8)];
+    }
+    report(kernels->name, "decode", (uint64_t)TILE_ROWS * 8 * PASSES, now_ns() - start);
+
+    start = now_ns();
+    for (int p = 0; p < PASSES; p++) {
+      for (int line = 0; line < LINES; line++) {
+        kernels->colorize(entries + line * LINE_WIDTH, colors,
+                          frame + line * LINE_WIDTH, LINE_WIDTH);
+      }
+      sink += frame[p % (LINES * LINE_WIDTH)];
+    }
+    report(kernels->name, "colorize", (uint64_t)LINES * LINE_WIDTH * PASSES, now_ns() - start);
+  }
+  printf("best: %s\n", pixels_best()->name);
+
+  free(frame);
+  free(entries);
+  free(decoded);
+  free(rows);
+  return 0;
+}
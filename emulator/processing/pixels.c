@@ -0,0 +1,176 @@
+// Pixel Kernels
+
+#include <stdbool.h>
+#include <string.h>
+#include "pixels.h"
+
+#if defined(__x86_64__)
+#define PIXELS_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// Plane bit for each pixel of a row, leftmost (bit 7) in the lowest byte in
+// memory, one byte per pixel
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define ROW_BITS 0x8040201008040201ull
+#else
+#define ROW_BITS 0x0102040810204080ull
+#endif
+#define BYTES_OF(x) (0x0101010101010101ull * (x))
+
+static void decode_scalar(const uint8_t* rows, uint8_t* out, int count) {
+  for (int row = 0; row < count; row++) {
+    uint8_t lo = rows[row * 2];
+    uint8_t hi = rows[row * 2 + 1];
+    for (int x = 0; x < 8; x++) {
+      int bit = 7 - x;
+      out[row * 8 + x] = ((hi >> bit) & 1) << 1 | ((lo >> bit) & 1);
+    }
+  }
+}
+
+// Copies a plane byte into all 8 bytes and keeps a different bit in each.
+// Adding 0x7F carries into the top bit of every byte that kept its bit, and
+// can't carry out of one, so shifting that down gives a 0 or 1 per pixel
+static uint64_t spread(uint8_t plane) {
+  uint64_t bits = BYTES_OF(plane) & ROW_BITS;
+  return ((bits + BYTES_OF(0x7F)) >> 7) & BYTES_OF(1);
+}
+
+static void decode_portable(const uint8_t* rows, uint8_t* out, int count) {
+  for (int row = 0; row < count; row++) {
+    uint64_t colors = spread(rows[row * 2]) | spread(rows[row * 2 + 1]) << 1;
+    memcpy(out + row * 8, &colors, 8);
+  }
+}
+
+static void colorize_scalar(const uint8_t* entries, const uint32_t* colors,
+                            uint32_t* out, int count) {
+  for (int i = 0; i < count; i++) {
+    out[i] = colors[entries[i]];
+  }
+}
+
+#ifdef PIXELS_X86
+// Same idea as spread, with a lane per pixel: the row's planes are
+// copied across 8 lanes each, and comparing against the bit each lane keeps
+// gives all ones or zeros
+static void decode_sse2(const uint8_t* rows, uint8_t* out, int count) {
+  const __m128i bits = _mm_set1_epi64x((long long)ROW_BITS);
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i two = _mm_set1_epi8(2);
+
+  int row = 0;
+  for (; row + 2 <= count; row += 2) {
+    uint32_t data;
+    memcpy(&data, rows + row * 2, 4);
+    __m128i v = _mm_cvtsi32_si128((int)data); // lo0 hi0 lo1 hi1
+    v = _mm_unpacklo_epi8(v, v);
+    v = _mm_unpacklo_epi16(v, v);             // each byte 4 times
+    __m128i row0 = _mm_unpacklo_epi32(v, v);  // lo0 x8, hi0 x8
+    __m128i row1 = _mm_unpackhi_epi32(v, v);  // lo1 x8, hi1 x8
+
+    __m128i lo = _mm_unpacklo_epi64(row0, row1);
+    __m128i hi = _mm_unpackhi_epi64(row0, row1);
+    lo = _mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits);
+    hi = _mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits);
+    __m128i colors = _mm_or_si128(_mm_and_si128(lo, one), _mm_and_si128(hi, two));
+    _mm_storeu_si128((__m128i*)(out + row * 8), colors);
+  }
+  decode_portable(rows + row * 2, out + row * 8, count - row);
+}
+
+// Four rows at once. Both halves get all 8 bytes and a shuffle picks the
+// planes of two rows for each
+__attribute__((target("avx2")))
+static void decode_avx2(const uint8_t* rows, uint8_t* out, int count) {
+  const __m256i lo_pick = _mm256_setr_epi8(
+    0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2,
+    4, 4, 4, 4, 4, 4, 4, 4, 6, 6, 6, 6, 6, 6, 6, 6);
+  const __m256i hi_pick = _mm256_setr_epi8(
+    1, 1, 1, 1, 1, 1, 1, 1, 3, 3, 3, 3, 3, 3, 3, 3,
+    5, 5, 5, 5, 5, 5, 5, 5, 7, 7, 7, 7, 7, 7, 7, 7);
+  const __m256i bits = _mm256_set1_epi64x((long long)ROW_BITS);
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i two = _mm256_set1_epi8(2);
+
+  int row = 0;
+  for (; row + 4 <= count; row += 4) {
+    uint64_t data;
+    memcpy(&data, rows + row * 2, 8);
+    __m256i v = _mm256_set1_epi64x((long long)data);
+
+    __m256i lo = _mm256_shuffle_epi8(v, lo_pick);
+    __m256i hi = _mm256_shuffle_epi8(v, hi_pick);
+    lo = _mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits);
+    hi = _mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits);
+    __m256i colors = _mm256_or_si256(_mm256_and_si256(lo, one), _mm256_and_si256(hi, two));
+    _mm256_storeu_si256((__m256i*)(out + row * 8), colors);
+  }
+  decode_portable(rows + row * 2, out + row * 8, count - row);
+}
+
+// Eight pixels a gather
+__attribute__((target("avx2")))
+static void colorize_avx2(const uint8_t* entries, const uint32_t* colors,
+                          uint32_t* out, int count) {
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i indices = _mm_loadl_epi64((const __m128i*)(entries + i));
+    __m256i pixels = _mm256_i32gather_epi32((const int*)colors,
+                                            _mm256_cvtepu8_epi32(indices), 4);
+    _mm256_storeu_si256((__m256i*)(out + i), pixels);
+  }
+  colorize_scalar(entries + i, colors, out + i, count - i);
+}
+
+// AVX2 needs the cpu to have it and the os to save ymm registers
+static bool host_has_avx2(void) {
+  unsigned int a, b, c, d;
+  if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) || !(c & bit_AVX)) {
+    return false;
+  }
+  uint32_t xcr0, xcr0_high;
+  __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+  if ((xcr0 & 6) != 6) {
+    return false;
+  }
+  if (__get_cpuid_max(0, NULL) < 7) {
+    return false;
+  }
+  __cpuid_count(7, 0, a, b, c, d);
+  return b & bit_AVX2;
+}
+#endif
+
+static const pixels_kernels_t KERNELS[PIXELS_KERNEL_COUNT] = {
+  [PIXELS_SCALAR] = { "scalar", decode_scalar, colorize_scalar },
+  [PIXELS_PORTABLE] = { "portable", decode_portable, colorize_scalar },
+#ifdef PIXELS_X86
+  [PIXELS_SSE2] = { "sse2", decode_sse2, colorize_scalar },
+  [PIXELS_AVX2] = { "avx2", decode_avx2, colorize_avx2 },
+#endif
+};
+
+const pixels_kernels_t* pixels_kernels(pixels_kernel_t which) {
+  if (which >= PIXELS_KERNEL_COUNT || !KERNELS[which].decode) {
+    return NULL;
+  }
+#ifdef PIXELS_X86
+  if (which == PIXELS_AVX2 && !host_has_avx2()) {
+    return NULL;
+  }
+#endif
+  return &KERNELS[which];
+}
+
+const pixels_kernels_t* pixels_best(void) {
+  for (int which = PIXELS_KERNEL_COUNT - 1; which > PIXELS_SCALAR; which--) {
+    const pixels_kernels_t* kernels = pixels_kernels(which);
+    if (kernels) {
+      return kernels;
+    }
+  }
+  return &KERNELS[PIXELS_SCALAR];
+}
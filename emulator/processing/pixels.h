@@ -0,0 +1,39 @@
+#ifndef PIXELS_H
+#define PIXELS_H
+
+#include <stdint.h>
+
+// The two per pixel jobs of the ppu, as kernels picked for the host cpu at
+// runtime: untangling 2bpp tile rows into a color (0-3) per pixel, and
+// turning a line of palette entries into host pixels. Every kernel gives
+// the same output as the scalar one, see pixels.test.zig
+
+// rows holds count tile rows of two bytes, the low plane then the high
+// plane. out gets 8 colors per row, leftmost pixel first
+typedef void (*pixels_decode_fn)(const uint8_t* rows, uint8_t* out, int count);
+
+// out[i] = colors[entries[i]] for count pixels
+typedef void (*pixels_colorize_fn)(const uint8_t* entries, const uint32_t* colors,
+                                   uint32_t* out, int count);
+
+typedef enum {
+  PIXELS_SCALAR = 0, // a bit at a time, the reference
+  PIXELS_PORTABLE,   // 8 pixels at a time in a 64 bit register
+  PIXELS_SSE2,       // 16 pixels at a time, any x86-64
+  PIXELS_AVX2,       // 32 pixels at a time, colors with gathers
+  PIXELS_KERNEL_COUNT
+} pixels_kernel_t;
+
+typedef struct {
+  const char* name;
+  pixels_decode_fn decode;
+  pixels_colorize_fn colorize;
+} pixels_kernels_t;
+
+// A kernel set, or NULL if this build or host can't run it
+const pixels_kernels_t* pixels_kernels(pixels_kernel_t which);
+
+// The fastest set the host can run
+const pixels_kernels_t* pixels_best(void);
+
+#endif
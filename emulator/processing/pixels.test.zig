@@ -0,0 +1,76 @@
+const std = @import("std");
+const testing = std.testing;
+const c = @cImport({
+    @cInclude("processing/pixels.h");
+});
+
+// Every low/high plane byte pair, a row each
+var rows: [0x10000 * 2]u8 = undefined;
+var expected: [0x10000 * 8]u8 = undefined;
+var decoded: [0x10000 * 8]u8 = undefined;
+
+test "pixels - scalar decode puts the high plane in the high bit" {
+    const scalar = c.pixels_kernels(c.PIXELS_SCALAR);
+    var out: [8]u8 = undefined;
+    scalar.*.decode.?(&[_]u8{ 0x3C, 0x7E }, &out, 1);
+    try testing.expectEqualSlices(u8, &.{ 0, 2, 3, 3, 3, 3, 2, 0 }, &out);
+}
+
+test "pixels - every decode kernel matches scalar for all plane pairs" {
+    for (0..0x10000) |i| {
+        rows[i * 2] = @truncate(i);
+        rows[i * 2 + 1] = @truncate(i >> 8);
+    }
+    const scalar = c.pixels_kernels(c.PIXELS_SCALAR);
+    scalar.*.decode.?(&rows, &expected, 0x10000);
+
+    for (0..c.PIXELS_KERNEL_COUNT) |which| {
+        const kernels = c.pixels_kernels(@intCast(which));
+        if (kernels == null) {
+            continue;
+        }
+        @memset(&decoded, 0xAA);
+        kernels.*.decode.?(&rows, &decoded, 0x10000);
+        try testing.expectEqualSlices(u8, &expected, &decoded);
+
+        // Counts that leave rows over for the tail, from an odd row
+        @memset(&decoded, 0xAA);
+        kernels.*.decode.?(&rows[2], &decoded, 7);
+        try testing.expectEqualSlices(u8, expected[8..64], decoded[0..56]);
+        try testing.expect(decoded[56] == 0xAA);
+    }
+}
+
+test "pixels - every colorize kernel matches scalar" {
+    var colors: [64]u32 = undefined;
+    for (&colors, 0..) |*color, i| {
+        color.* = 0xFF000000 | @as(u32, @intCast(i)) * 0x030507;
+    }
+    var entries: [163]u8 = undefined;
+    var prng = std.Random.DefaultPrng.init(0x5EED);
+    for (&entries) |*entry| {
+        entry.* = prng.random().uintLessThan(u8, 64);
+    }
+
+    var want: [163]u32 = undefined;
+    for (entries, 0..) |entry, i| {
+        want[i] = colors[entry];
+    }
+
+    for (0..c.PIXELS_KERNEL_COUNT) |which| {
+        const kernels = c.pixels_kernels(@intCast(which));
+        if (kernels == null) {
+            continue;
+        }
+        var out = [_]u32{0} ** 163;
+        kernels.*.colorize.?(&entries, &colors, &out, @intCast(entries.len));
+        try testing.expectEqualSlices(u32, &want, &out);
+    }
+}
+
+test "pixels - the best kernel set can run here" {
+    const best = c.pixels_best();
+    try testing.expect(best != null);
+    try testing.expect(best.*.decode != null);
+    try testing.expect(best.*.colorize != null);
+}
@@ -0,0 +1,101 @@
+// Finding each line's sprites with the oam index against scanning all 40
+// sprites on every line, for a frame full of sprites
+// Run with `zig build bench -Doptimize=ReleaseFast`
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ppu.h"
+#include "../cartridge/cart.h"
+#include "../state/gb.h"
+
+#define FRAMES 20000
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// What draw_sprites did before the index, kept as the baseline
+static int scan_line(const uint8_t* oam, int ly, int height, uint8_t* found) {
+  int count = 0;
+  for (int i = 0; i < PPU_SPRITES && count < PPU_LINE_SPRITES; i++) {
+    int row = ly - (oam[i * 4] - 16);
+    if (row >= 0 && row < height) {
+      found[count++] = i;
+    }
+  }
+  for (int i = 1; i < count; i++) {
+    uint8_t sprite = found[i];
+    int j = i;
+    for (; j > 0 && oam[found[j - 1] * 4 + 1] > oam[sprite * 4 + 1]; j--) {
+      found[j] = found[j - 1];
+    }
+    found[j] = sprite;
+  }
+  return count;
+}
+
+static void report(const char* name, uint64_t elapsed) {
+  printf("%-24s %8.1f ns/frame\n", name, (double)elapsed / FRAMES);
+}
+
+int main(void) {
+  cart_t cart = {0};
+  cart.cart_type = ROM;
+  cart.size = 0x8000;
+  cart.rom_banks = 2;
+  cart.rom_bank_mask = 1;
+  cart.data = calloc(cart.size, 1);
+
+  gb_t* gb = gb_create(&cart);
+  if (!gb) {
+    fprintf(stderr, "gb_create failed\n");
+    return 1;
+  }
+
+  // Every sprite on screen, tall ones in rows like a busy shooter
+  srand(0x5EED);
+  for (int i = 0; i < PPU_SPRITES; i++) {
+    gb->mmu.oam[i * 4] = 16 + rand() % PPU_HEIGHT;
+    gb->mmu.oam[i * 4 + 1] = rand() % 168;
+  }
+  gb->mmu.io[IO_LCDC] = LCDC_LCD_ON | LCDC_OBJ_ON | LCDC_OBJ_TALL;
+
+  volatile uint32_t sink = 0;
+  uint8_t found[PPU_LINE_SPRITES];
+  uint64_t start = now_ns();
+  for (int f = 0; f < FRAMES; f++) {
+    for (int ly = 0; ly < PPU_HEIGHT; ly++) {
+      sink += scan_line(gb->mmu.oam, ly, 16, found);
+    }
+  }
+  report("scan every line", now_ns() - start);
+
+  // Oam changes every frame, as with an OAM DMA in each vblank
+  const uint8_t* sprites;
+  start = now_ns();
+  for (int f = 0; f < FRAMES; f++) {
+    ppu_oam_written(&gb->ppu);
+    for (int ly = 0; ly < PPU_HEIGHT; ly++) {
+      sink += ppu_line_sprites(gb, ly, &sprites);
+    }
+  }
+  report("index, rebuilt per frame", now_ns() - start);
+
+  start = now_ns();
+  for (int f = 0; f < FRAMES; f++) {
+    for (int ly = 0; ly < PPU_HEIGHT; ly++) {
+      sink += ppu_line_sprites(gb, ly, &sprites);
+    }
+  }
+  report("index, oam unchanged", now_ns() - start);
+
+  gb_destroy(gb);
+  free(cart.data);
+  return 0;
+}
@@ -1 +1,311 @@
-// Picture Processig
+// Picture Processing
+
+#include <string.h>
+#include "ppu.h"
+#include "../state/gb.h"
+
+// Bg map attributes (cgb, vram bank 1) and sprite attributes share bits
+#define ATTR_PALETTE 0x07     // cgb
+#define ATTR_BANK 0x08        // cgb
+#define ATTR_DMG_PALETTE 0x10 // OBP1 instead of OBP0
+#define ATTR_XFLIP 0x20
+#define ATTR_YFLIP 0x40
+#define ATTR_PRIORITY 0x80    // sprite behind bg colors 1-3, or bg over sprites
+
+// A line before colors go on
+typedef struct {
+  uint8_t entry[PPU_WIDTH]; // palette entry, see PPU_COLORS
+  uint8_t bg[PPU_WIDTH];    // bg/window color 0-3, ATTR_PRIORITY if it's over sprites
+} line_t;
+
+const uint8_t* ppu_tile_row(gb_t* gb, int bank, int tile, int row) {
+  ppu_t* ppu = &gb->ppu;
+  if (ppu->dirty[bank][tile]) {
+    ppu->kernels->decode(gb->mmu.vram_banks[bank] + tile * 16, ppu->tiles[bank][tile], 8);
+    ppu->dirty[bank][tile] = false;
+  }
+  return ppu->tiles[bank][tile] + row * 8;
+}
+
+// Draws bg or window tiles from a 32x32 map (an offset into vram) over the
+// line from pixel `from` on, starting at pixel (map_x, map_y) of the map
+static void draw_tiles(gb_t* gb, line_t* line, uint16_t map, int from,
+                       int map_x, int map_y) {
+  bool cgb = gb->cart->is_cgb;
+  bool unsigned_tiles = gb->mmu.io[IO_LCDC] & LCDC_TILE_UNSIGNED;
+  uint16_t map_row = map + (map_y >> 3) * 32;
+  const uint8_t* indices = gb->mmu.vram_banks[0] + map_row;
+  const uint8_t* attrs = gb->mmu.vram_banks[1] + map_row;
+
+  for (int x = from; x < PPU_WIDTH;) {
+    int col = (map_x >> 3) & 31;
+    uint8_t index = indices[col];
+    uint8_t attr = cgb ? attrs[col] : 0;
+    int tile = unsigned_tiles ? index : 256 + (int8_t)index;
+    int row = attr & ATTR_YFLIP ? 7 - (map_y & 7) : map_y & 7;
+    const uint8_t* pixels = ppu_tile_row(gb, attr & ATTR_BANK ? 1 : 0, tile, row);
+    uint8_t palette = (attr & ATTR_PALETTE) * 4;
+    uint8_t over = attr & ATTR_PRIORITY;
+
+    int px = map_x & 7;
+    map_x += 8 - px;
+    for (; px < 8 && x < PPU_WIDTH; px++, x++) {
+      uint8_t color = pixels[attr & ATTR_XFLIP ? 7 - px : px];
+      line->entry[x] = palette + color;
+      line->bg[x] = color | over;
+    }
+  }
+}
+
+// Buckets every sprite into the lines it's on. Like the hardware only the
+// first 10 in oam order on a line count. A dmg draws the one with the lower
+// X over the other (oam order on a tie), so its lines are kept sorted that
+// way, a cgb goes by oam order
+static void index_sprites(gb_t* gb, int height) {
+  ppu_t* ppu = &gb->ppu;
+  const uint8_t* oam = gb->mmu.oam;
+  bool cgb = gb->cart->is_cgb;
+
+  memset(ppu->line_sprite_count, 0, sizeof(ppu->line_sprite_count));
+  for (int i = 0; i < PPU_SPRITES; i++) {
+    int top = oam[i * 4] - 16;
+    int from = top < 0 ? 0 : top;
+    int to = top + height < PPU_HEIGHT ? top + height : PPU_HEIGHT;
+    uint8_t x = oam[i * 4 + 1];
+
+    for (int ly = from; ly < to; ly++) {
+      uint8_t* line = ppu->line_sprites[ly];
+      uint8_t* count = &ppu->line_sprite_count[ly];
+      if (*count == PPU_LINE_SPRITES) {
+        continue;
+      }
+      int j = (*count)++;
+      for (; !cgb && j > 0 && oam[line[j - 1] * 4 + 1] > x; j--) {
+        line[j] = line[j - 1];
+      }
+      line[j] = i;
+    }
+  }
+  ppu->sprite_height = height;
+  ppu->sprites_dirty = false;
+}
+
+int ppu_line_sprites(gb_t* gb, int ly, const uint8_t** sprites) {
+  ppu_t* ppu = &gb->ppu;
+  int height = gb->mmu.io[IO_LCDC] & LCDC_OBJ_TALL ? 16 : 8;
+  if (ppu->sprites_dirty || ppu->sprite_height != height) {
+    index_sprites(gb, height);
+  }
+  *sprites = ppu->line_sprites[ly];
+  return ppu->line_sprite_count[ly];
+}
+
+// The first sprite with a solid pixel somewhere owns it, even if it's behind
+// the bg there
+static void draw_sprites(gb_t* gb, line_t* line, int ly) {
+  mmu_t* mmu = &gb->mmu;
+  uint8_t lcdc = mmu->io[IO_LCDC];
+  bool cgb = gb->cart->is_cgb;
+  int height = lcdc & LCDC_OBJ_TALL ? 16 : 8;
+
+  const uint8_t* found;
+  int count = ppu_line_sprites(gb, ly, &found);
+
+  // With the cgb's master priority off sprites are always on top
+  bool bg_can_win = !cgb || (lcdc & LCDC_BG_ON);
+  bool owned[PPU_WIDTH] = { 0 };
+  for (int i = 0; i < count; i++) {
+    const uint8_t* sprite = &mmu->oam[found[i] * 4];
+    uint8_t attr = sprite[3];
+    int row = ly - (sprite[0] - 16);
+    if (attr & ATTR_YFLIP) {
+      row = height - 1 - row;
+    }
+    int tile = height == 16 ? (sprite[2] & 0xFE) | row >> 3 : sprite[2];
+    const uint8_t* pixels = ppu_tile_row(gb, cgb && (attr & ATTR_BANK) ? 1 : 0, tile, row & 7);
+    int palette = cgb ? attr & ATTR_PALETTE : (attr & ATTR_DMG_PALETTE ? 1 : 0);
+    uint8_t base = PPU_OBJ_COLORS + palette * 4;
+
+    int left = sprite[1] - 8;
+    for (int px = 0; px < 8; px++) {
+      int x = left + px;
+      if (x < 0 || x >= PPU_WIDTH || owned[x]) {
+        continue;
+      }
+      uint8_t color = pixels[attr & ATTR_XFLIP ? 7 - px : px];
+      if (!color) {
+        continue;
+      }
+      owned[x] = true;
+      uint8_t bg = line->bg[x];
+      if (bg_can_win && (bg & 3) && ((attr & ATTR_PRIORITY) || (bg & ATTR_PRIORITY))) {
+        continue;
+      }
+      line->entry[x] = base + color;
+    }
+  }
+}
+
+static void draw_line(gb_t* gb, int ly) {
+  ppu_t* ppu = &gb->ppu;
+  uint8_t* io = gb->mmu.io;
+  uint8_t lcdc = io[IO_LCDC];
+  bool cgb = gb->cart->is_cgb;
+  uint32_t* out = ppu->frame[ly];
+
+  if (!(lcdc & LCDC_LCD_ON)) {
+    for (int x = 0; x < PPU_WIDTH; x++) {
+      out[x] = PALETTE_WHITE;
+    }
+    return;
+  }
+
+  // A dmg with the bg off shows white whatever BGP says, and no window either
+  line_t line;
+  if (cgb || (lcdc & LCDC_BG_ON)) {
+    uint16_t bg_map = lcdc & LCDC_BG_MAP ? 0x1C00 : 0x1800;
+    draw_tiles(gb, &line, bg_map, 0, io[IO_SCX], (ly + io[IO_SCY]) & 0xFF);
+
+    int wx = io[IO_WX] - 7;
+    if ((lcdc & LCDC_WIN_ON) && ly >= io[IO_WY] && wx < PPU_WIDTH) {
+      uint16_t win_map = lcdc & LCDC_WIN_MAP ? 0x1C00 : 0x1800;
+      draw_tiles(gb, &line, win_map, wx < 0 ? 0 : wx, wx < 0 ? -wx : 0, ppu->window_line);
+      ppu->window_line++;
+    }
+  }
+  else {
+    memset(line.entry, PPU_DMG_BLANK, sizeof(line.entry));
+    memset(line.bg, 0, sizeof(line.bg));
+  }
+
+  if (lcdc & LCDC_OBJ_ON) {
+    draw_sprites(gb, &line, ly);
+  }
+
+  ppu->kernels->colorize(line.entry, ppu->colors, out, PPU_WIDTH);
+}
+
+// Puts the mode and LY == LYC in STAT. The STAT interrupt sources share one
+// line, it's raised when the line comes on, not again while any stays on.
+// With the lcd off the line stays down
+static void set_mode(gb_t* gb, uint8_t mode) {
+  ppu_t* ppu = &gb->ppu;
+  uint8_t* io = gb->mmu.io;
+  uint8_t stat = (io[IO_STAT] & ~(STAT_MODE | STAT_LYC_EQUAL)) | mode;
+  if (io[IO_LY] == io[IO_LYC]) {
+    stat |= STAT_LYC_EQUAL;
+  }
+  io[IO_STAT] = stat;
+  ppu->mode = mode;
+
+  bool line = ((stat & STAT_LYC_INT) && (stat & STAT_LYC_EQUAL)) ||
+              ((stat & STAT_HBLANK_INT) && mode == PPU_MODE_HBLANK) ||
+              ((stat & STAT_VBLANK_INT) && mode == PPU_MODE_VBLANK) ||
+              ((stat & STAT_OAM_INT) && mode == PPU_MODE_OAM);
+  line = line && (io[IO_LCDC] & LCDC_LCD_ON);
+  if (line && !ppu->stat_line) {
+    mmu_request_interrupt(&gb->mmu, INT_STAT);
+  }
+  ppu->stat_line = line;
+}
+
+// Line 0 in oam search from gb->cycles
+static void start_lines(gb_t* gb) {
+  gb->mmu.io[IO_LY] = 0;
+  gb->ppu.stat_line = false;
+  set_mode(gb, PPU_MODE_OAM);
+  scheduler_set(&gb->sched, SCHED_PPU_LINE, gb->cycles + PPU_CYCLES_PER_LINE);
+  scheduler_set(&gb->sched, SCHED_PPU_MODE, gb->cycles + PPU_DRAW_START);
+}
+
+void ppu_init(gb_t* gb) {
+  ppu_t* ppu = &gb->ppu;
+  ppu->kernels = pixels_best();
+  memset(ppu->dirty, true, sizeof(ppu->dirty));
+  ppu->drawn_lines = 0;
+  ppu->window_line = 0;
+  ppu->sprites_dirty = true;
+
+  // Cgb palettes are left white, like the boot rom leaves them
+  memset(ppu->palettes, 0xFF, sizeof(ppu->palettes));
+  ppu->lut = palette_lut(false);
+  palette_refresh(gb);
+
+  // Lcd on with the bg from 0x8000, like the boot rom leaves it
+  gb->mmu.io[IO_LCDC] = LCDC_LCD_ON | LCDC_TILE_UNSIGNED | LCDC_BG_ON;
+  start_lines(gb);
+}
+
+void ppu_lcd_switched(gb_t* gb) {
+  ppu_t* ppu = &gb->ppu;
+  ppu->drawn_lines = 0;
+  ppu->window_line = 0;
+  if (gb->mmu.io[IO_LCDC] & LCDC_LCD_ON) {
+    start_lines(gb);
+    return;
+  }
+
+  // The screen goes white, and stays that way with no lines to draw
+  while (ppu->drawn_lines < PPU_HEIGHT) {
+    draw_line(gb, ppu->drawn_lines++);
+  }
+  scheduler_cancel(&gb->sched, SCHED_PPU_LINE);
+  scheduler_cancel(&gb->sched, SCHED_PPU_MODE);
+  gb->mmu.io[IO_LY] = 0;
+  set_mode(gb, PPU_MODE_HBLANK);
+}
+
+void ppu_catch_up(gb_t* gb) {
+  ppu_t* ppu = &gb->ppu;
+  if (!(gb->mmu.io[IO_LCDC] & LCDC_LCD_ON)) {
+    return;
+  }
+  int ly = gb->mmu.io[IO_LY];
+  int over = PPU_VBLANK_LINE;
+  if (ly < PPU_VBLANK_LINE) {
+    // The current line is out once drawing it is done, in hblank any change
+    // is for the next one
+    uint64_t line_start = gb->sched.at[SCHED_PPU_LINE] - PPU_CYCLES_PER_LINE;
+    over = gb->cycles - line_start >= PPU_HBLANK_START ? ly + 1 : ly;
+  }
+  while (ppu->drawn_lines < over) {
+    draw_line(gb, ppu->drawn_lines++);
+  }
+}
+
+void ppu_line(gb_t* gb, uint64_t at) {
+  uint8_t* io = gb->mmu.io;
+
+  io[IO_LY] = (io[IO_LY] + 1) % PPU_LINES;
+  if (io[IO_LY] == 0) {
+    gb->ppu.drawn_lines = 0;
+    gb->ppu.window_line = 0;
+  }
+  else if (io[IO_LY] == PPU_VBLANK_LINE) {
+    ppu_catch_up(gb);
+    mmu_request_interrupt(&gb->mmu, INT_VBLANK);
+  }
+
+  if (io[IO_LY] < PPU_VBLANK_LINE) {
+    set_mode(gb, PPU_MODE_OAM);
+    scheduler_set(&gb->sched, SCHED_PPU_MODE, at + PPU_DRAW_START);
+  }
+  else {
+    set_mode(gb, PPU_MODE_VBLANK);
+  }
+  scheduler_set(&gb->sched, SCHED_PPU_LINE, at + PPU_CYCLES_PER_LINE);
+}
+
+void ppu_stat_written(gb_t* gb) {
+  set_mode(gb, gb->ppu.mode);
+}
+
+void ppu_mode(gb_t* gb, uint64_t at) {
+  if (gb->ppu.mode == PPU_MODE_OAM) {
+    set_mode(gb, PPU_MODE_DRAW);
+    scheduler_set(&gb->sched, SCHED_PPU_MODE, at - PPU_DRAW_START + PPU_HBLANK_START);
+  }
+  else {
+    set_mode(gb, PPU_MODE_HBLANK);
+  }
+}
@@ -0,0 +1,140 @@
+#ifndef PPU_H
+#define PPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../memory/mmu.h"
+#include "palette.h"
+#include "pixels.h"
+
+struct gb;
+
+#define PPU_CYCLES_PER_LINE 456
+#define PPU_LINES 154 // 144 visible, then vblank
+#define PPU_VBLANK_LINE 144
+#define PPU_DRAW_START 80     // into a line, oam search is over and drawing starts
+#define PPU_HBLANK_START 252 // into a line, after oam search and the shortest draw
+
+#define PPU_WIDTH 160
+#define PPU_HEIGHT 144
+#define PPU_TILES 384         // per vram bank, 0x8000-0x97FF
+#define PPU_TILE_DATA 0x1800  // bytes of tile data at the start of vram
+#define PPU_SPRITES 40        // in oam, 4 bytes each
+#define PPU_LINE_SPRITES 10   // most sprites drawn on one line
+
+#define IO_LCDC 0x40
+#define IO_STAT 0x41
+#define IO_SCY 0x42
+#define IO_SCX 0x43
+#define IO_LY 0x44 // current line, offset into the io registers
+#define IO_LYC 0x45
+#define IO_BGP 0x47
+#define IO_OBP0 0x48
+#define IO_OBP1 0x49
+#define IO_WY 0x4A
+#define IO_WX 0x4B
+#define INT_VBLANK 0x01
+#define INT_STAT 0x02
+
+#define LCDC_BG_ON 0x01       // dmg: bg and window on, cgb: bg priority on
+#define LCDC_OBJ_ON 0x02
+#define LCDC_OBJ_TALL 0x04    // 8x16 sprites
+#define LCDC_BG_MAP 0x08      // bg map at 0x9C00 instead of 0x9800
+#define LCDC_TILE_UNSIGNED 0x10 // bg/window tiles from 0x8000 instead of 0x9000
+#define LCDC_WIN_ON 0x20
+#define LCDC_WIN_MAP 0x40
+#define LCDC_LCD_ON 0x80
+
+// STAT mode, bits 0-1
+#define PPU_MODE_HBLANK 0
+#define PPU_MODE_VBLANK 1
+#define PPU_MODE_OAM 2  // oam search
+#define PPU_MODE_DRAW 3
+
+#define STAT_MODE 0x03
+#define STAT_LYC_EQUAL 0x04 // LY == LYC
+#define STAT_HBLANK_INT 0x08
+#define STAT_VBLANK_INT 0x10
+#define STAT_OAM_INT 0x20
+#define STAT_LYC_INT 0x40
+
+// Palette entries a line is composed in, 4 colors to a palette. Bg uses
+// 0-31 (palette 0 only on a dmg), sprites 32-63 (OBP0 and OBP1 on a dmg)
+#define PPU_OBJ_COLORS 32
+#define PPU_COLORS 64
+#define PPU_DMG_BLANK 4 // always white, what a dmg shows with the bg off
+
+// Lines are drawn from tiles already decoded to one byte per pixel, so the
+// 2bpp planes are only untangled once per vram write rather than per pixel
+// per frame. A write to tile data marks the tile, see ppu_vram_written.
+//
+// Drawing lags behind the line timing: lines that are over are only drawn
+// when something they're drawn from is about to change (vram, oam, the lcd
+// and palette registers, see ppu_catch_up), at vblank, or when asked for,
+// and then all of them in one go
+typedef struct {
+  uint8_t tiles[MMU_VRAM_BANKS][PPU_TILES][64]; // color 0-3 per pixel, rows of 8
+  bool dirty[MMU_VRAM_BANKS][PPU_TILES];        // tiles to decode before use
+  uint8_t drawn_lines;                          // lines of this frame in `frame` so far
+  uint8_t window_line;                          // window lines drawn this frame
+  uint8_t mode;                                 // PPU_MODE_*, mirrored in STAT
+  bool stat_line;                               // an enabled STAT source is on
+  uint32_t colors[PPU_COLORS];                  // host pixel for each palette entry
+  uint8_t palettes[2][PALETTE_BYTES];           // cgb bg and sprite palette ram
+  const uint32_t* lut;                          // RGB555 to host pixels, see palette_lut
+  uint32_t frame[PPU_HEIGHT][PPU_WIDTH];        // 0xAARRGGBB
+  const pixels_kernels_t* kernels;              // decode and colorize, pixels_best
+
+  // Sprites on each line in drawing order, rebuilt when oam or the sprite
+  // size has changed since, see ppu_line_sprites
+  uint8_t line_sprites[PPU_HEIGHT][PPU_LINE_SPRITES];
+  uint8_t line_sprite_count[PPU_HEIGHT];
+  uint8_t sprite_height; // 8 or 16, what the index was built for
+  bool sprites_dirty;
+} ppu_t;
+
+// Starts line timing from gb->cycles, with LY at 0
+void ppu_init(struct gb* gb);
+
+// LCDC.7 changed. Off stops line timing with LY at 0 in hblank, no PPU
+// interrupts and a white frame until it's on again. On starts line timing
+// from gb->cycles at line 0
+void ppu_lcd_switched(struct gb* gb);
+
+// SCHED_PPU_LINE handler, moves LY on and raises vblank when it reaches 144,
+// with the frame drawn to the end. Only scheduled while the lcd is on
+void ppu_line(struct gb* gb, uint64_t at);
+
+// SCHED_PPU_MODE handler, oam search to drawing to hblank on a visible line
+void ppu_mode(struct gb* gb, uint64_t at);
+
+// STAT or LYC was written, LY == LYC and the STAT interrupt are checked again
+void ppu_stat_written(struct gb* gb);
+
+// Draws the lines of this frame that are over (the current one too once
+// it's in hblank) and not drawn yet. Called before anything they're drawn
+// from changes, and by frontends that want the frame part way through
+void ppu_catch_up(struct gb* gb);
+
+// Marks the tile holding a vram offset for decoding, offsets past the tile
+// data are maps and need nothing
+static inline void ppu_vram_written(ppu_t* ppu, int bank, uint16_t offset) {
+  if (offset < PPU_TILE_DATA) {
+    ppu->dirty[bank][offset >> 4] = true;
+  }
+}
+
+// Oam changed (a write or OAM DMA), the sprite index is built again on the
+// next line drawn
+static inline void ppu_oam_written(ppu_t* ppu) {
+  ppu->sprites_dirty = true;
+}
+
+// Sprites (oam indices) on a visible line in the order they're drawn, at
+// most PPU_LINE_SPRITES. Returns how many
+int ppu_line_sprites(struct gb* gb, int ly, const uint8_t** sprites);
+
+// Decoded row (0-7) of a tile in a vram bank, decoding it first if dirty
+const uint8_t* ppu_tile_row(struct gb* gb, int bank, int tile, int row);
+
+#endif
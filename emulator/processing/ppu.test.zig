@@ -0,0 +1,227 @@
+const std = @import("std");
+const testing = std.testing;
+const test_gb = @import("test_gb");
+const c = test_gb.c;
+
+test "ppu - tile data writes mark the tile for decoding" {
+    // loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+
+    _ = c.ppu_tile_row(gb, 0, 1, 0);
+    try testing.expect(!gb.*.ppu.dirty[0][1]);
+
+    // Tile 1, row 0
+    c.mmu_write(&gb.*.mmu, 0x8010, 0x3C);
+    c.mmu_write(&gb.*.mmu, 0x8011, 0x7E);
+    try testing.expect(gb.*.ppu.dirty[0][1]);
+    const row = c.ppu_tile_row(gb, 0, 1, 0);
+    try testing.expectEqualSlices(u8, &.{ 0, 2, 3, 3, 3, 3, 2, 0 }, row[0..8]);
+    try testing.expect(!gb.*.ppu.dirty[0][1]);
+}
+
+test "ppu - a line is drawn from the bg map with sprites over it" {
+    // loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    const mmu = &gb.*.mmu;
+
+    // Bg of tile 1, colors 1 1 1 1 0 0 0 0 on row 0
+    c.mmu_write(mmu, 0x8010, 0xF0);
+    for (0..0x400) |i| {
+        c.mmu_write(mmu, @intCast(0x9800 + i), 1);
+    }
+    // A color 3 sprite over the first tile, behind bg colors 1-3
+    c.mmu_write(mmu, 0x8020, 0xFF);
+    c.mmu_write(mmu, 0x8021, 0xFF);
+    @memcpy(mmu.*.oam[0..4], &[_]u8{ 16, 8, 2, 0x80 });
+
+    c.mmu_write(mmu, 0xFF47, 0xE4);
+    c.mmu_write(mmu, 0xFF48, 0xE4);
+    mmu.*.io[c.IO_LCDC] = c.LCDC_LCD_ON | c.LCDC_TILE_UNSIGNED | c.LCDC_OBJ_ON | c.LCDC_BG_ON;
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE);
+    c.ppu_catch_up(gb);
+
+    const line = gb.*.ppu.frame[0];
+    try testing.expect(line[0] == 0xFFAAAAAA);
+    try testing.expect(line[3] == 0xFFAAAAAA);
+    try testing.expect(line[4] == 0xFF000000);
+    try testing.expect(line[7] == 0xFF000000);
+    try testing.expect(line[8] == 0xFFAAAAAA);
+    try testing.expect(line[12] == 0xFFFFFFFF);
+}
+
+test "ppu - a dmg with the bg off shows white, not BGP color 0" {
+    // loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    const mmu = &gb.*.mmu;
+
+    c.mmu_write(mmu, 0xFF47, 0xFF);
+    c.mmu_write(mmu, 0xFF40, c.LCDC_LCD_ON);
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE);
+    c.ppu_catch_up(gb);
+    try testing.expect(gb.*.ppu.frame[0][0] == c.PALETTE_WHITE);
+    try testing.expect(gb.*.ppu.frame[0][c.PPU_WIDTH - 1] == c.PALETTE_WHITE);
+}
+
+test "ppu - a scroll written in hblank is for the next line" {
+    // loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    const mmu = &gb.*.mmu;
+
+    // Bg of tile 1, colors 1 1 1 1 0 0 0 0 on every row
+    for (0..8) |row| {
+        c.mmu_write(mmu, @intCast(0x8010 + row * 2), 0xF0);
+    }
+    for (0..0x400) |i| {
+        c.mmu_write(mmu, @intCast(0x9800 + i), 1);
+    }
+    c.mmu_write(mmu, 0xFF47, 0xE4);
+    c.mmu_write(mmu, 0xFF40, c.LCDC_LCD_ON | c.LCDC_TILE_UNSIGNED | c.LCDC_BG_ON);
+
+    // Line 0 is out by hblank, so it keeps the old scroll
+    _ = c.cpu_run_cycles(gb, c.PPU_HBLANK_START + 40);
+    try testing.expect(gb.*.mmu.io[c.IO_LY] == 0);
+    c.mmu_write(mmu, 0xFF43, 4);
+    try testing.expect(gb.*.ppu.drawn_lines == 1);
+
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE);
+    c.ppu_catch_up(gb);
+    try testing.expect(gb.*.ppu.frame[0][0] == 0xFFAAAAAA);
+    try testing.expect(gb.*.ppu.frame[1][0] == 0xFFFFFFFF);
+}
+
+test "ppu - the sprite index follows oam writes" {
+    // loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    const mmu = &gb.*.mmu;
+
+    // Two sprites on lines 0-7, the second further left so a dmg draws it first
+    for ([_]u8{ 16, 50, 0, 0, 16, 20, 0, 0 }, 0..) |byte, i| {
+        c.mmu_write(mmu, @intCast(0xFE00 + i), byte);
+    }
+    var sprites: [*c]const u8 = undefined;
+    try testing.expect(c.ppu_line_sprites(gb, 0, &sprites) == 2);
+    try testing.expect(sprites[0] == 1 and sprites[1] == 0);
+    try testing.expect(c.ppu_line_sprites(gb, 8, &sprites) == 0);
+
+    // Moving one down takes it off line 0
+    c.mmu_write(mmu, 0xFE00, 24);
+    try testing.expect(c.ppu_line_sprites(gb, 0, &sprites) == 1);
+    try testing.expect(c.ppu_line_sprites(gb, 8, &sprites) == 1);
+    try testing.expect(sprites[0] == 0);
+}
+
+test "ppu - lines already over are drawn with the registers they had" {
+    // loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    const mmu = &gb.*.mmu;
+
+    // Bg of tile 1, colors 1 1 1 1 0 0 0 0 on every row
+    for (0..8) |row| {
+        c.mmu_write(mmu, @intCast(0x8010 + row * 2), 0xF0);
+    }
+    for (0..0x400) |i| {
+        c.mmu_write(mmu, @intCast(0x9800 + i), 1);
+    }
+    c.mmu_write(mmu, 0xFF47, 0xE4);
+    c.mmu_write(mmu, 0xFF40, c.LCDC_LCD_ON | c.LCDC_TILE_UNSIGNED | c.LCDC_BG_ON);
+
+    // Nothing is drawn until something it's drawn from changes
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE);
+    try testing.expect(gb.*.ppu.drawn_lines == 0);
+
+    // Scrolling on line 1 leaves line 0 as it was
+    c.mmu_write(mmu, 0xFF43, 4);
+    try testing.expect(gb.*.ppu.drawn_lines == 1);
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE);
+    c.ppu_catch_up(gb);
+    try testing.expect(gb.*.ppu.drawn_lines == 2);
+    try testing.expect(gb.*.ppu.frame[0][0] == 0xFFAAAAAA);
+    try testing.expect(gb.*.ppu.frame[1][0] == 0xFFFFFFFF);
+
+    // Vblank finishes the frame
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE * (c.PPU_VBLANK_LINE - 2));
+    try testing.expect(gb.*.ppu.drawn_lines == c.PPU_HEIGHT);
+}
+
+test "ppu - STAT follows the mode through a line and LY == LYC raises its interrupt" {
+    // loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    const mmu = &gb.*.mmu;
+
+    try testing.expect(c.mmu_read(mmu, 0xFF41) & c.STAT_MODE == c.PPU_MODE_OAM);
+    _ = c.cpu_run_cycles(gb, c.PPU_DRAW_START + 20);
+    try testing.expect(c.mmu_read(mmu, 0xFF41) & c.STAT_MODE == c.PPU_MODE_DRAW);
+    _ = c.cpu_run_cycles(gb, c.PPU_HBLANK_START - c.PPU_DRAW_START);
+    try testing.expect(c.mmu_read(mmu, 0xFF41) & c.STAT_MODE == c.PPU_MODE_HBLANK);
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE - c.PPU_HBLANK_START);
+    try testing.expect(gb.*.mmu.io[c.IO_LY] == 1);
+    try testing.expect(c.mmu_read(mmu, 0xFF41) & c.STAT_MODE == c.PPU_MODE_OAM);
+
+    // Only the enabled source raises it
+    c.mmu_write(mmu, 0xFF45, 2);
+    c.mmu_write(mmu, 0xFF41, c.STAT_LYC_INT);
+    c.mmu_write(mmu, 0xFF0F, 0);
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE);
+    try testing.expect(gb.*.mmu.io[c.IO_LY] == 2);
+    try testing.expect(c.mmu_read(mmu, 0xFF41) & c.STAT_LYC_EQUAL != 0);
+    try testing.expect(gb.*.mmu.io[c.IO_IF] & c.INT_STAT != 0);
+
+    c.mmu_write(mmu, 0xFF0F, 0);
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE * (c.PPU_VBLANK_LINE - 2));
+    try testing.expect(c.mmu_read(mmu, 0xFF41) & (c.STAT_MODE | c.STAT_LYC_EQUAL) == c.PPU_MODE_VBLANK);
+    try testing.expect(gb.*.mmu.io[c.IO_IF] & c.INT_STAT == 0);
+}
+
+test "ppu - LY and the STAT mode bits are read only, LYC writes compare at once" {
+    // loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    const mmu = &gb.*.mmu;
+
+    c.mmu_write(mmu, 0xFF44, 0x55);
+    try testing.expect(c.mmu_read(mmu, 0xFF44) == 0);
+
+    c.mmu_write(mmu, 0xFF45, 1);
+    c.mmu_write(mmu, 0xFF41, 0xFF);
+    try testing.expect(c.mmu_read(mmu, 0xFF41) == 0xF8 | c.PPU_MODE_OAM);
+
+    // Matching LY raises it straight away. With every source enabled the
+    // line is already on from oam search, so only LYC is left on first
+    c.mmu_write(mmu, 0xFF41, c.STAT_LYC_INT);
+    c.mmu_write(mmu, 0xFF0F, 0);
+    c.mmu_write(mmu, 0xFF45, 0);
+    try testing.expect(c.mmu_read(mmu, 0xFF41) & c.STAT_LYC_EQUAL != 0);
+    try testing.expect(gb.*.mmu.io[c.IO_IF] & c.INT_STAT != 0);
+}
+
+test "ppu - with the lcd off LY stays at 0 and no vblank or STAT is raised" {
+    // loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+    const mmu = &gb.*.mmu;
+
+    c.mmu_write(mmu, 0xFF40, 0);
+    c.mmu_write(mmu, 0xFF41, c.STAT_HBLANK_INT | c.STAT_VBLANK_INT | c.STAT_OAM_INT);
+    c.mmu_write(mmu, 0xFF0F, 0);
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE * c.PPU_LINES * 2);
+    try testing.expect(gb.*.mmu.io[c.IO_LY] == 0);
+    try testing.expect(c.mmu_read(mmu, 0xFF41) & c.STAT_MODE == c.PPU_MODE_HBLANK);
+    try testing.expect(gb.*.mmu.io[c.IO_IF] & (c.INT_VBLANK | c.INT_STAT) == 0);
+    try testing.expect(gb.*.ppu.frame[0][0] == c.PALETTE_WHITE);
+
+    // On again, line 0 starts from the write
+    c.mmu_write(mmu, 0xFF41, 0);
+    c.mmu_write(mmu, 0xFF40, c.LCDC_LCD_ON);
+    _ = c.cpu_run_cycles(gb, c.PPU_HBLANK_START);
+    try testing.expect(gb.*.mmu.io[c.IO_LY] == 0);
+    _ = c.cpu_run_cycles(gb, c.PPU_CYCLES_PER_LINE * c.PPU_VBLANK_LINE - c.PPU_HBLANK_START);
+    try testing.expect(gb.*.mmu.io[c.IO_LY] == c.PPU_VBLANK_LINE);
+    try testing.expect(gb.*.mmu.io[c.IO_IF] & c.INT_VBLANK != 0);
+}
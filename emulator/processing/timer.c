@@ -0,0 +1,135 @@
+// Timer
+
+#include "timer.h"
+#include "../state/gb.h"
+
+// Counter bit whose falling edge ticks TIMA, by the low bits of TAC
+static const uint8_t TAC_BIT[4] = { 9, 3, 5, 7 };
+
+static uint64_t counter(gb_timer_t* timer, uint64_t at) {
+  return at - timer->div_base;
+}
+
+static bool enabled(gb_t* gb) {
+  return gb->mmu.io[IO_TAC] & TAC_ENABLE;
+}
+
+static int tick_shift(gb_t* gb) {
+  return TAC_BIT[gb->mmu.io[IO_TAC] & 3] + 1;
+}
+
+// Adds ticks to TIMA, reloading from TMA on every overflow. The interrupt is
+// left to timer_overflow, which runs at the cycle the overflow happened
+static void add_ticks(gb_t* gb, uint64_t ticks) {
+  gb_timer_t* timer = &gb->timer;
+  uint64_t total = timer->tima + ticks;
+  if (total > 0xFF) {
+    uint8_t tma = gb->mmu.io[IO_TMA];
+    total = tma + (total - 0x100) % (0x100 - tma);
+  }
+  timer->tima = (uint8_t)total;
+}
+
+// Brings TIMA up to cycle at, counting the falling edges since tima_at
+static void sync(gb_t* gb, uint64_t at) {
+  gb_timer_t* timer = &gb->timer;
+  if (at <= timer->tima_at) {
+    return;
+  }
+  if (enabled(gb)) {
+    int shift = tick_shift(gb);
+    add_ticks(gb, (counter(timer, at) >> shift) - (counter(timer, timer->tima_at) >> shift));
+  }
+  timer->tima_at = at;
+}
+
+// The falling edge that takes TIMA past 0xFF, if the timer is running
+static void schedule(gb_t* gb) {
+  gb_timer_t* timer = &gb->timer;
+  if (!enabled(gb)) {
+    scheduler_cancel(&gb->sched, SCHED_TIMER);
+    return;
+  }
+
+  int shift = tick_shift(gb);
+  uint64_t edges = 0x100 - timer->tima;
+  uint64_t last = counter(timer, timer->tima_at) >> shift;
+  scheduler_set(&gb->sched, SCHED_TIMER, timer->div_base + ((last + edges) << shift));
+}
+
+// Resetting DIV or changing TAC can pull the selected bit low, which ticks
+// TIMA the same as the counter moving on would
+static void falling_edge(gb_t* gb) {
+  gb_timer_t* timer = &gb->timer;
+  if (!enabled(gb)) {
+    return;
+  }
+  int bit = TAC_BIT[gb->mmu.io[IO_TAC] & 3];
+  if ((counter(timer, gb->cycles) >> bit) & 1) {
+    if (timer->tima == 0xFF) {
+      mmu_request_interrupt(&gb->mmu, INT_TIMER);
+    }
+    add_ticks(gb, 1);
+  }
+}
+
+void timer_init(gb_t* gb) {
+  gb->timer.div_base = gb->cycles - TIMER_DIV_AFTER_BOOT;
+  gb->timer.tima_at = gb->cycles;
+  gb->timer.tima = 0;
+  gb->mmu.io[IO_TMA] = 0;
+  gb->mmu.io[IO_TAC] = 0xF8;
+  scheduler_cancel(&gb->sched, SCHED_TIMER);
+}
+
+uint8_t timer_read(gb_t* gb, uint8_t reg) {
+  gb_timer_t* timer = &gb->timer;
+  switch (reg) {
+  case IO_DIV:
+    return (uint8_t)(counter(timer, gb->cycles) >> 8);
+  case IO_TIMA:
+    sync(gb, gb->cycles);
+    return timer->tima;
+  default:
+    return gb->mmu.io[reg];
+  }
+}
+
+void timer_write(gb_t* gb, uint8_t reg, uint8_t data) {
+  gb_timer_t* timer = &gb->timer;
+  sync(gb, gb->cycles);
+
+  switch (reg) {
+  case IO_DIV:
+    falling_edge(gb);
+    timer->div_base = gb->cycles;
+    break;
+  case IO_TIMA:
+    timer->tima = data;
+    break;
+  case IO_TMA:
+    gb->mmu.io[IO_TMA] = data;
+    break;
+  case IO_TAC: {
+    // Turning it off, or moving to a bit that's low, is an edge if the old
+    // bit was high
+    uint8_t old = gb->mmu.io[IO_TAC];
+    int old_bit = TAC_BIT[old & 3];
+    int new_bit = TAC_BIT[data & 3];
+    bool was_high = (old & TAC_ENABLE) && ((counter(timer, gb->cycles) >> old_bit) & 1);
+    bool is_high = (data & TAC_ENABLE) && ((counter(timer, gb->cycles) >> new_bit) & 1);
+    if (was_high && !is_high) {
+      falling_edge(gb);
+    }
+    gb->mmu.io[IO_TAC] = 0xF8 | data;
+    break;
+  }
+  }
+  schedule(gb);
+}
+
+void timer_overflow(gb_t* gb, uint64_t at) {
+  sync(gb, at);
+  mmu_request_interrupt(&gb->mmu, INT_TIMER);
+  schedule(gb);
+}
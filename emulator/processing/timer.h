@@ -0,0 +1,39 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+struct gb;
+
+// DIV and TIMA aren't counted up as the cpu runs. DIV is the top byte of a
+// 16 bit counter that runs at the t-cycle rate, so it's worked out from
+// gb->cycles when read, and TIMA is caught up from the counter's falling
+// edges when it's read or written. The only thing scheduled is the next
+// overflow, for the interrupt
+
+#define IO_DIV 0x04
+#define IO_TIMA 0x05
+#define IO_TMA 0x06
+#define IO_TAC 0x07
+#define INT_TIMER 0x04
+
+#define TAC_ENABLE 0x04
+#define TIMER_DIV_AFTER_BOOT 0xABCC // internal counter as the dmg boot rom leaves it
+
+typedef struct {
+  uint64_t div_base; // gb->cycles when the internal counter was last 0
+  uint64_t tima_at;  // gb->cycles tima was last caught up to
+  uint8_t tima;
+} gb_timer_t;
+
+// Starts the counter from the post boot value, with the timer stopped
+void timer_init(struct gb* gb);
+
+// Reads and writes of 0xFF04-0xFF07, address is the offset into the io registers
+uint8_t timer_read(struct gb* gb, uint8_t reg);
+void timer_write(struct gb* gb, uint8_t reg, uint8_t data);
+
+// SCHED_TIMER handler, raises the timer interrupt and schedules the next one
+void timer_overflow(struct gb* gb, uint64_t at);
+
+#endif
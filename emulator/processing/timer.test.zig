@@ -0,0 +1,38 @@
+const std = @import("std");
+const testing = std.testing;
+const test_gb = @import("test_gb");
+const c = test_gb.c;
+
+test "timer - DIV follows the cycle counter and resets on write" {
+    // loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+
+    _ = c.cpu_run_cycles(gb, 10000);
+    const counter = gb.*.cycles + c.TIMER_DIV_AFTER_BOOT;
+    try testing.expect(c.mmu_read(&gb.*.mmu, 0xFF04) == @as(u8, @truncate(counter >> 8)));
+
+    c.mmu_write(&gb.*.mmu, 0xFF04, 0x55);
+    try testing.expect(c.mmu_read(&gb.*.mmu, 0xFF04) == 0);
+    _ = c.cpu_run_cycles(gb, 300);
+    try testing.expect(c.mmu_read(&gb.*.mmu, 0xFF04) == 1);
+}
+
+test "timer - TIMA overflow reloads TMA and raises the interrupt" {
+    // LD A, F0; LDH (TMA), A; LDH (TIMA), A; LD A, 05; LDH (TAC), A; loop: JR loop
+    const gb = test_gb.create(.{}, &.{ 0x3E, 0xF0, 0xE0, 0x06, 0xE0, 0x05, 0x3E, 0x05, 0xE0, 0x07, 0x18, 0xFE });
+    defer c.gb_destroy(gb);
+
+    for (0..5) |_| {
+        _ = c.cpu_step(gb);
+    }
+    try testing.expect(gb.*.mmu.io[c.IO_IF] & c.INT_TIMER == 0);
+    try testing.expect(gb.*.sched.at[c.SCHED_TIMER] != c.SCHED_NEVER);
+
+    // 16 ticks of 16 cycles each
+    _ = c.cpu_run_cycles(gb, 16 * 16 + 16);
+    try testing.expect(gb.*.mmu.io[c.IO_IF] & c.INT_TIMER != 0);
+    const tima = c.mmu_read(&gb.*.mmu, 0xFF05);
+    try testing.expect(tima >= 0xF0 and tima <= 0xF3);
+    try testing.expect(gb.*.sched.at[c.SCHED_TIMER] > gb.*.cycles);
+}
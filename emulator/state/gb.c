@@ -0,0 +1,125 @@
+#define _DEFAULT_SOURCE // clock_gettime under -std=c11
+
+#include <stdlib.h>
+#include <string.h>
+#include "gb.h"
+#include "../cpu/dynarec.h"
+#include "../processing/dma.h"
+#include "../processing/ppu.h"
+#include "../processing/timer.h"
+#include "../util/clock.h"
+
+size_t gb_arena_size(const cart_t* cart) {
+  return sizeof(gb_t) + cart->ram_size;
+}
+
+gb_t* gb_create(cart_t* cart) {
+  uint64_t start = clock_now_ns();
+
+  gb_t* gb = calloc(1, gb_arena_size(cart));
+  if (!gb) {
+    return NULL;
+  }
+  gb->cart = cart;
+
+  // There's no boot rom, start from the state it leaves behind
+  cpu_skip_boot(&gb->cpu);
+  mbc_init(&gb->mbc, &gb->mbc_regs, cart->cart_type);
+  idle_init(&gb->idle, cart);
+  uint64_t arena = clock_now_ns();
+
+  ext_ram_backing_t backing = getenv("FOZBOY_MMAP_SAVE") ? EXT_RAM_MMAP : EXT_RAM_HEAP;
+  if (ext_ram_init(&gb->ext_ram, cart->ram_size, gb->ext_ram_data,
+                   cart->file_name, backing) != 0) {
+    ext_ram_deinit(&gb->ext_ram);
+    free(gb);
+    return NULL;
+  }
+  uint64_t ext_ram = clock_now_ns();
+
+  // The mmu maps the ram banks, so it comes last
+  mmu_init(&gb->mmu, cart, &gb->mbc, &gb->ext_ram);
+  gb->mmu.gb = gb;
+
+  scheduler_init(&gb->sched);
+  ppu_init(gb);
+  timer_init(gb);
+  dma_init(gb);
+
+  gb->timing.arena_ns = (arena - start) + (clock_now_ns() - ext_ram);
+  gb->timing.ext_ram_ns = ext_ram - arena;
+  return gb;
+}
+
+void gb_destroy(gb_t* gb) {
+  if (!gb) return;
+  dynarec_destroy(gb->dynarec);
+  ext_ram_deinit(&gb->ext_ram);
+  free(gb);
+}
+
+// Moves a pointer that points into `from` to the same spot in `to`
+// Pointers outside the arena (cart rom, a mapped .sav) are left alone
+static uint8_t* rebase(uint8_t* ptr, gb_t* from, gb_t* to) {
+  uintptr_t p = (uintptr_t)ptr;
+  uintptr_t base = (uintptr_t)from;
+  if (ptr == NULL || p < base || p >= base + gb_arena_size(from->cart)) {
+    return ptr;
+  }
+  return (uint8_t*)to + (p - base);
+}
+
+gb_t* gb_clone(gb_t* gb) {
+  size_t size = gb_arena_size(gb->cart);
+  gb_t* clone = malloc(size);
+  if (!clone) {
+    return NULL;
+  }
+  memcpy(clone, gb, size);
+  clone->dynarec = NULL;
+
+  // A clone never saves, so it doesn't share the writer or the .sav name
+  ext_ram_t* ext_ram = &clone->ext_ram;
+  ext_ram->writer = NULL;
+  ext_ram->snapshot_filename = NULL;
+  ext_ram->owns_data = false;
+  memset(ext_ram->dirty, 0, sizeof(ext_ram->dirty));
+
+  // Mapped banks live in the .sav mapping, give the clone its own copy
+  uint8_t* old_data = ext_ram->data;
+  if (ext_ram->is_mapped) {
+    memcpy(clone->ext_ram_data, old_data, ext_ram->size);
+    ext_ram->data = clone->ext_ram_data;
+    ext_ram->is_mapped = false;
+  }
+  else {
+    ext_ram->data = rebase(old_data, gb, clone);
+  }
+
+  mmu_t* mmu = &clone->mmu;
+  mmu->gb = clone;
+  mmu->mbc = &clone->mbc;
+  mmu->ext_ram = &clone->ext_ram;
+  clone->mbc.regs = &clone->mbc_regs;
+
+  for (int i = 0; i < MMU_BLOCK_COUNT; i++) {
+    mmu->blocks[i].buf = rebase(mmu->blocks[i].buf, gb, clone);
+  }
+  if (mmu->blocks[MMU_EXT_RAM].buf != NULL) {
+    mmu->blocks[MMU_EXT_RAM].buf = get_ram_bank(ext_ram, mmu->current_ram_bank);
+  }
+  for (int i = 0; i < MMU_PAGE_COUNT; i++) {
+    mmu->read_pages[i] = rebase(mmu->read_pages[i], gb, clone);
+    mmu->write_pages[i] = rebase(mmu->write_pages[i], gb, clone);
+  }
+
+  return clone;
+}
+
+void gb_print_timing(gb_t* gb, FILE* out) {
+  cart_t* cart = gb->cart;
+  fprintf(out,
+      "startup: rom load %.3f ms (%ld bytes, %s), header %.3f ms, arena %.3f ms, ext ram %.3f ms\n",
+      cart->timing.load_ns / 1e6, cart->size, cart->is_mapped ? "mmap" : "heap",
+      cart->timing.header_ns / 1e6, gb->timing.arena_ns / 1e6, gb->timing.ext_ram_ns / 1e6);
+}
@@ -0,0 +1,78 @@
+#ifndef GB_H
+#define GB_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../cpu/cpu.h"
+#include "../cpu/idle.h"
+#include "../memory/mmu.h"
+#include "../cartridge/cart.h"
+#include "../cartridge/ext_ram.h"
+#include "../cartridge/mbc.h"
+#include "../processing/dma.h"
+#include "../processing/ppu.h"
+#include "../processing/timer.h"
+#include "scheduler.h"
+
+struct dynarec;
+
+// One frame is 154 lines of 456 t-cycles, about 59.73 frames a second
+#define GB_CYCLES_PER_FRAME 70224
+#define GB_FRAME_NS 16742706
+
+// Startup timing for gb_create, in nanoseconds
+typedef struct {
+  uint64_t arena_ns;   // the single allocation and mmu/mbc setup
+  uint64_t ext_ram_ns; // cart ram, including mapping or loading the .sav
+} gb_timing_t;
+
+// The whole machine in one allocation. Everything the emulator touches while
+// running is in here (apart from the cart rom, a mapped .sav and translated
+// code), so pointers between parts never leave the arena and the state can be
+// cloned with a copy and a rebase, see gb_clone
+typedef struct gb {
+  Cpu cpu;
+  mmu_t mmu;
+  mbc_t mbc;
+  mbc_regs_t mbc_regs;
+  ext_ram_t ext_ram;
+  cart_t* cart; // shared, not owned
+  gb_timing_t timing;
+
+  uint64_t cycles;       // t-cycles since power on
+  uint64_t instructions; // instructions retired, for benchmarks
+  scheduler_t sched;     // next deadline for each part, in cycles
+  gb_timer_t timer;      // DIV and TIMA, worked out from cycles
+  dma_t dma;             // hblank DMA progress
+  ppu_t ppu;             // decoded tiles and the frame being drawn
+  uint64_t halt_skipped; // t-cycles jumped over in HALT rather than idled
+  idle_t idle;           // busy wait loops seen, and how much they've skipped
+
+  // Translated code cache, made on the first dynarec_run_cycles (cpu/dynarec.h)
+  struct dynarec* dynarec;
+
+  // Heap backed cart ram, cart->ram_size bytes allocated with the rest, see
+  // gb_arena_size
+  uint8_t ext_ram_data[];
+} gb_t;
+
+// Bytes in a machine's arena, gb_t and the cart ram after it
+size_t gb_arena_size(const cart_t* cart);
+
+// Builds a machine around a loaded cart. Cart ram is backed by the .sav next
+// to the rom (mapped if FOZBOY_MMAP_SAVE is set)
+// Returns NULL on failure
+gb_t* gb_create(cart_t* cart);
+
+// Flushes cart ram and frees the machine, the cart is left alone
+void gb_destroy(gb_t* gb);
+
+// Copies the full machine state into a new arena. The clone shares the cart
+// but not the .sav, its cart ram is never saved. Translated code isn't copied
+// Returns NULL on failure
+gb_t* gb_clone(gb_t* gb);
+
+// Print the cart and machine startup timing as a single line
+void gb_print_timing(gb_t* gb, FILE* out);
+
+#endif
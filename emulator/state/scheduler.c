@@ -0,0 +1,67 @@
+#include "scheduler.h"
+#include "gb.h"
+#include "../processing/dma.h"
+#include "../processing/ppu.h"
+#include "../processing/timer.h"
+
+typedef void (*sched_handler_t)(gb_t* gb, uint64_t at);
+
+static const sched_handler_t HANDLERS[SCHED_COUNT] = {
+  [SCHED_PPU_LINE] = ppu_line,
+  [SCHED_PPU_MODE] = ppu_mode,
+  [SCHED_TIMER] = timer_overflow,
+  [SCHED_OAM_DMA] = dma_oam_end,
+  [SCHED_HDMA] = dma_hblank,
+};
+
+// A handful of slots, a scan beats keeping a heap in order
+static void update_next(scheduler_t* sched) {
+  uint64_t next = SCHED_NEVER;
+  for (int i = 0; i < SCHED_COUNT; i++) {
+    if (sched->at[i] < next) {
+      next = sched->at[i];
+    }
+  }
+  sched->next = next;
+}
+
+void scheduler_init(scheduler_t* sched) {
+  for (int i = 0; i < SCHED_COUNT; i++) {
+    sched->at[i] = SCHED_NEVER;
+  }
+  sched->next = SCHED_NEVER;
+}
+
+void scheduler_set(scheduler_t* sched, sched_event_t event, uint64_t at) {
+  sched->at[event] = at;
+  update_next(sched);
+}
+
+void scheduler_cancel(scheduler_t* sched, sched_event_t event) {
+  scheduler_set(sched, event, SCHED_NEVER);
+}
+
+bool scheduler_run_due(gb_t* gb) {
+  scheduler_t* sched = &gb->sched;
+  bool ended = false;
+
+  while (sched->next <= gb->cycles) {
+    int event = 0;
+    for (int i = 1; i < SCHED_COUNT; i++) {
+      if (sched->at[i] < sched->at[event]) {
+        event = i;
+      }
+    }
+
+    uint64_t at = sched->at[event];
+    scheduler_cancel(sched, event);
+    if (event == SCHED_END) {
+      ended = true;
+    }
+    else if (HANDLERS[event]) {
+      HANDLERS[event](gb, at);
+      sched->ran_at = gb->cycles;
+    }
+  }
+  return ended;
+}
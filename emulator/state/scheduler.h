@@ -0,0 +1,44 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct gb;
+
+// Time is driven by deadlines instead of ticking every part every m-cycle.
+// Each part keeps one slot with the absolute t-cycle (gb->cycles) it next
+// needs to run at, and the cpu runs without looking at anything else until
+// the earliest of them comes up
+typedef enum {
+  SCHED_END = 0, // end of the current cpu_run_cycles budget, no handler
+  SCHED_PPU_LINE, // LY moves on to the next line
+  SCHED_PPU_MODE, // STAT mode 2 to 3, or 3 to 0, on a visible line
+  SCHED_TIMER,    // TIMA overflows
+  SCHED_INTERRUPT, // one may be ready to take, no handler, the cpu checks
+  SCHED_OAM_DMA,   // OAM DMA done, the cpu can see oam again
+  SCHED_HDMA,      // hblank, time for the next block of an hblank DMA
+  SCHED_COUNT
+} sched_event_t;
+
+#define SCHED_NEVER UINT64_MAX
+
+typedef struct {
+  uint64_t next;            // earliest of at, what the cpu checks
+  uint64_t at[SCHED_COUNT]; // SCHED_NEVER when not scheduled
+  uint64_t ran_at;          // gb->cycles the last time a handler ran
+} scheduler_t;
+
+// Nothing scheduled
+void scheduler_init(scheduler_t* sched);
+
+// Runs event at cycle `at`, replacing any earlier time for it
+void scheduler_set(scheduler_t* sched, sched_event_t event, uint64_t at);
+void scheduler_cancel(scheduler_t* sched, sched_event_t event);
+
+// Runs every event that is due by gb->cycles, earliest first. Each handler
+// gets the cycle it was due at, so rescheduling from it doesn't drift
+// Returns true if SCHED_END was one of them
+bool scheduler_run_due(struct gb* gb);
+
+#endif
@@ -0,0 +1,41 @@
+// The machine the cpu, dynarec and part tests run programs on, imported by
+// them as "test_gb". Tests use this `c` so they share its C types
+const std = @import("std");
+pub const c = @cImport({
+    @cInclude("cpu/cpu.h");
+    @cInclude("cpu/dynarec.h");
+    @cInclude("cpu/instructions.h");
+    @cInclude("cpu/lazy_flags.h");
+    @cInclude("cartridge/cart.h");
+    @cInclude("state/gb.h");
+    @cInclude("processing/dma.h");
+    @cInclude("processing/palette.h");
+    @cInclude("processing/ppu.h");
+    @cInclude("processing/timer.h");
+    @cInclude("static/alu_tables.h");
+});
+
+pub const Cart = struct {
+    cart_type: c.cart_type_enum = c.ROM,
+    is_cgb: bool = false,
+};
+
+// Four bank rom image, `program` at the entry point (0x0100). Tests can put
+// more code in it after create, the cart reads it in place
+pub var rom: [0x10000]u8 = undefined;
+var cart: c.cart_t = undefined;
+
+// One machine at a time, a new one reuses the rom and cart
+pub fn create(options: Cart, program: []const u8) [*c]c.gb_t {
+    @memset(&rom, 0);
+    @memcpy(rom[0x100..][0..program.len], program);
+
+    cart = std.mem.zeroes(c.cart_t);
+    cart.cart_type = options.cart_type;
+    cart.is_cgb = options.is_cgb;
+    cart.data = &rom;
+    cart.size = rom.len;
+    cart.rom_banks = 4;
+    cart.rom_bank_mask = 3;
+    return c.gb_create(&cart);
+}
@@ -0,0 +1,171 @@
+//! Writes the ALU tables declared in alu_tables.h as a C source file.
+//! Run by `zig build`, the output path is the only argument.
+//! Flags are worked out here from the SM83 definitions, independently of
+//! instructions.c, and cpu.test.zig checks the two agree for every input
+
+const std = @import("std");
+
+const FLAG_Z: u8 = 0x80;
+const FLAG_N: u8 = 0x40;
+const FLAG_H: u8 = 0x20;
+const FLAG_C: u8 = 0x10;
+
+fn addFlags(a: u8, b: u8, carry: u1) u8 {
+    const sum: u16 = @as(u16, a) + b + carry;
+    var f: u8 = 0;
+    if (sum & 0xFF == 0) f |= FLAG_Z;
+    if ((a & 0x0F) + (b & 0x0F) + @as(u8, carry) > 0x0F) f |= FLAG_H;
+    if (sum > 0xFF) f |= FLAG_C;
+    return f;
+}
+
+fn subFlags(a: u8, b: u8, carry: u1) u8 {
+    var f: u8 = FLAG_N;
+    if (a -% b -% carry == 0) f |= FLAG_Z;
+    if ((a & 0x0F) < (b & 0x0F) + @as(u8, carry)) f |= FLAG_H;
+    if (@as(u16, a) < @as(u16, b) + carry) f |= FLAG_C;
+    return f;
+}
+
+fn addEntry(i: usize) u16 {
+    return addFlags(@intCast((i >> 8) & 0xFF), @intCast(i & 0xFF), @intCast(i >> 16));
+}
+
+fn subEntry(i: usize) u16 {
+    return subFlags(@intCast((i >> 8) & 0xFF), @intCast(i & 0xFF), @intCast(i >> 16));
+}
+
+fn incEntry(i: usize) u16 {
+    const v: u8 = @intCast(i);
+    var f: u8 = 0;
+    if (v +% 1 == 0) f |= FLAG_Z;
+    if (v & 0x0F == 0x0F) f |= FLAG_H;
+    return f;
+}
+
+fn decEntry(i: usize) u16 {
+    const v: u8 = @intCast(i);
+    var f: u8 = FLAG_N;
+    if (v -% 1 == 0) f |= FLAG_Z;
+    if (v & 0x0F == 0) f |= FLAG_H;
+    return f;
+}
+
+// https://gbdev.io/pandocs/CPU_Instruction_Set.html#daa
+fn daaEntry(i: usize) u16 {
+    const n = (i >> 8) & 4 != 0;
+    const h = (i >> 8) & 2 != 0;
+    var carry = (i >> 8) & 1 != 0;
+    var a: u8 = @intCast(i & 0xFF);
+
+    var adjust: u8 = 0;
+    if (h or (!n and (a & 0x0F) > 0x09)) adjust |= 0x06;
+    if (carry or (!n and a > 0x99)) {
+        adjust |= 0x60;
+        carry = true;
+    }
+    a = if (n) a -% adjust else a +% adjust;
+
+    var f: u8 = 0;
+    if (a == 0) f |= FLAG_Z;
+    if (n) f |= FLAG_N;
+    if (carry) f |= FLAG_C;
+    return @as(u16, a) << 8 | f;
+}
+
+fn shiftEntry(i: usize) u16 {
+    const carry_in: u8 = @intCast((i >> 8) & 1);
+    const v: u8 = @intCast(i & 0xFF);
+
+    var result: u8 = undefined;
+    var carry_out: bool = undefined;
+    switch (i >> 9) {
+        0 => { // RLC
+            result = v << 1 | v >> 7;
+            carry_out = v & 0x80 != 0;
+        },
+        1 => { // RRC
+            result = v >> 1 | v << 7;
+            carry_out = v & 0x01 != 0;
+        },
+        2 => { // RL
+            result = v << 1 | carry_in;
+            carry_out = v & 0x80 != 0;
+        },
+        3 => { // RR
+            result = v >> 1 | carry_in << 7;
+            carry_out = v & 0x01 != 0;
+        },
+        4 => { // SLA
+            result = v << 1;
+            carry_out = v & 0x80 != 0;
+        },
+        5 => { // SRA
+            result = v >> 1 | (v & 0x80);
+            carry_out = v & 0x01 != 0;
+        },
+        6 => { // SWAP
+            result = v >> 4 | v << 4;
+            carry_out = false;
+        },
+        else => { // SRL
+            result = v >> 1;
+            carry_out = v & 0x01 != 0;
+        },
+    }
+
+    var f: u8 = 0;
+    if (result == 0) f |= FLAG_Z;
+    if (carry_out) f |= FLAG_C;
+    return @as(u16, result) << 8 | f;
+}
+
+// Buffered output, the tables come to a few megabytes of text
+const Out = struct {
+    file: std.fs.File,
+    buf: [1 << 16]u8 = undefined,
+    len: usize = 0,
+
+    fn print(self: *Out, comptime fmt: []const u8, args: anytype) !void {
+        if (self.len + 256 > self.buf.len) try self.flush();
+        const written = try std.fmt.bufPrint(self.buf[self.len..], fmt, args);
+        self.len += written.len;
+    }
+
+    fn flush(self: *Out) !void {
+        try self.file.writeAll(self.buf[0..self.len]);
+        self.len = 0;
+    }
+};
+
+fn writeTable(out: *Out, comptime c_type: []const u8, comptime name: []const u8, len: usize, comptime entry: fn (usize) u16) !void {
+    try out.print("const " ++ c_type ++ " " ++ name ++ "[{d}] = {{\n", .{len});
+    for (0..len) |i| {
+        if (i % 16 == 0) try out.print(" ", .{});
+        try out.print(" {d},", .{entry(i)});
+        if (i % 16 == 15) try out.print("\n", .{});
+    }
+    try out.print("}};\n\n", .{});
+}
+
+pub fn main() !void {
+    const allocator = std.heap.page_allocator;
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
+    if (args.len != 2) return error.MissingOutputPath;
+
+    const file = try std.fs.cwd().createFile(args[1], .{});
+    defer file.close();
+
+    var out = Out{ .file = file };
+    try out.print("// Generated by emulator/static/alu_tables.gen.zig, do not edit\n\n", .{});
+    try out.print("#include \"static/alu_tables.h\"\n#include <stdint.h>\n\n", .{});
+
+    try writeTable(&out, "uint8_t", "ALU_ADD_FLAGS", 2 * 65536, addEntry);
+    try writeTable(&out, "uint8_t", "ALU_SUB_FLAGS", 2 * 65536, subEntry);
+    try writeTable(&out, "uint8_t", "ALU_INC_FLAGS", 256, incEntry);
+    try writeTable(&out, "uint8_t", "ALU_DEC_FLAGS", 256, decEntry);
+    try writeTable(&out, "uint16_t", "ALU_DAA", 8 * 256, daaEntry);
+    try writeTable(&out, "uint16_t", "ALU_SHIFT", 8 * 2 * 256, shiftEntry);
+    try out.flush();
+}
@@ -0,0 +1,26 @@
+#ifndef ALU_TABLES_H
+#define ALU_TABLES_H
+
+#include <stdint.h>
+
+// ALU flag and result tables, generated at build time by alu_tables.gen.zig.
+// Flags are laid out as in F (Z N H C in bits 7-4)
+
+// ADD/ADC and SUB/SBC/CP flags, index is carry << 16 | a << 8 | operand
+extern const uint8_t ALU_ADD_FLAGS[2 * 65536];
+extern const uint8_t ALU_SUB_FLAGS[2 * 65536];
+
+// Z, N and H for INC/DEC, by the value before. C is kept from F
+extern const uint8_t ALU_INC_FLAGS[256];
+extern const uint8_t ALU_DEC_FLAGS[256];
+
+// DAA, index is (F >> 4 & 7) << 8 | a, so N H C then A
+// Entries are result << 8 | flags
+extern const uint16_t ALU_DAA[8 * 256];
+
+// CB shift group: RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL in opcode order.
+// Index is op << 9 | carry << 8 | value, entries are result << 8 | flags.
+// RLCA/RRCA/RLA/RRA use the same entries with Z cleared
+extern const uint16_t ALU_SHIFT[8 * 2 * 256];
+
+#endif
@@ -0,0 +1,13 @@
+// Per cartridge idle loops, see idle_hack_t
+
+#include "idle_hacks.h"
+#include <stdint.h>
+
+// One line per loop, carts with several loops get several lines:
+//   { header checksum, global checksum, bank, loop start },
+// The loop has to end in a JR back to its start and pass the same checks as
+// a detected one, apart from where it reads. An entry is a promise that what
+// it reads only changes from the cpu or at an event
+const idle_hack_t IDLE_HACKS[] = {
+  { 0 },
+};
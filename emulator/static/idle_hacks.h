@@ -0,0 +1,19 @@
+#ifndef IDLE_HACKS_H
+#define IDLE_HACKS_H
+
+#include <stdint.h>
+
+// A loop known to be idle in one cartridge, for loops the detector in
+// cpu/idle.c can't prove are because they read wram or through a register
+// pair. They still can't write anything or count a register
+typedef struct {
+  uint8_t header_checksum;  // 0x14D
+  uint16_t global_checksum; // 0x14E-0x14F, big endian
+  uint16_t bank;            // rom bank the loop is in, 0 below 0x4000
+  uint16_t pc;              // loop start, where the jump back lands
+} idle_hack_t;
+
+// Ends with an entry where pc is 0
+extern const idle_hack_t IDLE_HACKS[];
+
+#endif
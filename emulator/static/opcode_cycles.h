@@ -0,0 +1,21 @@
+#ifndef OPCODE_CYCLES_H
+#define OPCODE_CYCLES_H
+
+#include <stdint.h>
+
+// Instruction timings in t-cycles (4 per m-cycle), indexed by opcode
+
+// Unprefixed opcodes, conditional branches not taken
+// 0xCB is 0, the prefixed instruction is counted by CB_OPCODE_CYCLES
+extern const uint8_t OPCODE_CYCLES[256];
+
+// Added to OPCODE_CYCLES when a conditional jr/jp/call/ret is taken
+extern const uint8_t OPCODE_BRANCH_CYCLES[256];
+
+// 0xCB prefixed opcodes, including the prefix fetch
+extern const uint8_t CB_OPCODE_CYCLES[256];
+
+// Instruction lengths in bytes, indexed by opcode. Unused opcodes are 1
+extern const uint8_t OPCODE_LENGTHS[256];
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+// Monotonic host clock, for timing and throttling. Not emulated time.
+// Translation units including this need _DEFAULT_SOURCE (or _POSIX_C_SOURCE)
+// defined before any system header when built with -std=c11
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t clock_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#endif
@@ -2,12 +2,16 @@ package main
 
 // #cgo CFLAGS: -I./zig-out/include
 // #cgo LDFLAGS: -L./zig-out/lib -lgbc
+// #include <stdlib.h>
 // #include "gbc.h"
 import "C"
 
 import (
 	"fmt"
 	"os"
+	"os/signal"
+	"syscall"
+	"unsafe"
 
 	tea "github.com/charmbracelet/bubbletea"
 	"github.com/onioncall/fozboy/tui"
@@ -24,6 +28,22 @@ func main() {
 		}
 	}
 
-	res := C.run()
+	romPath := ""
+	if len(os.Args) > 1 && os.Args[1] != "tui" {
+		romPath = os.Args[1]
+	}
+
+	cRomPath := C.CString(romPath)
+	defer C.free(unsafe.Pointer(cRomPath))
+
+	// Let the emulator stop between frames, so the save gets flushed
+	sigs := make(chan os.Signal, 1)
+	signal.Notify(sigs, os.Interrupt, syscall.SIGTERM)
+	go func() {
+		<-sigs
+		C.stop()
+	}()
+
+	res := C.run(cRomPath)
 	fmt.Println(res)
 }